@@ -0,0 +1,225 @@
+/**
+ * @file estimator_benchmark.cpp
+ *
+ * Per-call latency and heap allocations of the estimator's hot paths: the attitude and position
+ * models, one propagation and one measurement update of each filter, and a full estimator tick of
+ * both EstimatorContinuousDiscrete and EstimatorQuaternionINS.
+ *
+ * The full tick runs the real estimator in event-driven mode, fed the synthetic flight of
+ * synthetic_flight.hpp through the same sensor callbacks the subscriptions use. One iteration is
+ * one IMU sample, plus whatever other sensors are due at that stamp. The vehicle is armed and
+ * the stream is run for a warm-up period first, so the timed ticks are past the barometer
+ * calibration and the GPS initialization.
+ *
+ * The model, propagation and update benchmarks call the estimator's models directly
+ * (estimator_continuous_discrete_models.hpp) on the problem in filter_problem.hpp.
+ *
+ * allocs_per_call counts calls to the global operator new per iteration. The filters do not
+ * allocate, so a nonzero count on the model, propagation or update benchmarks is a regression. On
+ * the full tick, any allocation comes from the ROS side of the node.
+ *
+ * The stream and the problems are fixed, so runs on the same machine are comparable. Compare runs
+ * with google benchmark's compare.py, e.g. with --benchmark_repetitions=10 on both sides.
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include <benchmark/benchmark.h>
+
+#include "ekf_core.hpp"
+#include "estimator_continuous_discrete.hpp"
+#include "estimator_quaternion_ins.hpp"
+#include "filter_problem.hpp"
+#include "sensor_fed_estimator.hpp"
+#include "synthetic_flight.hpp"
+
+namespace
+{
+
+std::atomic<int64_t> allocation_count{0};
+
+} // namespace
+
+void * operator new(std::size_t size)
+{
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void * ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void * ptr) noexcept { std::free(ptr); }
+
+void operator delete(void * ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace
+{
+
+using namespace rosplane_benchmarks;
+
+/**
+ * Counts the allocations made while the benchmark loop runs and reports them per iteration.
+ */
+class AllocationCounter
+{
+public:
+  AllocationCounter()
+      : start_(allocation_count.load(std::memory_order_relaxed))
+  {}
+
+  void report(benchmark::State & state) const
+  {
+    const int64_t allocations = allocation_count.load(std::memory_order_relaxed) - start_;
+    state.counters["allocs_per_call"] =
+      benchmark::Counter(static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+  }
+
+private:
+  int64_t start_;
+};
+
+const FilterProblem problem;
+
+void BM_AttitudeDynamics(benchmark::State & state)
+{
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(attitude_dynamics(problem.x_a, problem.angular_rates));
+  }
+  allocations.report(state);
+}
+BENCHMARK(BM_AttitudeDynamics);
+
+void BM_PositionJacobian(benchmark::State & state)
+{
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(position_jacobian(problem.x_p, problem.position_inputs));
+  }
+  allocations.report(state);
+}
+BENCHMARK(BM_PositionJacobian);
+
+void BM_AttitudePropagate(benchmark::State & state)
+{
+  const Eigen::Matrix2f Q = problem.Q_a_diagonal.asDiagonal();
+  const Eigen::Matrix3f Q_g = problem.Q_g_diagonal.asDiagonal();
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    auto x = problem.x_a;
+    auto P = problem.P_a;
+    AttitudeEKF::propagate(x, P, problem.angular_rates, attitude_dynamics, attitude_jacobian,
+                           attitude_input_jacobian, Q, Q_g, Ts, num_propagation_steps);
+    benchmark::DoNotOptimize(P);
+  }
+  allocations.report(state);
+}
+BENCHMARK(BM_AttitudePropagate);
+
+void BM_PositionPropagate(benchmark::State & state)
+{
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    auto x = problem.x_p;
+    auto P = problem.P_p;
+    PositionEKF::propagate_structured<4>(x, P, problem.position_inputs, position_dynamics,
+                                         position_jacobian, problem.Q_p_diagonal, Ts,
+                                         num_propagation_steps);
+    benchmark::DoNotOptimize(P);
+  }
+  allocations.report(state);
+}
+BENCHMARK(BM_PositionPropagate);
+
+void BM_AttitudeMeasurementUpdate(benchmark::State & state)
+{
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    auto x = problem.x_a;
+    auto P = problem.P_a;
+    auto innovation = AttitudeEKF::measurement_update(
+      x, P, problem.attitude_measurement_inputs, attitude_measurement_prediction,
+      attitude_measurement_jacobian, problem.y_accel, problem.R_accel);
+    benchmark::DoNotOptimize(innovation);
+    benchmark::DoNotOptimize(P);
+  }
+  allocations.report(state);
+}
+BENCHMARK(BM_AttitudeMeasurementUpdate);
+
+void BM_PositionMeasurementUpdate(benchmark::State & state)
+{
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    auto x = problem.x_p;
+    auto P = problem.P_p;
+    auto innovation = PositionEKF::sequential_measurement_update(
+      x, P, problem.va, position_measurement_prediction, position_measurement_jacobian,
+      problem.y_gps, problem.R_gps_diagonal);
+    benchmark::DoNotOptimize(innovation);
+    benchmark::DoNotOptimize(P);
+  }
+  allocations.report(state);
+}
+BENCHMARK(BM_PositionMeasurementUpdate);
+
+/**
+ * An estimator, continuous-discrete or quaternion INS, fed the synthetic flight through its sensor
+ * callbacks. The estimated state is kept rather than published.
+ */
+template<typename Estimator>
+class BenchmarkEstimator : public rosplane::SensorFedEstimator<Estimator>
+{
+public:
+  const rosplane_msgs::msg::State & last_state() const { return last_state_; }
+
+protected:
+  void publish_state(const rosplane_msgs::msg::State & msg) override { last_state_ = msg; }
+
+private:
+  rosplane_msgs::msg::State last_state_;
+};
+
+constexpr int warm_up_ticks = 3000;
+
+template<typename Estimator>
+void BM_EstimateTick(benchmark::State & state)
+{
+  auto estimator = std::make_shared<BenchmarkEstimator<Estimator>>();
+  SyntheticFlight flight;
+  flight.arm(*estimator);
+  for (int i = 0; i < warm_up_ticks; i++) {
+    flight.feed_tick(*estimator);
+  }
+
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    flight.feed_tick(*estimator);
+  }
+  allocations.report(state);
+
+  // A drifting estimate would make the timings meaningless, so report where the filter is.
+  state.counters["phi"] = estimator->last_state().phi;
+  state.counters["vg"] = estimator->last_state().vg;
+}
+BENCHMARK_TEMPLATE(BM_EstimateTick, rosplane::EstimatorContinuousDiscrete);
+BENCHMARK_TEMPLATE(BM_EstimateTick, rosplane::EstimatorQuaternionINS);
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+  rclcpp::init(argc, argv);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    rclcpp::shutdown();
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  rclcpp::shutdown();
+  return 0;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file filter_problem.hpp
+ *
+ * The fixed attitude and position filter problem the estimator benchmarks run on: states,
+ * covariances, inputs, noise and measurements in the range EstimatorContinuousDiscrete sees in
+ * flight, so runs on the same machine are comparable.
+ */
+
+#ifndef FILTER_PROBLEM_H
+#define FILTER_PROBLEM_H
+
+#include <cmath>
+
+#include <Eigen/Dense>
+
+#include "ekf_core.hpp"
+#include "estimator_continuous_discrete_models.hpp"
+
+namespace rosplane_benchmarks
+{
+
+using AttitudeEKF = rosplane::EKFCore<2, 3>;
+using PositionEKF = rosplane::EKFCore<7, 6>;
+
+constexpr double gravity = 9.8; // The estimator's default gravity parameter
+constexpr float Ts = 0.01f;
+constexpr int num_propagation_steps = 10;
+
+struct FilterProblem
+{
+  AttitudeEKF::StateVector x_a;
+  AttitudeEKF::StateMatrix P_a;
+  AttitudeEKF::InputVector angular_rates;
+  Eigen::Vector2f Q_a_diagonal;
+  Eigen::Vector3f Q_g_diagonal;
+  Eigen::Matrix3f R_accel;
+  Eigen::Vector3f y_accel;
+  Eigen::Vector4f attitude_measurement_inputs;
+
+  PositionEKF::StateVector x_p;
+  PositionEKF::StateMatrix P_p;
+  PositionEKF::InputVector position_inputs;
+  PositionEKF::StateVector Q_p_diagonal;
+  Eigen::Matrix<float, 6, 1> y_gps;
+  Eigen::Matrix<float, 6, 1> R_gps_diagonal;
+  Eigen::Matrix<float, 1, 1> va;
+
+  FilterProblem()
+  {
+    x_a << 0.2f, 0.05f;
+    P_a << 0.02f, 0.004f, 0.004f, 0.03f;
+    angular_rates << 0.05f, 0.1f, 0.2f;
+    Q_a_diagonal << 1e-9f, 1e-9f;
+    Q_g_diagonal.setConstant(0.13f * 0.13f * 3e-4f);
+    R_accel = Eigen::Matrix3f::Identity() * std::pow(0.0025f * gravity, 2.0f);
+    attitude_measurement_inputs << 0.05f, 0.1f, 0.2f, 20.0f;
+
+    x_p << 10.0f, -5.0f, 20.0f, 0.3f, 1.0f, -2.0f, 0.25f;
+    Eigen::Matrix<float, 7, 7> B = Eigen::Matrix<float, 7, 7>::Identity();
+    B.row(0) << 0.9f, 0.1f, 0.0f, 0.2f, 0.0f, 0.1f, 0.0f;
+    B.row(3) << 0.0f, 0.0f, 0.2f, 0.3f, 0.0f, 0.1f, 0.1f;
+    B.row(6) << 0.0f, 0.1f, 0.0f, 0.1f, 0.0f, 0.0f, 0.4f;
+    P_p = B * B.transpose();
+    position_inputs << 0.05f, 0.1f, 0.2f, 0.2f, 0.05f, 20.0f;
+    Q_p_diagonal.setConstant(0.1f);
+    R_gps_diagonal << 0.0441f, 0.0441f, 0.0025f, 0.0016f, 0.01f, 0.01f;
+    va << 20.0f;
+    y_gps << 10.4f, -4.7f, 20.2f, 0.29f, 0.0f, 0.0f;
+
+    y_accel = rosplane::continuous_discrete::attitude_measurement_prediction(
+                x_a, attitude_measurement_inputs, gravity)
+      + Eigen::Vector3f(0.05f, -0.03f, 0.02f);
+  }
+};
+
+/**
+ * The estimator's models, as the callables the EKF operations take.
+ */
+const auto attitude_dynamics = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::attitude_dynamics(x, u);
+};
+const auto attitude_jacobian = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::attitude_jacobian(x, u);
+};
+const auto attitude_input_jacobian = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::attitude_input_jacobian(x, u);
+};
+const auto attitude_measurement_prediction = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::attitude_measurement_prediction(x, u, gravity);
+};
+const auto attitude_measurement_jacobian = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::attitude_measurement_jacobian(x, u, gravity);
+};
+const auto position_dynamics = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::position_dynamics(x, u, gravity);
+};
+const auto position_jacobian = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::position_jacobian(x, u, gravity);
+};
+const auto position_measurement_prediction = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::position_measurement_prediction(x, u);
+};
+const auto position_measurement_jacobian = [](const auto & x, const auto & u) {
+  return rosplane::continuous_discrete::position_measurement_jacobian(x, u);
+};
+
+} // namespace rosplane_benchmarks
+
+#endif // FILTER_PROBLEM_H
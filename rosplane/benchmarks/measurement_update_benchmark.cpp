@@ -0,0 +1,93 @@
+/**
+ * @file measurement_update_benchmark.cpp
+ *
+ * Compares the batch and sequential EKF measurement updates on the seven state position filter
+ * with the estimator's six element GPS measurement, for cost and for agreement of the resulting
+ * state and covariance.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "filter_problem.hpp"
+
+namespace
+{
+
+using namespace rosplane_benchmarks;
+
+const FilterProblem problem;
+
+void batch_update(PositionEKF::StateVector & x, PositionEKF::StateMatrix & P)
+{
+  const Eigen::Matrix<float, 6, 6> R = problem.R_gps_diagonal.asDiagonal();
+  PositionEKF::measurement_update(x, P, problem.va, position_measurement_prediction,
+                                  position_measurement_jacobian, problem.y_gps, R);
+}
+
+void sequential_update(PositionEKF::StateVector & x, PositionEKF::StateMatrix & P, bool joseph_form)
+{
+  PositionEKF::sequential_measurement_update(x, P, problem.va, position_measurement_prediction,
+                                             position_measurement_jacobian, problem.y_gps,
+                                             problem.R_gps_diagonal, 0.0f, joseph_form);
+}
+
+/**
+ * Reports how far the sequential result is from the batch result.
+ */
+void report_agreement(benchmark::State & state, bool joseph_form)
+{
+  PositionEKF::StateVector x_batch = problem.x_p;
+  PositionEKF::StateMatrix P_batch = problem.P_p;
+  batch_update(x_batch, P_batch);
+
+  PositionEKF::StateVector x_sequential = problem.x_p;
+  PositionEKF::StateMatrix P_sequential = problem.P_p;
+  sequential_update(x_sequential, P_sequential, joseph_form);
+
+  state.counters["max_state_diff"] = (x_sequential - x_batch).cwiseAbs().maxCoeff();
+  state.counters["max_cov_diff"] = (P_sequential - P_batch).cwiseAbs().maxCoeff();
+  state.counters["cov_asymmetry"] =
+    (P_sequential - P_sequential.transpose()).cwiseAbs().maxCoeff();
+}
+
+void BM_BatchMeasurementUpdate(benchmark::State & state)
+{
+  for (auto _ : state) {
+    PositionEKF::StateVector x = problem.x_p;
+    PositionEKF::StateMatrix P = problem.P_p;
+    batch_update(x, P);
+    benchmark::DoNotOptimize(x);
+    benchmark::DoNotOptimize(P);
+  }
+}
+BENCHMARK(BM_BatchMeasurementUpdate);
+
+void BM_SequentialMeasurementUpdate(benchmark::State & state)
+{
+  for (auto _ : state) {
+    PositionEKF::StateVector x = problem.x_p;
+    PositionEKF::StateMatrix P = problem.P_p;
+    sequential_update(x, P, false);
+    benchmark::DoNotOptimize(x);
+    benchmark::DoNotOptimize(P);
+  }
+  report_agreement(state, false);
+}
+BENCHMARK(BM_SequentialMeasurementUpdate);
+
+void BM_SequentialJosephMeasurementUpdate(benchmark::State & state)
+{
+  for (auto _ : state) {
+    PositionEKF::StateVector x = problem.x_p;
+    PositionEKF::StateMatrix P = problem.P_p;
+    sequential_update(x, P, true);
+    benchmark::DoNotOptimize(x);
+    benchmark::DoNotOptimize(P);
+  }
+  report_agreement(state, true);
+}
+BENCHMARK(BM_SequentialJosephMeasurementUpdate);
+
+} // namespace
+
+BENCHMARK_MAIN();
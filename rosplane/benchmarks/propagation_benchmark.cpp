@@ -0,0 +1,155 @@
+/**
+ * @file propagation_benchmark.cpp
+ *
+ * Compares the generic dense EKF propagation against the structured propagation for the attitude
+ * and position filters, for the cost of one estimator tick and for agreement of the resulting
+ * covariance. flops_per_tick counts the floating point operations of the covariance products
+ * (two per multiply-add); the model evaluations are the same in both paths and are not counted.
+ *
+ * The estimator only uses the structured path for the position filter. The attitude filter has no
+ * zero jacobian rows to skip, and the structured path there is slower despite its lower flop count.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "filter_problem.hpp"
+
+namespace
+{
+
+using namespace rosplane_benchmarks;
+
+constexpr double product_flops(int rows, int inner, int cols) { return 2.0 * rows * inner * cols; }
+
+/**
+ * Flops of one sub-step of EKFCore::propagate: A * A, A_d * P * A_d' and G * Q_g * G'.
+ */
+constexpr double generic_flops(int N, int G)
+{
+  return 3 * product_flops(N, N, N) + product_flops(N, G, G) + product_flops(N, G, N);
+}
+
+/**
+ * Flops of one sub-step of EKFCore::propagate_structured: the leading K rows of A * A and A_d * P,
+ * the K x K block of A_d * P * A_d' and G * diag(Q_g) * G'.
+ */
+constexpr double structured_flops(int N, int K, int G)
+{
+  return product_flops(K, K, N) + product_flops(K, N, N) + product_flops(K, N, K)
+    + (G > 0 ? K * G + product_flops(K, G, K) : 0.0);
+}
+
+const FilterProblem problem;
+
+void attitude_generic(AttitudeEKF::StateVector & x, AttitudeEKF::StateMatrix & P)
+{
+  const Eigen::Matrix2f Q = problem.Q_a_diagonal.asDiagonal();
+  const Eigen::Matrix3f Q_g = problem.Q_g_diagonal.asDiagonal();
+  AttitudeEKF::propagate(x, P, problem.angular_rates, attitude_dynamics, attitude_jacobian,
+                         attitude_input_jacobian, Q, Q_g, Ts, num_propagation_steps);
+}
+
+void attitude_structured(AttitudeEKF::StateVector & x, AttitudeEKF::StateMatrix & P)
+{
+  AttitudeEKF::propagate_structured<2>(x, P, problem.angular_rates, attitude_dynamics,
+                                       attitude_jacobian, attitude_input_jacobian,
+                                       problem.Q_a_diagonal, problem.Q_g_diagonal, Ts,
+                                       num_propagation_steps);
+}
+
+void position_generic(PositionEKF::StateVector & x, PositionEKF::StateMatrix & P)
+{
+  const Eigen::Matrix<float, 7, 7> Q = problem.Q_p_diagonal.asDiagonal();
+  PositionEKF::propagate(
+    x, P, problem.position_inputs, position_dynamics, position_jacobian,
+    [](const auto &, const auto &) { return Eigen::Matrix<float, 7, 7>::Zero().eval(); }, Q,
+    Eigen::Matrix<float, 7, 7>::Zero().eval(), Ts, num_propagation_steps);
+}
+
+void position_structured(PositionEKF::StateVector & x, PositionEKF::StateMatrix & P)
+{
+  PositionEKF::propagate_structured<4>(x, P, problem.position_inputs, position_dynamics,
+                                       position_jacobian, problem.Q_p_diagonal, Ts,
+                                       num_propagation_steps);
+}
+
+/**
+ * Runs one tick with both paths and records how far apart the results are.
+ */
+template<typename StateVector, typename StateMatrix, typename Propagate>
+void record_agreement(benchmark::State & state, const StateVector & x, const StateMatrix & P,
+                      Propagate generic, Propagate structured)
+{
+  StateVector x_generic = x;
+  StateMatrix P_generic = P;
+  generic(x_generic, P_generic);
+
+  StateVector x_structured = x;
+  StateMatrix P_structured = P;
+  structured(x_structured, P_structured);
+
+  state.counters["max_state_diff"] = (x_structured - x_generic).cwiseAbs().maxCoeff();
+  state.counters["max_cov_diff"] = (P_structured - P_generic).cwiseAbs().maxCoeff();
+}
+
+void record_flops(benchmark::State & state, double flops_per_step)
+{
+  const double flops_per_tick = flops_per_step * num_propagation_steps;
+  state.counters["flops_per_tick"] = flops_per_tick;
+  state.counters["flop_rate"] =
+    benchmark::Counter(flops_per_tick, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void BM_AttitudeGenericPropagate(benchmark::State & state)
+{
+  for (auto _ : state) {
+    auto x = problem.x_a;
+    auto P = problem.P_a;
+    attitude_generic(x, P);
+    benchmark::DoNotOptimize(P);
+  }
+  record_flops(state, generic_flops(2, 3));
+}
+BENCHMARK(BM_AttitudeGenericPropagate);
+
+void BM_AttitudeStructuredPropagate(benchmark::State & state)
+{
+  for (auto _ : state) {
+    auto x = problem.x_a;
+    auto P = problem.P_a;
+    attitude_structured(x, P);
+    benchmark::DoNotOptimize(P);
+  }
+  record_flops(state, structured_flops(2, 2, 3));
+  record_agreement(state, problem.x_a, problem.P_a, attitude_generic, attitude_structured);
+}
+BENCHMARK(BM_AttitudeStructuredPropagate);
+
+void BM_PositionGenericPropagate(benchmark::State & state)
+{
+  for (auto _ : state) {
+    auto x = problem.x_p;
+    auto P = problem.P_p;
+    position_generic(x, P);
+    benchmark::DoNotOptimize(P);
+  }
+  record_flops(state, generic_flops(7, 7));
+}
+BENCHMARK(BM_PositionGenericPropagate);
+
+void BM_PositionStructuredPropagate(benchmark::State & state)
+{
+  for (auto _ : state) {
+    auto x = problem.x_p;
+    auto P = problem.P_p;
+    position_structured(x, P);
+    benchmark::DoNotOptimize(P);
+  }
+  record_flops(state, structured_flops(7, 4, 0));
+  record_agreement(state, problem.x_p, problem.P_p, position_generic, position_structured);
+}
+BENCHMARK(BM_PositionStructuredPropagate);
+
+} // namespace
+
+BENCHMARK_MAIN();
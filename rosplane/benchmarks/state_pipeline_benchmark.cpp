@@ -0,0 +1,127 @@
+/**
+ * @file state_pipeline_benchmark.cpp
+ *
+ * End-to-end latency from an IMU sample to the actuator command it produces, through the real
+ * estimator, path planner, path manager, path follower and controller, with and without
+ * intra-process communication.
+ *
+ * The nodes are the components of launch/rosplane_composed.launch.py: EstimatorContinuousDiscrete,
+ * PathPlanner, PathManagerExample, PathFollowerExample and ControllerSucessiveLoop, all spun by one
+ * single-threaded executor as in the component container. The controller runs with
+ * control_on_state, so each new estimated state is controlled as soon as it arrives. The estimator
+ * is fed the synthetic flight of synthetic_flight.hpp through its sensor callbacks, in event-driven
+ * mode, and a probe node subscribes to the controller's command topic.
+ *
+ * One iteration feeds one IMU sample, plus whatever other sensors are due at its stamp, which
+ * steps the estimator and publishes the estimated state, and ends when the probe receives the
+ * command the controller computed from it. The executor also serves the manager's and follower's
+ * timers while it waits, as the container would, so their cost lands in the iterations they fall
+ * in. The pipeline is run until the controller publishes commands before timing starts.
+ *
+ * With intra_process:0 the messages go through the middleware, serialized by each publisher and
+ * deserialized by each subscriber. With intra_process:1 they are handed over in memory.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <rclcpp/rclcpp.hpp>
+
+#include "controller_successive_loop.hpp"
+#include "estimator_continuous_discrete.hpp"
+#include "path_follower_example.hpp"
+#include "path_manager_example.hpp"
+#include "path_planner.hpp"
+#include "rosflight_msgs/msg/command.hpp"
+#include "sensor_fed_estimator.hpp"
+#include "synthetic_flight.hpp"
+
+namespace
+{
+
+using rosplane_benchmarks::SyntheticFlight;
+
+constexpr auto delivery_timeout = std::chrono::seconds(1);
+constexpr auto warm_up_timeout = std::chrono::seconds(10);
+
+void BM_ImuToCommandLatency(benchmark::State & state)
+{
+  rclcpp::NodeOptions options;
+  options.use_intra_process_comms(state.range(0) != 0);
+
+  auto estimator =
+    std::make_shared<rosplane::SensorFedEstimator<rosplane::EstimatorContinuousDiscrete>>(options);
+  auto planner = std::make_shared<rosplane::PathPlanner>(options);
+  auto manager = std::make_shared<rosplane::PathManagerExample>(options);
+  auto follower = std::make_shared<rosplane::PathFollowerExample>(options);
+  auto controller = std::make_shared<rosplane::ControllerSucessiveLoop>(
+    rclcpp::NodeOptions(options).parameter_overrides({{"control_on_state", true}}));
+
+  auto probe = std::make_shared<rclcpp::Node>("pipeline_probe", options);
+  int64_t commands_received = 0;
+  auto command_sub = probe->create_subscription<rosflight_msgs::msg::Command>(
+    "command", 10,
+    [&commands_received](rosflight_msgs::msg::Command::ConstSharedPtr) { commands_received++; });
+
+  rclcpp::executors::SingleThreadedExecutor executor;
+  executor.add_node(estimator);
+  executor.add_node(planner);
+  executor.add_node(manager);
+  executor.add_node(follower);
+  executor.add_node(controller);
+  executor.add_node(probe);
+
+  // Fly until the path has reached the follower and its commands the controller, so the timed
+  // iterations run the whole chain.
+  SyntheticFlight flight;
+  flight.arm(*estimator);
+  auto warm_up_start = std::chrono::steady_clock::now();
+  while (commands_received == 0) {
+    if (std::chrono::steady_clock::now() - warm_up_start > warm_up_timeout) {
+      state.SkipWithError("The controller did not publish commands");
+      return;
+    }
+    flight.feed_tick(*estimator);
+    executor.spin_some(std::chrono::milliseconds(10));
+  }
+
+  for (auto _ : state) {
+    int64_t commands_before = commands_received;
+
+    auto start = std::chrono::steady_clock::now();
+    flight.feed_tick(*estimator);
+    while (commands_received == commands_before) {
+      executor.spin_some();
+      if (std::chrono::steady_clock::now() - start > delivery_timeout) {
+        state.SkipWithError("No command was published for the state");
+        return;
+      }
+    }
+    state.SetIterationTime(
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+}
+BENCHMARK(BM_ImuToCommandLatency)
+  ->ArgName("intra_process")
+  ->Arg(0)
+  ->Arg(1)
+  ->UseManualTime()
+  ->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+  rclcpp::init(argc, argv);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    rclcpp::shutdown();
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  rclcpp::shutdown();
+  return 0;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file synthetic_flight.hpp
+ *
+ * A synthetic, deterministic sensor stream for driving the real estimator without a log, shared by
+ * the estimator benchmark and the tests: 100 Hz IMU, 50 Hz barometer and airspeed and 10 Hz GPS,
+ * for an aircraft flying straight and level north at 20 m/s while rolling back and forth by a few
+ * degrees.
+ */
+
+#ifndef SYNTHETIC_FLIGHT_H
+#define SYNTHETIC_FLIGHT_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "filter_problem.hpp"
+#include "geodesy.hpp"
+#include "sensor_fed_estimator.hpp"
+
+namespace rosplane_benchmarks
+{
+
+struct SyntheticFlight
+{
+  static constexpr double va = 20.0;              // Airspeed and ground speed, no wind (m/s)
+  static constexpr double roll_amplitude = 0.1;   // rad
+  static constexpr double roll_frequency = 0.5;   // rad/s
+  static constexpr int64_t imu_per_second = 100;
+  static constexpr int64_t imu_per_baro = 2;
+  static constexpr int64_t imu_per_gps = 10;
+
+  int64_t tick = 0; /**< IMU samples fed so far */
+
+  /**
+   * @brief Arms the estimator, as the flight controller's status would once the vehicle is armed.
+   */
+  template<typename Estimator>
+  static void arm(rosplane::SensorFedEstimator<Estimator> & estimator)
+  {
+    estimator.feed_status(builtin_interfaces::msg::Time(), true);
+  }
+
+  /**
+   * @brief Feeds the sensor messages of one IMU period: the IMU sample, plus whatever other
+   * sensors are due at its stamp.
+   */
+  template<typename Estimator>
+  void feed_tick(rosplane::SensorFedEstimator<Estimator> & estimator)
+  {
+    const double t = tick * static_cast<double>(Ts);
+    builtin_interfaces::msg::Time stamp;
+    stamp.sec = static_cast<int32_t>(tick / imu_per_second);
+    stamp.nanosec = static_cast<uint32_t>((tick % imu_per_second) * (1000000000 / imu_per_second));
+
+    const double phi = roll_amplitude * std::sin(roll_frequency * t);
+    const double roll_rate = roll_amplitude * roll_frequency * std::cos(roll_frequency * t);
+    estimator.feed_imu(stamp, roll_rate, 0.0, 0.0, 0.0, -gravity * std::sin(phi),
+                       -gravity * std::cos(phi));
+
+    if (tick % imu_per_baro == 0) {
+      estimator.feed_baro(stamp, 101325.0);
+      estimator.feed_airspeed(stamp, 0.5 * 1.225 * va * va);
+    }
+
+    if (tick % imu_per_gps == 0) {
+      estimator.feed_gnss_fix(stamp, sensor_msgs::msg::NavSatStatus::STATUS_FIX,
+                              40.0 + va * t / rosplane::WGS84_A * 180.0 / M_PI, -111.0, 1400.0);
+      estimator.feed_gnss_vel(stamp, va, 0.0, 0.0);
+    }
+
+    tick++;
+  }
+};
+
+} // namespace rosplane_benchmarks
+
+#endif // SYNTHETIC_FLIGHT_H
@@ -0,0 +1,34 @@
+/**
+ * @file angles.hpp
+ *
+ * Angle helpers shared by the estimator, the path follower and the controller. They are inline so
+ * that nodes built into separate component libraries and loaded into one process do not carry
+ * competing definitions.
+ */
+
+#ifndef ANGLES_H
+#define ANGLES_H
+
+#include <cmath>
+
+namespace rosplane
+{
+
+inline float radians(float degrees) { return M_PI * degrees / 180.0; }
+
+/**
+ * @brief Wraps an angle to within pi of another.
+ *
+ * @param fixed_heading The angle to wrap around (rad).
+ * @param wrapped_heading The angle to wrap (rad).
+ * @return wrapped_heading plus or minus a multiple of 2 pi, within pi of fixed_heading.
+ */
+inline double wrap_within_180(double fixed_heading, double wrapped_heading)
+{
+  // wrapped_heading - number_of_times_to_wrap * 2pi
+  return wrapped_heading - floor((wrapped_heading - fixed_heading) / (2 * M_PI) + 0.5) * 2 * M_PI;
+}
+
+} // namespace rosplane
+
+#endif // ANGLES_H
@@ -18,6 +18,7 @@
 #include "param_manager.hpp"
 #include "rosplane_msgs/msg/controller_commands.hpp"
 #include "rosplane_msgs/msg/controller_internals.hpp"
+#include "rosplane_msgs/msg/controller_watchdog.hpp"
 #include "rosplane_msgs/msg/state.hpp"
 
 using std::placeholders::_1;
@@ -35,6 +36,18 @@ enum class AltZones
   ALTITUDE_HOLD /**< In the altitude hold zone the aircraft keeps altitude and follows commanded course */
 };
 
+/**
+ * What the controller flies while the controller commands are stale. While the state is stale
+ * the loops cannot be closed, so it always flies FIXED_THROTTLE.
+ */
+enum class FailsafeMode
+{
+  WINGS_LEVEL,    /**< Hold the current course and the last commanded altitude and airspeed */
+  FIXED_THROTTLE, /**< Neutral surfaces and the failsafe_throttle, open loop */
+  LOITER          /**< Circle at the failsafe_loiter_roll angle, holding the last commanded
+                       altitude and airspeed */
+};
+
 /**
  * This class implements all of the basic functionality of a controller interfacing with ROS2.
  */
@@ -45,7 +58,7 @@ public:
   /**
    * Constructor for ROS2 setup and parameter initialization.
    */
-  ControllerBase();
+  explicit ControllerBase(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
 
   /**
    * Gets the current phi_c value from the current private command message.
@@ -53,7 +66,7 @@ public:
    * @return The latest phi_c value in the controller commands message, as received by the
    * ROS callback.
    */
-  float get_phi_c() { return controller_commands_.phi_c; }
+  float get_phi_c() { return controller_commands_->phi_c; }
 
   /**
    * Gets the current theta_c value from the current private command message.
@@ -61,7 +74,7 @@ public:
    * @return The latest theta_c value in the controller commands message, as received by the
    * ROS callback.
    */
-  float get_theta_c() { return controller_commands_.theta_c; };
+  float get_theta_c() { return controller_commands_->theta_c; };
 
 protected:
   /**
@@ -69,7 +82,7 @@ protected:
    */
   struct Input
   {
-    float Ts;     /**< time step */
+    float Ts;     /**< time step (s) since the last call of control() */
     float h;      /**< altitude */
     float va;     /**< airspeed */
     float phi;    /**< roll angle */
@@ -110,6 +123,13 @@ protected:
    */
   virtual void control(const Input & input, Output & output) = 0;
 
+  /**
+   * Called from the parameter callback after the params_ object has been updated, once the
+   * controller base has been constructed. Controllers that compile values from the parameters
+   * rebuild them here.
+   */
+  virtual void parameters_changed() {}
+
 private:
   /**
    * This publisher publishes the final calculated control surface deflections.
@@ -121,6 +141,11 @@ private:
    */
   rclcpp::Publisher<rosplane_msgs::msg::ControllerInternals>::SharedPtr controller_internals_pub_;
 
+  /**
+   * This publisher publishes the state of the input watchdog when it changes.
+   */
+  rclcpp::Publisher<rosplane_msgs::msg::ControllerWatchdog>::SharedPtr watchdog_pub_;
+
   /**
    * This subscriber subscribes to the commands the controller uses to calculate control effort.
    */
@@ -141,6 +166,58 @@ private:
    */
   std::chrono::microseconds timer_period_;
 
+  /**
+   * True to run the control on the arrival of each new state rather than on the timer, which then
+   * only watches for the state to stop arriving.
+   */
+  bool control_on_state_;
+
+  /**
+   * Stamp of the last state the control ran on in control_on_state_ mode.
+   */
+  rclcpp::Time last_state_stamp_;
+
+  /**
+   * Age after which the state and the controller commands are stale and the failsafe is flown.
+   */
+  rclcpp::Duration state_timeout_;
+  rclcpp::Duration command_timeout_;
+
+  /**
+   * What to fly while the controller commands are stale.
+   */
+  FailsafeMode failsafe_mode_;
+
+  /**
+   * Times the last state and controller commands were received, on the node's clock.
+   */
+  rclcpp::Time last_state_receive_time_;
+  rclcpp::Time last_command_receive_time_;
+
+  /**
+   * Flag to indicate if the first state has been received.
+   */
+  bool state_received_;
+
+  /**
+   * Flags set by check_inputs() while the state or the controller commands are older than their
+   * timeouts.
+   */
+  bool state_stale_;
+  bool command_stale_;
+
+  /**
+   * Flag to indicate that the watchdog state has been published at least once.
+   */
+  bool watchdog_published_;
+
+  /**
+   * Course, altitude and airspeed held by the failsafe, saved when the commands went stale.
+   */
+  float failsafe_chi_;
+  float failsafe_h_;
+  float failsafe_va_;
+
   /**
    * Flag that determines when params have been initialized to prevent errors when setting the timer
    */
@@ -149,18 +226,31 @@ private:
   /**
    * The stored value for the most up to date commands for the controller.
    */
-  rosplane_msgs::msg::ControllerCommands controller_commands_;
+  rosplane_msgs::msg::ControllerCommands::ConstSharedPtr controller_commands_;
 
   /**
    * The stored value for the most up to date vehicle state (pose).
    */
-  rosplane_msgs::msg::State vehicle_state_;
+  rosplane_msgs::msg::State::ConstSharedPtr vehicle_state_;
 
   /**
    * Flag to indicate if the first command has been received.
    */
   bool command_recieved_;
 
+  /**
+   * Handles to the scaling factors used in convert_to_pwm, resolved once in the constructor.
+   */
+  ParamHandle<double> pwm_rad_e_;
+  ParamHandle<double> pwm_rad_a_;
+  ParamHandle<double> pwm_rad_r_;
+
+  /**
+   * Handles to the failsafe parameters, resolved once in the constructor.
+   */
+  ParamHandle<double> failsafe_throttle_;
+  ParamHandle<double> failsafe_loiter_roll_;
+
   /**
    * Convert from deflection angle in radians to pwm.
    */
@@ -168,23 +258,66 @@ private:
 
   /**
    * Calls the control function and publishes outputs and intermediate values to the command and controller internals
-   * topics.
+   * topics. Flies the failsafe instead while the inputs are stale.
+   * @param Ts Time step (s) since the last call of the control function.
+   * @param now The current time, on the node's clock.
+   */
+  void actuator_controls_publish(float Ts, const rclcpp::Time & now);
+
+  /**
+   * Packages the control efforts into a command message and publishes it.
+   */
+  void publish_actuators(const Output & output, const rclcpp::Time & now);
+
+  /**
+   * Publishes neutral surfaces and the failsafe_throttle, for when the loops cannot or should not
+   * be closed.
+   */
+  void publish_fixed_throttle(const rclcpp::Time & now);
+
+  /**
+   * Replaces the stale controller commands in the inputs with the failsafe_mode_ commands.
+   */
+  void apply_failsafe_commands(Input & input);
+
+  /**
+   * Compares the ages of the state and the controller commands with their timeouts, and logs and
+   * publishes the watchdog state when it changes. This is a couple of comparisons, so it is run on
+   * every tick.
+   * @param now The current time, on the node's clock.
+   */
+  void check_inputs(const rclcpp::Time & now);
+
+  /**
+   * Publishes the state of the watchdog to the controller_watchdog topic.
+   */
+  void publish_watchdog(const rclcpp::Time & now);
+
+  /**
+   * Called by the timer in control_on_state_ mode. Flies the failsafe while no state arrives
+   * within the state_timeout.
+   */
+  void state_watchdog();
+
+  /**
+   * Reads the timeouts and the failsafe mode from the parameters.
    */
-  void actuator_controls_publish();
+  void update_watchdog_parameters();
 
   /**
    * Callback for new set of controller commands published to the controller_commands_sub_.
-   * This saves the message as the member variable controller_commands_ for use in control loops.
+   * This keeps the message as the member variable controller_commands_ for use in control loops.
    * @param msg ControllerCommands message.
    */
-  void controller_commands_callback(const rosplane_msgs::msg::ControllerCommands::SharedPtr msg);
+  void
+  controller_commands_callback(const rosplane_msgs::msg::ControllerCommands::ConstSharedPtr msg);
 
   /**
    * Callback for the new state of the aircraft published to the vehicle_state_sub_.
-   * This saves the message as the member variable vehicle_state_ for sue in control loops.
+   * This keeps the message as the member variable vehicle_state_ for use in control loops.
    * @param msg
    */
-  void vehicle_state_callback(const rosplane_msgs::msg::State::SharedPtr msg);
+  void vehicle_state_callback(const rosplane_msgs::msg::State::ConstSharedPtr msg);
 
   /**
    * ROS2 parameter system interface. This connects ROS2 parameters with the defined update callback, parametersCallback.
@@ -207,7 +340,8 @@ private:
   void declare_parameters();
 
   /**
-   * This creates a wall timer that calls the controller publisher.
+   * This creates a wall timer that calls the controller publisher, or the state watchdog when the
+   * control runs on each new state.
   */
   void set_timer();
 };
@@ -10,7 +10,7 @@ class ControllerStateMachine : public ControllerBase
 {
 
 public:
-  ControllerStateMachine();
+  explicit ControllerStateMachine(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
 
   /**
  * The state machine for the control algorithm for the autopilot.
@@ -70,6 +70,12 @@ private:
    * Also declares default values before they are set to the values set in the launch script.
   */
   void declare_parameters();
+
+  /**
+   * Handles to the zone altitudes, resolved once in the constructor.
+   */
+  ParamHandle<double> alt_toz_;
+  ParamHandle<double> alt_hz_;
 };
 
 } // namespace rosplane
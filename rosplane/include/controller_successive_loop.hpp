@@ -1,7 +1,14 @@
 #ifndef CONTROLLER_EXAMPLE_H
 #define CONTROLLER_EXAMPLE_H
 
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "controller_state_machine.hpp"
+#include "gain_schedule.hpp"
+#include "pid.hpp"
 
 namespace rosplane
 {
@@ -12,9 +19,147 @@ public:
   /**
    * Constructor to initialize node.
    */
-  ControllerSucessiveLoop();
+  explicit ControllerSucessiveLoop(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
+
+  /**
+   * Loads the gains for this tick and runs the state machine.
+   * @param input The command inputs to the controller such as course and airspeed.
+   * @param output The control efforts calculated and selected intermediate values.
+   */
+  void control(const Input & input, Output & output) override;
 
 protected:
+  /**
+   * Number of gains in the gain schedule of the control loops: kp, ki and kd of the course, roll,
+   * pitch, airspeed and altitude loops, in that order.
+   */
+  static constexpr int NUM_SCHEDULED_GAINS = 15;
+
+  /**
+   * The gains, limits and constants of the control loops, compiled from the parameters so the loops
+   * do not look them up by name or recompute them every tick. A set is never changed after it is
+   * built; a parameter update builds a new one.
+   */
+  struct Gains
+  {
+    float Ts; /**< Controller period, from controller_output_frequency (s) */
+
+    PidGains course;   /**< Course to roll angle (rad) */
+    PidGains roll;     /**< Roll angle to aileron deflection */
+    PidGains pitch;    /**< Pitch angle to elevator deflection */
+    PidGains airspeed; /**< Airspeed to throttle */
+    PidGains altitude; /**< Altitude to pitch angle (rad) */
+
+    float a_trim; /**< trim_a / pwm_rad_a */
+    float e_trim; /**< trim_e / pwm_rad_e */
+    float trim_t;
+    float alt_hz;
+
+    float y_pwo; /**< Yaw damper washout filter pole */
+    float y_kr;  /**< Yaw damper gain */
+    float y_b0;  /**< Yaw damper washout filter coefficients, discretized at Ts */
+    float y_b1;
+    float y_a0;
+    float max_r;
+
+    float max_takeoff_throttle;
+    float cmd_takeoff_pitch; /**< (rad) */
+    bool roll_override;
+    bool pitch_override;
+
+    ScheduleVariable schedule_variable; /**< NONE if the PID gains above are used as they are */
+    float rho; /**< Air density used for the dynamic pressure (kg/m^3) */
+    GainSchedule<NUM_SCHEDULED_GAINS> schedule; /**< Empty if the gains are not scheduled */
+  };
+
+  /**
+   * The gains of the current tick, loaded once at the start of control() so that every loop in a
+   * tick uses the same set. Points to the compiled set, or to a copy of it with the scheduled
+   * gains interpolated for the current flight condition and the constants derived from the time
+   * step recomputed for the tick's Input::Ts.
+   */
+  const Gains * gains_;
+
+  /**
+   * Sets the time step of a gain set and recomputes the constants derived from it.
+   */
+  static void set_period(Gains & gains, float Ts);
+
+  /**
+   * Loads the latest compiled gain set for this tick, interpolates its scheduled gains and adapts
+   * it to the tick's time step.
+   * Controllers with gains of their own load them here too.
+   * @param input The inputs of this tick, which give the flight condition.
+   */
+  virtual void load_gains(const Input & input);
+
+  /**
+   * @return The value of the schedule variable of the current gain set for the given inputs.
+   */
+  float schedule_key(const Input & input) const;
+
+  /**
+   * @return The schedule variable selected by the gain_schedule parameter.
+   */
+  ScheduleVariable get_schedule_variable();
+
+  /**
+   * Builds a gain schedule from the gain_schedule_breakpoints parameter and a <gain>_schedule
+   * parameter for each gain, holding the gain's value at each breakpoint. A gain without a
+   * schedule keeps the value of its <gain> parameter at every breakpoint.
+   * @param gain_names The names of the gain parameters, in the order of the schedule's rows.
+   * @return The schedule, or an empty one if the gains are not scheduled.
+   */
+  template<size_t N>
+  GainSchedule<N> build_schedule(const std::array<const char *, N> & gain_names)
+  {
+    GainSchedule<N> schedule;
+    if (get_schedule_variable() == ScheduleVariable::NONE) {
+      return schedule;
+    }
+
+    std::vector<double> breakpoints = params_.get_double_array("gain_schedule_breakpoints");
+    if (breakpoints.empty() || breakpoints.size() > GainSchedule<N>::capacity) {
+      RCLCPP_ERROR(this->get_logger(),
+                   "gain_schedule_breakpoints needs 1 to %d values, gains are not scheduled.",
+                   GainSchedule<N>::capacity);
+      return schedule;
+    }
+
+    std::array<std::vector<double>, N> columns;
+    for (size_t j = 0; j < N; j++) {
+      columns[j] = params_.get_double_array(std::string(gain_names[j]) + "_schedule");
+      if (!columns[j].empty() && columns[j].size() != breakpoints.size()) {
+        RCLCPP_ERROR(this->get_logger(),
+                     "%s_schedule needs one value per breakpoint, %s is not scheduled.",
+                     gain_names[j], gain_names[j]);
+        columns[j].clear();
+      }
+      if (columns[j].empty()) {
+        columns[j].assign(breakpoints.size(), params_.get_double(gain_names[j]));
+      }
+    }
+
+    for (size_t i = 0; i < breakpoints.size(); i++) {
+      typename GainSchedule<N>::Row row;
+      for (size_t j = 0; j < N; j++) {
+        row[j] = columns[j][i];
+      }
+      if (!schedule.add_breakpoint(breakpoints[i], row)) {
+        RCLCPP_ERROR(this->get_logger(),
+                     "gain_schedule_breakpoints must be increasing, gains are not scheduled.");
+        schedule.clear();
+        return schedule;
+      }
+    }
+    return schedule;
+  }
+
+  /**
+   * Rebuilds the gain set when the parameters change.
+   */
+  void parameters_changed() override;
+
   /**
    * This function continually loops while the aircraft is in the take-off zone. The lateral and longitudinal control
    * for the take-off zone is called in this function.
@@ -111,14 +256,9 @@ protected:
   float course_hold(float chi_c, float chi, float phi_ff, float r);
 
   /**
-   * The difference between the commanded course angle and the current course angle.
+   * PID of the course loop, with the yaw rate as its derivative.
    */
-  float c_error_;
-
-  /**
-   * The integral of the error in course angle.
-   */
-  float c_integrator_;
+  Pid<PidDerivative::RATE> course_pid_;
 
   /**
    * The control loop for moving to and holding a commanded roll angle.
@@ -130,14 +270,9 @@ protected:
   float roll_hold(float phi_c, float phi, float p);
 
   /**
-   * The difference between the commanded roll angle and the current roll angle.
+   * PID of the roll loop, with the roll rate as its derivative.
    */
-  float r_error_;
-
-  /**
-   * The integral of the error in roll angle.
-   */
-  float r_integrator;
+  Pid<PidDerivative::RATE> roll_pid_;
 
   /**
    * The control loop for moving to and holding a commanded pitch angle.
@@ -149,14 +284,9 @@ protected:
   float pitch_hold(float theta_c, float theta, float q);
 
   /**
-   * The difference between the commanded pitch angle and the current pitch angle.
-   */
-  float p_error_;
-
-  /**
-   * The integral of the error in pitch angle.
+   * PID of the pitch loop, with the pitch rate as its derivative.
    */
-  float p_integrator_;
+  Pid<PidDerivative::RATE> pitch_pid_;
 
   /**
    * The control loop that calculates the required throttle level to move to and maintain a commanded airspeed.
@@ -167,19 +297,9 @@ protected:
   float airspeed_with_throttle_hold(float va_c, float va);
 
   /**
-   * The difference between the commanded airspeed and the current airspeed.
-   */
-  float at_error_;
-
-  /**
-   * The integral of the error in airspeed.
+   * PID of the airspeed with throttle loop, with the dirty derivative of the airspeed error.
    */
-  float at_integrator_;
-
-  /**
-   * The derivative of the error in airspeed.
-   */
-  float at_differentiator_;
+  Pid<PidDerivative::ERROR> airspeed_pid_;
 
   /**
    * The control loop that calculates the required pitch angle to command to maintain a commanded altitude.
@@ -190,19 +310,9 @@ protected:
   float altitude_hold_control(float h_c, float h);
 
   /**
-   * The difference between the commanded altitude and the current altitude.
-   */
-  float a_error_;
-
-  /**
-   * The integral of the error in altitude.
-   */
-  float a_integrator_;
-
-  /**
-   * The derivative of the error in altitude.
+   * PID of the altitude loop, with the dirty derivative of the altitude error.
    */
-  float a_differentiator_;
+  Pid<PidDerivative::ERROR> altitude_pid_;
 
   //    float cooridinated_turn_hold(float v, const struct params_s &params, float Ts); // TODO implement if you want...
   //    float ct_error_;
@@ -225,12 +335,41 @@ protected:
 
   float adjust_h_c(float h_c, float h, float max_diff);
 
+  /**
+   * Warns about the terms of a loop's PID that were NaN on its last update.
+   * @param nan_terms The terms that were NaN, from Pid::nan_terms().
+   * @param loop The name of the loop.
+   */
+  void warn_nan_terms(uint8_t nan_terms, const char * loop);
+
 private:
   /**
    * Declares the parameters associated to this controller, controller_successive_loop, so that ROS2 can see them.
    * Also declares default values before they are set to the values set in the launch script.
   */
   void declare_parameters();
+
+  /**
+   * Builds a gain set from the current parameters and publishes it for the next tick.
+   */
+  void compile_gains();
+
+  /**
+   * The latest compiled gain set. It is only read and replaced with std::atomic_load and
+   * std::atomic_store, so a tick never sees a set from a parameter update that is half applied,
+   * even if the parameter callback runs on another thread of the executor.
+   */
+  std::shared_ptr<const Gains> latest_gains_;
+
+  /**
+   * Holds the compiled gain set of the current tick.
+   */
+  std::shared_ptr<const Gains> tick_gains_;
+
+  /**
+   * The gains of the current tick, when they are scheduled or the time step is not the nominal one.
+   */
+  Gains adjusted_gains_;
 };
 } // namespace rosplane
 
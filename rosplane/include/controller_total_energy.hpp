@@ -12,7 +12,7 @@ public:
   /**
    * Constructor to initialize node.
    */
-  ControllerTotalEnergy();
+  explicit ControllerTotalEnergy(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
 
 protected:
   /**
@@ -121,12 +121,65 @@ protected:
    */
   float E_error_prev_;
 
+  /**
+   * The gains and constants of the energy loops, compiled from the parameters like the gains of
+   * the successive loop controller.
+   */
+  struct EnergyGains
+  {
+    float e_kp;
+    float e_ki;
+    float l_kp;
+    float l_ki;
+    float mass;
+    float gravity;
+    float max_alt_error;
+    GainSchedule<4> schedule; /**< e_kp, e_ki, l_kp and l_ki. Empty if they are not scheduled */
+  };
+
+  /**
+   * The energy gains of the current tick, loaded with the other gains in load_gains().
+   */
+  const EnergyGains * energy_gains_;
+
+  /**
+   * Loads the gains of the successive loop controller, then the energy gains.
+   * @param input The inputs of this tick, which give the flight condition.
+   */
+  void load_gains(const Input & input) override;
+
+  /**
+   * Rebuilds the energy gains along with the other gains when the parameters change.
+   */
+  void parameters_changed() override;
+
 private:
   /**
    * Declares the parameters associated to this controller, controller_successive_loop, so that ROS2 can see them.
    * Also declares default values before they are set to the values set in the launch script.
   */
   void declare_parameters();
+
+  /**
+   * Builds a set of energy gains from the current parameters and publishes it for the next tick.
+   */
+  void compile_energy_gains();
+
+  /**
+   * The latest compiled energy gains, only read and replaced with std::atomic_load and
+   * std::atomic_store.
+   */
+  std::shared_ptr<const EnergyGains> latest_energy_gains_;
+
+  /**
+   * Holds the compiled energy gains of the current tick.
+   */
+  std::shared_ptr<const EnergyGains> tick_energy_gains_;
+
+  /**
+   * The energy gains of the current tick with the scheduled gains interpolated.
+   */
+  EnergyGains scheduled_energy_gains_;
 };
 } // namespace rosplane
 
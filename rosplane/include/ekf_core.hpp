@@ -0,0 +1,358 @@
+/**
+ * @file ekf_core.hpp
+ *
+ * Fixed-size extended Kalman filter math used by the EKF estimators. The state, input and
+ * measurement dimensions are template parameters so that every matrix lives on the stack and the
+ * state and covariance are updated in place. No heap allocation happens in any of these functions.
+ */
+
+#ifndef EKF_CORE_H
+#define EKF_CORE_H
+
+#include <cmath>
+
+#include <Eigen/Dense>
+
+namespace rosplane
+{
+
+/**
+ * The innovation of a fused measurement and the result of its chi-squared gate.
+ */
+template<int M>
+struct MeasurementInnovation
+{
+  Eigen::Matrix<float, M, 1> residual; /**< Measurement minus prediction */
+  float nis;     /**< Normalized innovation squared, residual' * S^-1 * residual */
+  bool accepted; /**< False if the gate rejected the measurement and the state was not changed */
+};
+
+/**
+ * Checks the normalized innovation squared against a gate threshold. A threshold of zero or less
+ * disables the gate, but a non-finite NIS is always rejected.
+ */
+inline bool passes_gate(float nis, float gate_threshold)
+{
+  return std::isfinite(nis) && (gate_threshold <= 0.0f || nis <= gate_threshold);
+}
+
+/**
+ * Continuous-discrete EKF operations for a filter with N states driven by an input vector of
+ * size U.
+ *
+ * The models are passed as callables (usually lambdas capturing the estimator) so they can be
+ * inlined. They must return fixed-size Eigen types of the sizes described on each function.
+ */
+template<int N, int U>
+class EKFCore
+{
+public:
+  using StateVector = Eigen::Matrix<float, N, 1>;
+  using StateMatrix = Eigen::Matrix<float, N, N>;
+  using InputVector = Eigen::Matrix<float, U, 1>;
+
+  /**
+   * Propagates the state and covariance forward by Ts using num_steps Euler integration steps
+   * and a second-order approximation of the matrix exponential.
+   *
+   * @param x The state estimate, updated in place.
+   * @param P The state covariance, updated in place.
+   * @param inputs The inputs to the dynamic model.
+   * @param dynamic_model Callable (x, inputs) -> StateVector with the time derivative of the state.
+   * @param jacobian Callable (x, inputs) -> StateMatrix with the jacobian of the dynamic model.
+   * @param input_jacobian Callable (x, inputs) -> N x G matrix mapping input noise to the state.
+   * @param Q The process noise covariance.
+   * @param Q_g The G x G input noise covariance.
+   * @param Ts The time to propagate over, in seconds.
+   * @param num_steps The number of integration steps to split Ts into.
+   */
+  template<int G, typename DynamicModel, typename Jacobian, typename InputJacobian>
+  static void propagate(StateVector & x, StateMatrix & P, const InputVector & inputs,
+                        DynamicModel && dynamic_model, Jacobian && jacobian,
+                        InputJacobian && input_jacobian, const StateMatrix & Q,
+                        const Eigen::Matrix<float, G, G> & Q_g, float Ts, int num_steps)
+  {
+    const float dt = Ts / num_steps;
+
+    for (int _ = 0; _ < num_steps; _++) {
+      // Propagate model by a step.
+      x += dynamic_model(x, inputs) * dt;
+
+      const StateMatrix A = jacobian(x, inputs);
+
+      // Find the second order approx of the matrix exponential.
+      StateMatrix A_d = StateMatrix::Identity() + dt * A;
+      A_d.noalias() += (dt * dt / 2.0f) * A * A;
+
+      const Eigen::Matrix<float, N, G> G_mat = input_jacobian(x, inputs);
+
+      // Propagate the covariance.
+      StateMatrix Q_d = Q;
+      Q_d.noalias() += G_mat * Q_g * G_mat.transpose();
+
+      StateMatrix P_next = Q_d * (dt * dt);
+      P_next.noalias() += A_d * P * A_d.transpose();
+      P = P_next;
+    }
+  }
+
+  /**
+   * Propagates like propagate, for a model whose jacobian is zero below row K (the derivatives of
+   * the last N - K states do not depend on the state) and whose process and input noise covariances
+   * are diagonal. Only the leading K rows of A_d differ from the identity, so the covariance is
+   * updated block by block and the trailing N - K by N - K block only gains its process noise.
+   *
+   * @param x The state estimate, updated in place.
+   * @param P The state covariance, updated in place.
+   * @param inputs The inputs to the dynamic model.
+   * @param dynamic_model Callable (x, inputs) -> StateVector with the time derivative of the state.
+   * @param jacobian Callable (x, inputs) -> StateMatrix with the jacobian of the dynamic model.
+   *                 Only its leading K rows are read.
+   * @param input_jacobian Callable (x, inputs) -> K x G matrix mapping input noise to the leading K
+   *                       states.
+   * @param Q_diagonal The diagonal of the process noise covariance.
+   * @param Q_g_diagonal The diagonal of the input noise covariance.
+   * @param Ts The time to propagate over, in seconds.
+   * @param num_steps The number of integration steps to split Ts into.
+   */
+  template<int K, int G, typename DynamicModel, typename Jacobian, typename InputJacobian>
+  static void propagate_structured(StateVector & x, StateMatrix & P, const InputVector & inputs,
+                                   DynamicModel && dynamic_model, Jacobian && jacobian,
+                                   InputJacobian && input_jacobian, const StateVector & Q_diagonal,
+                                   const Eigen::Matrix<float, G, 1> & Q_g_diagonal, float Ts,
+                                   int num_steps)
+  {
+    propagate_structured_impl<K, G>(x, P, inputs, dynamic_model, jacobian, input_jacobian,
+                                    Q_diagonal, Q_g_diagonal, Ts, num_steps);
+  }
+
+  /**
+   * Same as above, for a model without input noise.
+   */
+  template<int K, typename DynamicModel, typename Jacobian>
+  static void propagate_structured(StateVector & x, StateMatrix & P, const InputVector & inputs,
+                                   DynamicModel && dynamic_model, Jacobian && jacobian,
+                                   const StateVector & Q_diagonal, float Ts, int num_steps)
+  {
+    propagate_structured_impl<K, 0>(x, P, inputs, dynamic_model, jacobian, nullptr, Q_diagonal,
+                                    Eigen::Matrix<float, 0, 1>(), Ts, num_steps);
+  }
+
+  /**
+   * Fuses a measurement vector of size M into the state, unless the squared Mahalanobis distance
+   * of the innovation is over the gate threshold. For a correct filter that distance follows a
+   * chi-squared distribution with M degrees of freedom, so the threshold is a chi-squared quantile.
+   *
+   * @param x The state estimate, updated in place.
+   * @param P The state covariance, updated in place.
+   * @param inputs Any additional values the measurement model needs.
+   * @param measurement_model Callable (x, inputs) -> M vector with the predicted measurement.
+   * @param measurement_jacobian Callable (x, inputs) -> M x N jacobian of the measurement model.
+   * @param y The measurement.
+   * @param R The M x M measurement covariance.
+   * @param gate_threshold The largest accepted normalized innovation squared. Zero disables it.
+   * @return The innovation and whether the measurement was accepted.
+   */
+  template<int M, int V, typename MeasurementModel, typename MeasurementJacobian>
+  static MeasurementInnovation<M>
+  measurement_update(StateVector & x, StateMatrix & P, const Eigen::Matrix<float, V, 1> & inputs,
+                     MeasurementModel && measurement_model,
+                     MeasurementJacobian && measurement_jacobian,
+                     const Eigen::Matrix<float, M, 1> & y, const Eigen::Matrix<float, M, M> & R,
+                     float gate_threshold = 0.0f)
+  {
+    MeasurementInnovation<M> innovation;
+
+    const Eigen::Matrix<float, M, 1> h = measurement_model(x, inputs);
+    const Eigen::Matrix<float, M, N> C = measurement_jacobian(x, inputs);
+
+    const Eigen::Matrix<float, N, M> PCt = P * C.transpose();
+
+    // Find the S_inv to find the Kalman gain.
+    Eigen::Matrix<float, M, M> S = R;
+    S.noalias() += C * PCt;
+    const Eigen::Matrix<float, M, M> S_inv = S.inverse();
+
+    // Gate the measurement on its normalized innovation squared.
+    innovation.residual = y - h;
+    innovation.nis = innovation.residual.dot(S_inv * innovation.residual);
+    innovation.accepted = passes_gate(innovation.nis, gate_threshold);
+    if (!innovation.accepted) {
+      return innovation;
+    }
+
+    // Find the Kalman gain.
+    const Eigen::Matrix<float, N, M> L = PCt * S_inv;
+
+    // Use a temp to increase readablility.
+    StateMatrix temp = StateMatrix::Identity();
+    temp.noalias() -= L * C;
+
+    // Adjust the covariance with new information.
+    StateMatrix P_next = L * R * L.transpose();
+    P_next.noalias() += temp * P * temp.transpose();
+    P = P_next;
+
+    // Use Kalman gain to optimally adjust estimate.
+    x.noalias() += L * innovation.residual;
+
+    return innovation;
+  }
+
+  /**
+   * Fuses a measurement vector of size M with a diagonal covariance as M scalar updates, which
+   * avoids inverting the M x M innovation covariance. The model is linearized once about the prior
+   * and each scalar innovation is corrected for the updates before it, so the result matches
+   * measurement_update up to rounding. The gate is applied to the total normalized innovation
+   * squared, which for a diagonal R equals the batch value; a rejected measurement leaves the state
+   * and covariance unchanged.
+   *
+   * @param x The state estimate, updated in place.
+   * @param P The state covariance, updated in place.
+   * @param inputs Any additional values the measurement model needs.
+   * @param measurement_model Callable (x, inputs) -> M vector with the predicted measurement.
+   * @param measurement_jacobian Callable (x, inputs) -> M x N jacobian of the measurement model.
+   * @param y The measurement.
+   * @param R_diagonal The diagonal of the measurement covariance.
+   * @param gate_threshold The largest accepted normalized innovation squared. Zero disables it.
+   * @param joseph_form Use the Joseph form covariance update for each scalar update.
+   * @return The innovation and whether the measurement was accepted.
+   */
+  template<int M, int V, typename MeasurementModel, typename MeasurementJacobian>
+  static MeasurementInnovation<M> sequential_measurement_update(
+    StateVector & x, StateMatrix & P, const Eigen::Matrix<float, V, 1> & inputs,
+    MeasurementModel && measurement_model, MeasurementJacobian && measurement_jacobian,
+    const Eigen::Matrix<float, M, 1> & y, const Eigen::Matrix<float, M, 1> & R_diagonal,
+    float gate_threshold = 0.0f, bool joseph_form = false)
+  {
+    MeasurementInnovation<M> innovation;
+
+    const Eigen::Matrix<float, M, 1> h = measurement_model(x, inputs);
+    const Eigen::Matrix<float, M, N> C = measurement_jacobian(x, inputs);
+    innovation.residual = y - h;
+
+    // Keep the prior to correct the later innovations and to restore a rejected measurement.
+    const StateVector x_prior = x;
+    const StateMatrix P_prior = P;
+
+    innovation.nis = 0.0f;
+    for (int i = 0; i < M; i++) {
+      const StateVector c = C.row(i).transpose();
+      const float prediction = h(i) + c.dot(x - x_prior);
+      innovation.nis +=
+        single_measurement_update(x, P, y(i), prediction, R_diagonal(i), c, 0.0f, joseph_form).nis;
+    }
+
+    innovation.accepted = passes_gate(innovation.nis, gate_threshold);
+    if (!innovation.accepted) {
+      x = x_prior;
+      P = P_prior;
+    }
+
+    return innovation;
+  }
+
+  /**
+   * Fuses a single scalar measurement into the state.
+   *
+   * @param x The state estimate, updated in place.
+   * @param P The state covariance, updated in place.
+   * @param measurement The measured value.
+   * @param measurement_prediction The value the measurement model predicts.
+   * @param measurement_variance The variance of the measurement.
+   * @param measurement_jacobian The (transposed) row of the measurement jacobian.
+   * @param gate_threshold The largest accepted normalized innovation squared. Zero disables it.
+   * @param joseph_form Use the Joseph form covariance update, which keeps P symmetric and positive
+   * definite under rounding at the cost of a few more multiplies.
+   * @return The innovation and whether the measurement was accepted.
+   */
+  static MeasurementInnovation<1>
+  single_measurement_update(StateVector & x, StateMatrix & P, float measurement,
+                            float measurement_prediction, float measurement_variance,
+                            const StateVector & measurement_jacobian, float gate_threshold = 0.0f,
+                            bool joseph_form = false)
+  {
+    MeasurementInnovation<1> innovation;
+
+    const StateVector PC = P * measurement_jacobian;
+    const float S = measurement_variance + measurement_jacobian.dot(PC);
+
+    innovation.residual(0) = measurement - measurement_prediction;
+    innovation.nis = innovation.residual(0) * innovation.residual(0) / S;
+    innovation.accepted = passes_gate(innovation.nis, gate_threshold);
+    if (!innovation.accepted) {
+      return innovation;
+    }
+
+    const StateVector L = PC / S;
+
+    // (I - L C) P as a rank one update, since C P is the transpose of PC.
+    P.noalias() -= L * PC.transpose();
+
+    if (joseph_form) {
+      // Complete the Joseph form (I - L C) P (I - L C)' + L R L' with two more rank one updates.
+      const StateVector P_updated_C = P * measurement_jacobian;
+      P.noalias() -= P_updated_C * L.transpose();
+      P.noalias() += (measurement_variance * L) * L.transpose();
+    }
+    // The rank one updates assume P is symmetric. Rounding breaks that a little on every update,
+    // and over many updates the filter diverges, so mirror the upper triangle onto the lower.
+    P.template triangularView<Eigen::StrictlyLower>() = P.transpose();
+
+    x += L * innovation.residual(0);
+
+    return innovation;
+  }
+
+private:
+  template<int K, int G, typename DynamicModel, typename Jacobian, typename InputJacobian>
+  static void propagate_structured_impl(StateVector & x, StateMatrix & P,
+                                        const InputVector & inputs, DynamicModel && dynamic_model,
+                                        Jacobian && jacobian, InputJacobian && input_jacobian,
+                                        const StateVector & Q_diagonal,
+                                        const Eigen::Matrix<float, G, 1> & Q_g_diagonal, float Ts,
+                                        int num_steps)
+  {
+    static_assert(K > 0 && K <= N, "The number of states with dynamics must be in [1, N].");
+
+    const float dt = Ts / num_steps;
+    const StateVector Q_d = Q_diagonal * (dt * dt);
+
+    for (int _ = 0; _ < num_steps; _++) {
+      // Propagate model by a step.
+      x += dynamic_model(x, inputs) * dt;
+
+      const StateMatrix A = jacobian(x, inputs);
+      const auto A_top = A.template topRows<K>();
+
+      // The leading K rows of the second order approx of the matrix exponential. A is zero below
+      // row K, so only the leading K columns of A_top contribute to A * A.
+      Eigen::Matrix<float, K, N> A_d_top = dt * A_top;
+      A_d_top.template leftCols<K>().diagonal().array() += 1.0f;
+      A_d_top.noalias() += (dt * dt / 2.0f) * A_top.template leftCols<K>() * A_top;
+
+      // The leading K rows of A_d P, the only rows that differ from P.
+      Eigen::Matrix<float, K, N> A_d_P;
+      A_d_P.noalias() = A_d_top * P;
+
+      // Propagate the covariance. The trailing columns of A_d' are unit vectors, so the
+      // off-diagonal blocks are copied from A_d P and the trailing block does not change.
+      P.template topLeftCorner<K, K>().noalias() = A_d_P * A_d_top.transpose();
+      if constexpr (K < N) {
+        P.template topRightCorner<K, N - K>() = A_d_P.template rightCols<N - K>();
+        P.template bottomLeftCorner<N - K, K>() = A_d_P.template rightCols<N - K>().transpose();
+      }
+
+      if constexpr (G > 0) {
+        const Eigen::Matrix<float, K, G> G_mat = input_jacobian(x, inputs);
+        P.template topLeftCorner<K, K>().noalias() +=
+          (G_mat * (Q_g_diagonal * (dt * dt)).asDiagonal()) * G_mat.transpose();
+      }
+      P.diagonal() += Q_d;
+    }
+  }
+};
+
+} // namespace rosplane
+
+#endif // EKF_CORE_H
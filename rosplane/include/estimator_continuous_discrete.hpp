@@ -1,13 +1,16 @@
 #ifndef ESTIMATOR_CONTINUOUS_DISCRETE_H
 #define ESTIMATOR_CONTINUOUS_DISCRETE_H
 
+#include <array>
 #include <math.h>
 
 #include <Eigen/Geometry>
 #include <yaml-cpp/yaml.h>
 
+#include "estimator_continuous_discrete_models.hpp"
 #include "estimator_ekf.hpp"
 #include "estimator_ros.hpp"
+#include "ud_covariance.hpp"
 
 namespace rosplane
 {
@@ -15,16 +18,22 @@ namespace rosplane
 class EstimatorContinuousDiscrete : public EstimatorEKF
 {
 public:
-  EstimatorContinuousDiscrete();
-  EstimatorContinuousDiscrete(bool use_params);
+  explicit EstimatorContinuousDiscrete(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
+
+protected:
+  /**
+   * @return The position filter covariance, rebuilt after every update when it is UD-factorized.
+   */
+  const Eigen::Matrix<float, 7, 7> & position_covariance() const { return P_p_; }
 
 private:
   virtual void estimate(const Input & input, Output & output);
+  virtual void fill_diagnostics(rosplane_msgs::msg::EstimatorDiagnostics & diagnostics) override;
+  virtual bool fill_innovations(rosplane_msgs::msg::EstimatorInnovations & innovations) override;
 
-  double lpf_a_;
   float alpha_;
   float alpha1_;
-  int N_;
+  float alpha_Ts_; /**< Time step the low pass filter constants were computed for */
 
   float lpf_gyro_x_;
   float lpf_gyro_y_;
@@ -43,80 +52,267 @@ private:
   float thetahat_;
   float psihat_; // TODO: link to an inital condiditons param
 
-  Eigen::VectorXf attitude_dynamics(const Eigen::VectorXf & state,
-                                    const Eigen::VectorXf & measurements);
-  std::function<Eigen::VectorXf(const Eigen::VectorXf, const Eigen::VectorXf)>
-    attitude_dynamics_model;
-
-  Eigen::MatrixXf attitude_jacobian(const Eigen::VectorXf & state,
-                                    const Eigen::VectorXf & angular_rates);
-  std::function<Eigen::MatrixXf(const Eigen::VectorXf &, const Eigen::VectorXf &)>
-    attitude_jacobian_model;
-
-  Eigen::MatrixXf attitude_input_jacobian(const Eigen::VectorXf & state,
-                                          const Eigen::VectorXf & angular_rates);
-  std::function<Eigen::MatrixXf(const Eigen::VectorXf &, const Eigen::VectorXf &)>
-    attitude_input_jacobian_model;
-
-  Eigen::VectorXf attitude_measurement_prediction(const Eigen::VectorXf & state,
-                                                  const Eigen::VectorXf & inputs);
-  std::function<Eigen::VectorXf(const Eigen::VectorXf, const Eigen::VectorXf)>
-    attitude_measurement_model;
-
-  Eigen::MatrixXf attitude_measurement_jacobian(const Eigen::VectorXf & state,
-                                                const Eigen::VectorXf & inputs);
-  std::function<Eigen::MatrixXf(const Eigen::VectorXf, const Eigen::VectorXf)>
-    attitude_measurement_jacobian_model;
-
-  Eigen::VectorXf position_dynamics(const Eigen::VectorXf & state,
-                                    const Eigen::VectorXf & measurements);
-  std::function<Eigen::VectorXf(const Eigen::VectorXf, const Eigen::VectorXf)>
-    position_dynamics_model;
-
-  Eigen::MatrixXf position_jacobian(const Eigen::VectorXf & state,
-                                    const Eigen::VectorXf & measurements);
-  std::function<Eigen::MatrixXf(const Eigen::VectorXf &, const Eigen::VectorXf &)>
-    position_jacobian_model;
-
-  Eigen::MatrixXf position_input_jacobian(const Eigen::VectorXf & state,
-                                          const Eigen::VectorXf & inputs);
-  std::function<Eigen::MatrixXf(const Eigen::VectorXf &, const Eigen::VectorXf &)>
-    position_input_jacobian_model;
-
-  Eigen::VectorXf position_measurement_prediction(const Eigen::VectorXf & state,
-                                                  const Eigen::VectorXf & input);
-  std::function<Eigen::VectorXf(const Eigen::VectorXf, const Eigen::VectorXf)>
-    position_measurement_model;
-
-  Eigen::MatrixXf position_measurement_jacobian(const Eigen::VectorXf & state,
-                                                const Eigen::VectorXf & input);
-  std::function<Eigen::MatrixXf(const Eigen::VectorXf, const Eigen::VectorXf)>
-    position_measurement_jacobian_model;
+  /**
+   * The roll/pitch filter. Two states (phi, theta) propagated with the three gyro rates.
+   */
+  using AttitudeEKF = EKFCore<2, 3>;
+
+  /**
+   * The position/course/wind filter. Seven states (pn, pe, Vg, chi, wn, we, psi) propagated with
+   * the gyro rates, the attitude estimate and the airspeed.
+   */
+  using PositionEKF = EKFCore<7, 6>;
+
+  /**
+   * UD-factorized covariance operations for the position filter, used when the
+   * position_ud_covariance parameter is set.
+   */
+  using PositionUD = UDCovariance<7, 6>;
+
+  /**
+   * The vertical channel. Three states (h, h_dot, baro bias) propagated with the vertical
+   * acceleration and corrected with the barometer, GNSS altitude and GNSS down velocity.
+   */
+  using VerticalEKF = EKFCore<3, 1>;
 
   Eigen::Vector2f xhat_a_; // 2
   Eigen::Matrix2f P_a_;    // 2x2
 
-  Eigen::VectorXf xhat_p_; // 7
-  Eigen::MatrixXf P_p_;    // 7x7
+  Eigen::Vector<float, 7> xhat_p_; // 7
+  Eigen::Matrix<float, 7, 7> P_p_; // 7x7
 
   Eigen::Matrix2f Q_a_; // 2x2
   Eigen::Matrix3f Q_g_;
   Eigen::Matrix3f R_accel_;
 
-  Eigen::MatrixXf Q_p_; // 7x7
-  Eigen::MatrixXf R_p_; // 6x6
-  Eigen::VectorXf f_p_; // 7
-  Eigen::MatrixXf A_p_; // 7x7
-  float h_p_;
-  Eigen::VectorXf C_p_; // 7
-  Eigen::VectorXf L_p_; // 7
+  Eigen::Matrix<float, 7, 7> Q_p_; // 7x7
+  Eigen::Matrix<float, 6, 6> R_p_; // 6x6
+
+  Eigen::Vector3f xhat_v_; // h, h_dot, baro bias
+  Eigen::Matrix3f P_v_;    // 3x3
+
+  /**
+   * Gyro bias estimate and the variance of each axis. The bias is a random walk, measured by the
+   * gyros whenever the aircraft is stationary. The accelerometer bias is not observable in this
+   * estimator, so it stays at the saved value.
+   */
+  Eigen::Vector3f gyro_bias_;
+  Eigen::Vector3f gyro_bias_var_;
+  Eigen::Vector3f accel_bias_;
 
-  // TODO: not used
-  float gate_threshold_ = 9.21; // chi2(q = .01, df = 2)
+  /**
+   * Factors of P_p_ = U_p_ D_p_ U_p_' when the position covariance is UD-factorized. The factors
+   * are then the primary representation and P_p_ is rebuilt from them after every update.
+   * Anything that sets P_p_ directly must clear position_ud_valid_ so they are refactored.
+   */
+  Eigen::Matrix<float, 7, 7> U_p_;
+  Eigen::Vector<float, 7> D_p_;
+  bool position_ud_valid_;
+
+  /**
+   * One step of the position filter, kept so that a delayed GPS measurement can be fused
+   * at the time it was taken and the filter re-propagated to the present.
+   */
+  struct PositionSnapshot
+  {
+    double stamp;                   /**< Time at the end of the step (s) */
+    float Ts;                       /**< Length of the step (s) */
+    Eigen::Vector<float, 6> inputs; /**< Inputs the step was propagated with */
+    Eigen::Vector<float, 7> xhat;   /**< State at the end of the step */
+    Eigen::Matrix<float, 7, 7> P;   /**< Covariance at the end of the step */
+    bool gps_new;                   /**< Set if a GPS measurement was fused during the step */
+    float gps_offset;               /**< Time from the start of the step to the GPS measurement */
+    Eigen::Vector<float, 6> y_gps;  /**< The GPS measurement fused during the step */
+    float gps_vahat;                /**< Airspeed estimate the GPS measurement was fused with */
+    float gps_gate_threshold;       /**< Gate the GPS measurement was first fused with */
+    MeasurementInnovation<6> gps_innovation; /**< Result of fusing the GPS measurement */
+  };
+
+  /**
+   * Number of position steps kept in the history. This bounds how late a GPS measurement can be
+   * and still be fused at its own time: 2.56 s with the position filter at 100 Hz, 5.12 s at 50 Hz.
+   */
+  static constexpr std::size_t position_history_capacity_ = 256;
+
+  /**
+   * Time since the last position step and the time-weighted sum of the attitude filter outputs
+   * over it. The position filter runs at position_update_frequency, below the attitude filter's
+   * rate, and is propagated with the mean of those outputs.
+   */
+  float position_elapsed_;
+  Eigen::Vector<float, 6> position_inputs_sum_;
+
+  /**
+   * @brief Returns whether the position filter should take a step this estimator step, which is
+   * when a position period has (nearly) elapsed or a GPS measurement has arrived.
+   *
+   * @param Ts The length of the current estimator step (s).
+   * @param gps_new Whether a GPS measurement arrived this step.
+   */
+  bool position_step_due(float Ts, bool gps_new);
+
+  /**
+   * @brief Runs one step of the position filter over the time since the last one: propagates it
+   * with the mean attitude filter outputs, fuses any new GPS measurement and records the step.
+   *
+   * @param attitude_states The current attitude filter outputs: p, q, r, phi, theta and va.
+   */
+  void step_position(const Input & input, const Eigen::Vector<float, 6> & attitude_states,
+                     int position_propagation_steps);
+
+  std::array<PositionSnapshot, position_history_capacity_> position_history_;
+  std::size_t position_history_head_;  /**< Index of the newest step */
+  std::size_t position_history_count_; /**< Number of valid steps */
+
+  /**
+   * Delayed GPS (out-of-sequence measurement) statistics.
+   */
+  int64_t gps_replay_count_;       /**< Measurements fused in the past and re-propagated */
+  int64_t gps_too_old_count_;      /**< Measurements older than the history, fused as current */
+  int64_t gps_over_budget_count_;  /**< Measurements whose replay would exceed the time budget */
+  int64_t gps_dropped_count_;      /**< Measurements dropped as their step already held one */
+  double gps_replay_time_last_;    /**< Wall time of the last re-propagation (s) */
+  double gps_replay_time_max_;     /**< Longest re-propagation so far (s) */
+  double gps_replay_step_cost_;    /**< Running average wall time of one replayed step (s) */
+
+  /**
+   * @brief Returns a step from the position history.
+   *
+   * @param age How many steps before the newest one. Zero is the newest.
+   */
+  PositionSnapshot & position_history_at(std::size_t age);
+
+  /**
+   * @brief Adds the current position state as the newest step in the history.
+   */
+  void push_position_history(double stamp, float Ts, const Eigen::Vector<float, 6> & inputs);
+
+  /**
+   * @brief Propagates the position filter over a time step.
+   */
+  void propagate_position(const Eigen::Vector<float, 6> & inputs, float Ts,
+                          int num_propagation_steps);
+
+  /**
+   * @brief Fuses a GPS measurement into the position filter at the current state.
+   *
+   * @param gate_threshold The chi-squared gate for the measurement, zero to accept it regardless.
+   * @return The innovation and whether the measurement passed the gate.
+   */
+  MeasurementInnovation<6> fuse_gps(const Eigen::Vector<float, 6> & y_pos, float vahat,
+                                    float gate_threshold);
+
+  /**
+   * @brief Returns the gate to fuse the next measurement of a sensor with. After too many
+   * consecutive rejections the gate is opened for one measurement, so the filter can recover when
+   * it is the estimate that is wrong, e.g. at startup.
+   */
+  float gate_for(float gate_threshold, int consecutive_rejections);
+
+  /**
+   * @brief Fuses a GPS measurement at the time it was taken. If that is in the past the filter is
+   * rewound to the step containing the measurement and re-propagated to the present, as long as
+   * the measurement is within the history and the expected cost is within the replay budget.
+   * Otherwise the measurement is fused at the current state.
+   *
+   * @param y_pos The GPS measurement.
+   * @param vahat The airspeed estimate.
+   * @param gps_stamp The time the measurement was taken (s).
+   * @param num_propagation_steps The number of integration steps per replayed step.
+   */
+  void fuse_delayed_gps(const Eigen::Vector<float, 6> & y_pos, float vahat, double gps_stamp,
+                        int num_propagation_steps);
+
+  /**
+   * @brief Returns whether a step of the history already holds a GPS measurement, counting and
+   * logging the new one as dropped if so. Each step holds one measurement, and replacing it would
+   * undo its fusion on the next replay.
+   */
+  bool gps_step_taken(const PositionSnapshot & step);
+
+  /**
+   * @brief Re-propagates one step of the history from the current state, fusing the GPS
+   * measurement it holds, and stores the result back into the step.
+   */
+  void replay_position_step(PositionSnapshot & step, int num_propagation_steps);
+
+  /**
+   * Handles to the parameters used in the estimation loop, resolved once in the constructor.
+   */
+  ParamHandle<double> gps_n_lim_;
+  ParamHandle<double> gps_e_lim_;
+  ParamHandle<int64_t> attitude_propagation_steps_;
+  ParamHandle<int64_t> position_propagation_steps_;
+  ParamHandle<double> position_update_frequency_;
+  ParamHandle<double> max_estimated_phi_;
+  ParamHandle<double> max_estimated_theta_;
+  ParamHandle<double> estimator_max_buffer_;
+  ParamHandle<double> lpf_a_;
+  ParamHandle<double> lpf_a1_;
+  ParamHandle<double> gps_replay_budget_;
+  ParamHandle<double> accel_gate_threshold_;
+  ParamHandle<double> gps_gate_threshold_;
+  ParamHandle<int64_t> gate_max_consecutive_rejections_;
+  ParamHandle<bool> gps_sequential_update_;
+  ParamHandle<bool> sequential_update_joseph_form_;
+  ParamHandle<bool> position_ud_covariance_;
+  ParamHandle<bool> vertical_channel_;
+  ParamHandle<double> vertical_accel_noise_;
+  ParamHandle<double> baro_bias_random_walk_;
+  ParamHandle<double> sigma_baro_alt_;
+  ParamHandle<double> sigma_gps_alt_;
+  ParamHandle<double> sigma_gps_vd_;
+  ParamHandle<bool> gyro_bias_estimation_;
+  ParamHandle<double> gyro_bias_random_walk_;
+  ParamHandle<double> stationary_gyro_threshold_;
+  ParamHandle<double> stationary_accel_threshold_;
+  ParamHandle<double> stationary_speed_threshold_;
+  ParamHandle<double> gyro_process_noise_;
+
+  /**
+   * Parameter revision that the R matrices were last computed with.
+   */
+  uint64_t measurement_model_params_revision_;
+
+  /**
+   * Innovation statistics of the accelerometer and GPS updates, updated every estimate and
+   * published by EstimatorROS at innovations_decimation.
+   */
+  rosplane_msgs::msg::EstimatorInnovations innovations_;
+  uint32_t reinitializations_; /**< Filter resets after a non-finite state */
+  int accel_consecutive_rejections_;
+  int gps_consecutive_rejections_;
+
+  /**
+   * @brief Records the result of a GPS update in the innovation statistics.
+   */
+  void record_gps_innovation(const MeasurementInnovation<6> & innovation);
 
   void check_xhat_a();
 
-  void bind_functions();
+  /**
+   * @brief Runs one step of the vertical channel: propagates it with the vertical acceleration and
+   * fuses any new barometer and GNSS measurements.
+   *
+   * @param input The estimator inputs.
+   * @param Ts The length of the step (s).
+   * @return The altitude estimate (m).
+   */
+  float step_vertical(const Input & input, float Ts);
+
+  /**
+   * @brief Propagates the gyro bias estimate and, if the aircraft is stationary, corrects it with
+   * the gyro measurement.
+   *
+   * @param input The estimator inputs.
+   * @param Ts The length of the step (s).
+   */
+  void update_gyro_bias(const Input & input, float Ts);
+
+  /**
+   * @brief Initializes the vertical channel covariance with the ROS2 parameters
+   */
+  void initialize_vertical_covariance();
 
   /**
    * @brief This declares each parameter as a parameter so that the ROS2 parameter system can recognize each parameter.
@@ -129,6 +325,18 @@ private:
   */
   void update_measurement_model_parameters();
 
+  /**
+   * @brief Computes the low pass filter constants for the given time step.
+   *
+   * @param Ts The time step between estimates (s).
+   */
+  void update_lpf_alphas(float Ts);
+
+  /**
+   * @brief Resolves the handles to the parameters used in the estimation loop
+   */
+  void bind_parameters();
+
   /**
    * @brief Initializes the covariance matrices and process noise matrices with the ROS2 parameters
    */
@@ -0,0 +1,272 @@
+/**
+ * @file estimator_continuous_discrete_models.hpp
+ *
+ * The attitude and position models of EstimatorContinuousDiscrete, as free functions so the
+ * benchmarks and tests can run the same models as the estimator without a ROS node.
+ */
+
+#ifndef ESTIMATOR_CONTINUOUS_DISCRETE_MODELS_H
+#define ESTIMATOR_CONTINUOUS_DISCRETE_MODELS_H
+
+#include <cmath>
+
+#include <Eigen/Dense>
+
+namespace rosplane
+{
+
+namespace continuous_discrete
+{
+
+/**
+ * @brief The attitude model. The state is phi and theta, the inputs are p, q and r.
+ */
+inline Eigen::Vector2f attitude_dynamics(const Eigen::Vector2f & state,
+                                         const Eigen::Vector3f & angular_rates)
+{
+  float cp = cosf(state(0)); // cos(phi)
+  float sp = sinf(state(0)); // sin(phi)
+  float tt = tanf(state(1)); // tan(theta)
+
+  float p = angular_rates(0);
+  float q = angular_rates(1);
+  float r = angular_rates(2);
+
+  Eigen::Vector2f f;
+
+  f(0) = p + (q * sp + r * cp) * tt;
+  f(1) = q * cp - r * sp;
+
+  return f;
+}
+
+inline Eigen::Matrix2f attitude_jacobian(const Eigen::Vector2f & state,
+                                         const Eigen::Vector3f & angular_rates)
+{
+  float cp = cosf(state(0)); // cos(phi)
+  float sp = sinf(state(0)); // sin(phi)
+  float tt = tanf(state(1)); // tan(theta)
+  float ct = cosf(state(1)); // cos(theta)
+
+  float q = angular_rates(1);
+  float r = angular_rates(2);
+
+  Eigen::Matrix2f A = Eigen::Matrix2f::Zero();
+  A(0, 0) = (q * cp - r * sp) * tt;
+  A(0, 1) = (q * sp + r * cp) / ct / ct;
+  A(1, 0) = -q * sp - r * cp;
+
+  return A;
+}
+
+inline Eigen::Matrix<float, 2, 3> attitude_input_jacobian(const Eigen::Vector2f & state,
+                                                          const Eigen::Vector3f &)
+{
+  float cp = cosf(state(0)); // cos(phi)
+  float sp = sinf(state(0)); // sin(phi)
+  float tt = tanf(state(1)); // tan(theta)
+
+  Eigen::Matrix<float, 2, 3> G;
+  G << 1, sp * tt, cp * tt, 0.0, cp, -sp;
+
+  return G;
+}
+
+/**
+ * @brief The accelerometer model of the attitude filter. The inputs are p, q, r and va.
+ */
+inline Eigen::Vector3f attitude_measurement_prediction(const Eigen::Vector2f & state,
+                                                       const Eigen::Vector4f & inputs,
+                                                       double gravity)
+{
+  float cp = cosf(state(0)); // cos(phi)
+  float sp = sinf(state(0)); // sin(phi)
+  float st = sinf(state(1)); // sin(theta)
+  float ct = cosf(state(1)); // cos(theta)
+
+  float p = inputs(0);
+  float q = inputs(1);
+  float r = inputs(2);
+  float va = inputs(3);
+
+  Eigen::Vector3f h = Eigen::Vector3f::Zero();
+  h(0) = q * va * st + gravity * st;
+  h(1) = r * va * ct - p * va * st - gravity * ct * sp;
+  h(2) = -q * va * ct - gravity * ct * cp;
+
+  return h;
+}
+
+inline Eigen::Matrix<float, 3, 2> attitude_measurement_jacobian(const Eigen::Vector2f & state,
+                                                                const Eigen::Vector4f & inputs,
+                                                                double gravity)
+{
+  float cp = cosf(state(0));
+  float sp = sinf(state(0));
+  float ct = cosf(state(1));
+  float st = sinf(state(1));
+
+  float p = inputs(0);
+  float q = inputs(1);
+  float r = inputs(2);
+  float va = inputs(3);
+
+  Eigen::Matrix<float, 3, 2> C;
+
+  C << 0.0, q * va * ct + gravity * ct, -gravity * cp * ct,
+    -r * va * st - p * va * ct + gravity * sp * st, gravity * sp * ct, (q * va + gravity * cp) * st;
+
+  return C;
+}
+
+/**
+ * @brief The position model. The state is pn, pe, Vg, chi, wn, we and psi, the inputs are p, q,
+ * r, phi, theta and va.
+ */
+inline Eigen::Vector<float, 7> position_dynamics(const Eigen::Vector<float, 7> & state,
+                                                 const Eigen::Vector<float, 6> & inputs,
+                                                 double gravity)
+{
+  float Vg = state(2);
+  float chi = state(3);
+  float wn = state(4);
+  float we = state(5);
+  float psi = state(6);
+
+  float q = inputs(1);
+  float r = inputs(2);
+  float phi = inputs(3);
+  float theta = inputs(4);
+  float va = inputs(5);
+
+  float psidot = (q * sinf(phi) + r * cosf(phi)) / cosf(theta);
+
+  float Vgdot = va / Vg * psidot * (we * cosf(psi) - wn * sinf(psi));
+
+  Eigen::Vector<float, 7> f = Eigen::Vector<float, 7>::Zero();
+
+  f(0) = Vg * cosf(chi);
+  f(1) = Vg * sinf(chi);
+  f(2) = Vgdot;
+  f(3) = gravity / Vg * tanf(phi) * cosf(chi - psi);
+  f(6) = psidot;
+
+  return f;
+}
+
+/**
+ * @brief The jacobian of the position model. Linearized about the roll angle in the inputs, the
+ * same one the dynamics are evaluated with.
+ */
+inline Eigen::Matrix<float, 7, 7> position_jacobian(const Eigen::Vector<float, 7> & state,
+                                                    const Eigen::Vector<float, 6> & inputs,
+                                                    double gravity)
+{
+  float Vg = state(2);
+  float chi = state(3);
+  float wn = state(4);
+  float we = state(5);
+  float psi = state(6);
+
+  float q = inputs(1);
+  float r = inputs(2);
+  float phi = inputs(3);
+  float theta = inputs(4);
+  float va = inputs(5);
+
+  float psidot = (q * sinf(phi) + r * cosf(phi)) / cosf(theta);
+
+  float Vgdot = va / Vg * psidot * (wn * cosf(psi) - we * sinf(psi));
+
+  Eigen::Matrix<float, 7, 7> A = Eigen::Matrix<float, 7, 7>::Zero();
+  A(0, 2) = cosf(chi);
+  A(0, 3) = -Vg * sinf(chi);
+  A(1, 2) = sinf(chi);
+  A(1, 3) = Vg * cosf(chi);
+  A(2, 2) = -Vgdot / Vg;
+  A(2, 4) = -psidot * va * sinf(psi) / Vg;
+  A(2, 5) = psidot * va * cosf(psi) / Vg;
+  A(2, 6) = -psidot * va * (wn * cosf(psi) + we * sinf(psi)) / Vg;
+  A(3, 2) = -gravity / powf(Vg, 2) * tanf(phi);
+
+  return A;
+}
+
+/**
+ * @brief The GPS model of the position filter. The input is va.
+ */
+inline Eigen::Vector<float, 6>
+position_measurement_prediction(const Eigen::Vector<float, 7> & state,
+                                const Eigen::Vector<float, 1> & input)
+{
+  float va = input(0);
+
+  Eigen::Vector<float, 6> h = Eigen::Vector<float, 6>::Zero();
+
+  // GPS north
+  h(0) = state(0);
+
+  // GPS east
+  h(1) = state(1);
+
+  // GPS ground speed
+  h(2) = state(2);
+
+  // GPS course
+  h(3) = state(3);
+
+  // Pseudo Measurement north
+  h(4) = va * cosf(state(6)) + state(4) - state(2) * cosf(state(3));
+
+  // Pseudo Measurement east
+  h(5) = va * sinf(state(6)) + state(5) - state(2) * sinf(state(3));
+
+  // To add a new measurement, simply use the state and any input you need as another entry to h.
+  // Be sure to update the measurement jacobian C.
+
+  return h;
+}
+
+inline Eigen::Matrix<float, 6, 7>
+position_measurement_jacobian(const Eigen::Vector<float, 7> & state,
+                              const Eigen::Vector<float, 1> & input)
+{
+  float va = input(0);
+
+  Eigen::Matrix<float, 6, 7> C = Eigen::Matrix<float, 6, 7>::Zero();
+
+  // GPS north
+  C(0, 0) = 1;
+
+  // GPS east
+  C(1, 1) = 1;
+
+  // GPS ground speed
+  C(2, 2) = 1;
+
+  // GPS course
+  C(3, 3) = 1;
+
+  // Pseudo Measurement north
+  C(4, 2) = -cosf(state(3));
+  C(4, 3) = state(2) * sinf(state(3));
+  C(4, 4) = 1;
+  C(4, 6) = -va * sinf(state(6));
+
+  // Pseudo Measurement east
+  C(5, 2) = -sinf(state(3));
+  C(5, 3) = -state(2) * cosf(state(3));
+  C(5, 5) = 1;
+  C(5, 6) = va * cosf(state(6));
+
+  // To add a new measurement use the inputs and the state to add another row to the matrix C. Be
+  // sure to update the measurement prediction vector h.
+
+  return C;
+}
+
+} // namespace continuous_discrete
+
+} // namespace rosplane
+
+#endif // ESTIMATOR_CONTINUOUS_DISCRETE_MODELS_H
@@ -3,42 +3,24 @@
 
 #include <cassert>
 #include <math.h>
-#include <tuple>
 
 #include <Eigen/Geometry>
 #include <yaml-cpp/yaml.h>
 
+#include "ekf_core.hpp"
 #include "estimator_ros.hpp"
 
 namespace rosplane
 {
 
+/**
+ * Base class for the EKF estimators. The filter math itself lives in EKFCore, which children
+ * instantiate with the fixed state and input sizes of each of their filters.
+ */
 class EstimatorEKF : public EstimatorROS
 {
 public:
-  EstimatorEKF();
-
-protected:
-  std::tuple<Eigen::MatrixXf, Eigen::VectorXf> measurement_update(
-    Eigen::VectorXf x, Eigen::VectorXf inputs,
-    std::function<Eigen::VectorXf(const Eigen::VectorXf, const Eigen::VectorXf)> measurement_model,
-    Eigen::VectorXf y,
-    std::function<Eigen::MatrixXf(const Eigen::VectorXf, const Eigen::VectorXf)>
-      measurement_jacobian,
-    Eigen::MatrixXf R, Eigen::MatrixXf P);
-
-  std::tuple<Eigen::MatrixXf, Eigen::VectorXf> propagate_model(
-    Eigen::VectorXf x,
-    std::function<Eigen::VectorXf(const Eigen::VectorXf &, const Eigen::VectorXf &)> dynamic_model,
-    std::function<Eigen::MatrixXf(const Eigen::VectorXf &, const Eigen::VectorXf &)> jacobian,
-    Eigen::VectorXf inputs,
-    std::function<Eigen::MatrixXf(const Eigen::VectorXf &, const Eigen::VectorXf &)> input_jacobian,
-    Eigen::MatrixXf P, Eigen::MatrixXf Q, Eigen::MatrixXf Q_g, float Ts);
-
-  std::tuple<Eigen::MatrixXf, Eigen::VectorXf>
-  single_measurement_update(float measurement, float mesurement_prediction,
-                            float measurement_uncertainty, Eigen::VectorXf measurement_jacobian,
-                            Eigen::VectorXf x, Eigen::MatrixXf P);
+  explicit EstimatorEKF(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
 
 private:
   virtual void estimate(const Input & input, Output & output) override = 0;
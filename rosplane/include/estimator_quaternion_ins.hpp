@@ -0,0 +1,183 @@
+/**
+ * @file estimator_quaternion_ins.hpp
+ *
+ * Quaternion error-state EKF estimator: a strapdown INS driven by the gyros and accelerometers and
+ * corrected with GPS, barometer and airspeed measurements.
+ */
+
+#ifndef ESTIMATOR_QUATERNION_INS_H
+#define ESTIMATOR_QUATERNION_INS_H
+
+#include <Eigen/Geometry>
+
+#include "estimator_ekf.hpp"
+#include "estimator_ros.hpp"
+
+namespace rosplane
+{
+
+/**
+ * Full state INS estimator, an alternative to EstimatorContinuousDiscrete.
+ *
+ * The nominal state is the NED position and velocity, the body to NED attitude quaternion, the
+ * gyro and accelerometer biases and the horizontal wind. It is integrated from the IMU without
+ * linearization. The EKF runs on the 17 state error of that nominal state: position, velocity,
+ * the rotation vector of the attitude error in the body frame, both biases and the wind. After
+ * every measurement update the error is folded into the nominal state and reset to zero.
+ *
+ * Altitude, angle of attack and sideslip are estimated rather than derived from the barometer or
+ * assumed zero, and heading is observed through the GPS velocity, the airspeed and a zero
+ * sideslip pseudo measurement rather than only through the course.
+ */
+class EstimatorQuaternionINS : public EstimatorEKF
+{
+public:
+  explicit EstimatorQuaternionINS(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
+
+private:
+  virtual void estimate(const Input & input, Output & output);
+  virtual void fill_diagnostics(rosplane_msgs::msg::EstimatorDiagnostics & diagnostics) override;
+
+  /**
+   * The error-state filter. The error is zero between updates, so the filter is only used for its
+   * covariance propagation and measurement updates. Its inputs are the bias-corrected specific
+   * force and angular rate.
+   */
+  using ErrorEKF = EKFCore<17, 6>;
+
+  /**
+   * Offsets of the blocks of the error state.
+   */
+  static constexpr int position_index_ = 0;
+  static constexpr int velocity_index_ = 3;
+  static constexpr int attitude_index_ = 6;
+  static constexpr int gyro_bias_index_ = 9;
+  static constexpr int accel_bias_index_ = 12;
+  static constexpr int wind_index_ = 15;
+
+  /**
+   * The leading error states with dynamics: position, velocity and attitude. The biases and the
+   * wind are random walks.
+   */
+  static constexpr int num_dynamic_states_ = 9;
+
+  Eigen::Vector3f position_;   /**< NED position relative to the initial GPS fix (m) */
+  Eigen::Vector3f velocity_;   /**< NED velocity (m/s) */
+  Eigen::Quaternionf attitude_; /**< Rotation from the body frame to NED */
+  Eigen::Vector3f gyro_bias_;  /**< (rad/s) */
+  Eigen::Vector3f accel_bias_; /**< (m/s^2) */
+  Eigen::Vector2f wind_;       /**< North and east wind (m/s) */
+
+  ErrorEKF::StateMatrix P_; /**< Covariance of the error state */
+
+  bool initialized_;     /**< The attitude has been levelled from the accelerometers */
+  bool heading_aligned_; /**< The heading has been aligned with the first GPS course */
+
+  /**
+   * For the diagnostics. Only the GPS gate fields of the innovations are used, since the GPS
+   * measurements differ from the continuous-discrete estimator's.
+   */
+  rosplane_msgs::msg::EstimatorInnovations innovations_;
+  uint32_t reinitializations_; /**< Filter resets after a non-finite state */
+
+  /**
+   * @brief Levels the attitude from the accelerometers and resets the rest of the state and the
+   * covariance. The heading is zero until the GPS course aligns it. The biases start from the
+   * saved values if the estimator was seeded.
+   */
+  void initialize(const Input & input);
+
+  /**
+   * @brief Resets the covariance to its initial value from the ROS2 parameters.
+   */
+  void initialize_covariance();
+
+  /**
+   * @brief Integrates the nominal state and propagates the error covariance over a time step.
+   *
+   * @param angular_rate The bias-corrected angular rate (rad/s).
+   * @param specific_force The bias-corrected specific force (m/s^2).
+   * @param Ts The time step (s).
+   */
+  void propagate(const Eigen::Vector3f & angular_rate, const Eigen::Vector3f & specific_force,
+                 float Ts);
+
+  /**
+   * @brief Fuses the GPS position and horizontal velocity.
+   */
+  void fuse_gps(const Input & input);
+
+  /**
+   * @brief Fuses the leading M GPS measurements: north, east, altitude, north velocity and east
+   * velocity.
+   */
+  template<int M>
+  void fuse_gps_measurements(const Eigen::Vector<float, M> & y,
+                             const Eigen::Vector<float, M> & R_diagonal);
+
+  /**
+   * @brief Fuses the barometric altitude.
+   */
+  void fuse_baro(float static_pres);
+
+  /**
+   * @brief Fuses the airspeed and the zero sideslip pseudo measurement.
+   */
+  void fuse_air_data(float diff_pres);
+
+  /**
+   * @brief Folds a measurement update's error estimate into the nominal state.
+   */
+  void inject_error(const ErrorEKF::StateVector & error);
+
+  /**
+   * @brief Returns the velocity relative to the air mass in the body frame.
+   */
+  Eigen::Vector3f air_relative_velocity_body() const;
+
+  /**
+   * @brief Rotates the heading so the course matches a measured course, keeping the velocity
+   * along it. Used once, on the first GPS measurement with a usable course.
+   */
+  void align_heading(float gps_Vg, float gps_course);
+
+  /**
+   * @brief Reinitializes the filter if any part of the state has become non-finite.
+   */
+  void check_state(const Input & input);
+
+  /**
+   * @brief This declares each parameter as a parameter so that the ROS2 parameter system can
+   * recognize each parameter. It also sets the default parameter, which will then be overridden by
+   * a launch script.
+   */
+  void declare_parameters();
+
+  /**
+   * @brief Resolves the handles to the parameters used in the estimation loop
+   */
+  void bind_parameters();
+
+  /**
+   * Handles to the parameters used in the estimation loop, resolved once in the constructor.
+   */
+  ParamHandle<double> sigma_gyro_;
+  ParamHandle<double> sigma_accel_;
+  ParamHandle<double> gyro_bias_random_walk_;
+  ParamHandle<double> accel_bias_random_walk_;
+  ParamHandle<double> wind_random_walk_;
+  ParamHandle<double> sigma_gps_horizontal_;
+  ParamHandle<double> sigma_gps_vertical_;
+  ParamHandle<double> sigma_gps_velocity_;
+  ParamHandle<double> sigma_baro_;
+  ParamHandle<double> sigma_airspeed_;
+  ParamHandle<double> sigma_sideslip_;
+  ParamHandle<double> airspeed_fusion_threshold_;
+  ParamHandle<double> gps_gate_threshold_;
+  ParamHandle<bool> joseph_form_;
+  ParamHandle<double> ground_speed_threshold_;
+};
+
+} // namespace rosplane
+
+#endif // ESTIMATOR_QUATERNION_INS_H
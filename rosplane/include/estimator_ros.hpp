@@ -11,7 +11,9 @@
 #ifndef ESTIMATOR_ROS_H
 #define ESTIMATOR_ROS_H
 
+#include <atomic>
 #include <chrono>
+#include <vector>
 
 #include <ament_index_cpp/get_package_share_directory.hpp>
 #include <geometry_msgs/msg/twist_stamped.hpp>
@@ -23,10 +25,15 @@
 #include <sensor_msgs/msg/nav_sat_fix.hpp>
 #include <yaml-cpp/yaml.h>
 
+#include "geodesy.hpp"
+#include "held_measurement_queue.hpp"
 #include "param_manager.hpp"
+#include "rosplane_msgs/msg/baro_calibration.hpp"
+#include "rosplane_msgs/msg/estimator_diagnostics.hpp"
+#include "rosplane_msgs/msg/estimator_innovations.hpp"
 #include "rosplane_msgs/msg/state.hpp"
-
-#define EARTH_RADIUS 6378145.0f
+#include "spsc_ring_buffer.hpp"
+#include "streaming_statistics.hpp"
 
 using std::placeholders::_1;
 using namespace std::chrono_literals;
@@ -37,11 +44,13 @@ namespace rosplane
 class EstimatorROS : public rclcpp::Node
 {
 public:
-  EstimatorROS();
+  explicit EstimatorROS(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
 
 protected:
   struct Input
   {
+    double stamp; /**< Time the estimate is made at (s) */
+    float Ts;     /**< Time since the last estimate (s) */
     float gyro_x;
     float gyro_y;
     float gyro_z;
@@ -50,12 +59,16 @@ protected:
     float accel_z;
     float static_pres;
     float diff_pres;
+    bool baro_new;     /**< A barometer measurement arrived since the last estimate */
+    bool airspeed_new; /**< An airspeed measurement arrived since the last estimate */
     bool gps_new;
     float gps_n;
     float gps_e;
     float gps_h;
     float gps_Vg;
     float gps_course;
+    float gps_vd; /**< GPS down velocity (m/s) */
+    double gps_stamp; /**< Time the GPS fix was measured at (s) */
     bool status_armed;
     bool armed_init;
   };
@@ -85,11 +98,110 @@ protected:
   virtual void estimate(const Input & input, Output & output) = 0;
 
   ParamManager params_;
+
+  /**
+   * Handles to the parameters shared by the estimation loop and the sensor callbacks. These are
+   * resolved once in the constructor so the hot paths do not look parameters up by name.
+   */
+  ParamHandle<double> rho_;
+  ParamHandle<double> gravity_;
+  ParamHandle<double> update_frequency_;
+
+  /**
+   * The sensor message handlers. These are protected, not private, so that a derived class can
+   * drive the estimator with recorded or synthetic messages instead of subscriptions, as
+   * SensorFedEstimator does for the offline replay, the tests and the benchmarks.
+   */
+  void gnssFixCallback(const sensor_msgs::msg::NavSatFix::SharedPtr msg);
+  void gnssVelCallback(const geometry_msgs::msg::TwistStamped::SharedPtr msg);
+  void imuCallback(const sensor_msgs::msg::Imu::SharedPtr msg);
+  void baroAltCallback(const rosflight_msgs::msg::Barometer::SharedPtr msg);
+  void airspeedCallback(const rosflight_msgs::msg::Airspeed::SharedPtr msg);
+  void statusCallback(const rosflight_msgs::msg::Status::SharedPtr msg);
+
+  /**
+   * @brief Outputs the estimated state. Publishes it on the estimated_state topic by default.
+   * Not called when the node uses intra-process communication, which publishes the state as a
+   * unique pointer instead.
+   *
+   * @param msg The estimated state.
+   */
+  virtual void publish_state(const rosplane_msgs::msg::State & msg);
+
+  /**
+   * @brief Adds the estimator specific parts of the diagnostics: the covariance diagonal, the
+   * innovations and the reinitialization count. Called on every diagnostics message.
+   *
+   * @param diagnostics The message to fill. The timing and sensor fields are already set.
+   */
+  virtual void fill_diagnostics(rosplane_msgs::msg::EstimatorDiagnostics & diagnostics);
+
+  /**
+   * @brief Copies the estimator's latest innovations and gating decisions. Called every
+   * innovations_decimation estimates, outside the timed estimate().
+   *
+   * @param innovations The message to fill. The header is set by the caller.
+   * @return False if the estimator has no innovations to publish, the default.
+   */
+  virtual bool fill_innovations(rosplane_msgs::msg::EstimatorInnovations & innovations);
+
+  /**
+   * @brief Outputs the diagnostics. Publishes them on the estimator_diagnostics topic by default.
+   *
+   * @param msg The diagnostics.
+   */
+  virtual void publish_diagnostics(const rosplane_msgs::msg::EstimatorDiagnostics & msg);
+
+  /**
+   * @brief Outputs the innovations. Publishes them on the estimator_innovations topic by default.
+   *
+   * @param msg The innovations.
+   */
+  virtual void publish_innovations(const rosplane_msgs::msg::EstimatorInnovations & msg);
+
+  /**
+   * @brief This saves parameters to the param file for later use. The write happens on the
+   * ParamManager's persistence thread, so this does not wait on the disk.
+   *
+   * @param param_name The name of the parameter.
+   * @param param_val The value of the parameter.
+   */
+  virtual void saveParameter(std::string param_name, double param_val);
+
+  /**
+   * @brief Persists the IMU biases once their estimates have converged and moved away from the
+   * saved values by more than their converged standard deviation. Called by the estimators after
+   * every bias update.
+   *
+   * @param gyro_bias The gyro bias estimate (rad/s).
+   * @param gyro_bias_var The variance of each axis of the gyro bias estimate.
+   * @param accel_bias The accelerometer bias estimate (m/s^2).
+   * @param accel_bias_var The variance of each axis of the accelerometer bias estimate. Infinite
+   * if the estimator does not estimate it.
+   */
+  void persist_imu_biases(const Eigen::Vector3f & gyro_bias, const Eigen::Vector3f & gyro_bias_var,
+                          const Eigen::Vector3f & accel_bias,
+                          const Eigen::Vector3f & accel_bias_var);
+
+  /**
+   * @brief Seeds the GPS origin, the barometer calibration and the IMU biases with the values saved
+   * in the parameters, so the estimator does not wait to initialize them.
+   */
+  void seed_from_parameters();
+
+  /**
+   * IMU biases saved by an earlier run, which the estimators start from. Zero unless the estimator
+   * was seeded from the parameters.
+   */
+  Eigen::Vector3f gyro_bias_seed_;  /**< (rad/s) */
+  Eigen::Vector3f accel_bias_seed_; /**< (m/s^2) */
+
   bool gps_init_;
   double init_lat_ = 0.0; /**< Initial latitude in degrees */
   double init_lon_ = 0.0; /**< Initial longitude in degrees */
   float init_alt_ = 0.0;  /**< Initial altitude in meters above MSL  */
   float init_static_;     /**< Initial static pressure (mbar)  */
+  LocalTangentPlane gps_origin_; /**< Tangent plane at the initial position */
 
 private:
   rclcpp::Publisher<rosplane_msgs::msg::State>::SharedPtr vehicle_state_pub_;
@@ -103,24 +215,209 @@ private:
 
   std::string param_filepath_ = "estimator_params.yaml";
 
+  /**
+   * A single stamped IMU sample, as handed from the IMU callback to the estimator.
+   */
+  struct ImuSample
+  {
+    rclcpp::Time stamp;
+    float gyro_x;
+    float gyro_y;
+    float gyro_z;
+    float accel_x;
+    float accel_y;
+    float accel_z;
+  };
+
   void update();
-  void gnssFixCallback(const sensor_msgs::msg::NavSatFix::SharedPtr msg);
-  void gnssVelCallback(const geometry_msgs::msg::TwistStamped::SharedPtr msg);
-  void imuCallback(const sensor_msgs::msg::Imu::SharedPtr msg);
-  void baroAltCallback(const rosflight_msgs::msg::Barometer::SharedPtr msg);
+
+  /**
+   * @brief Fills the state message from the estimator output.
+   */
+  void fill_state(const rclcpp::Time & stamp, const Output & output,
+                  rosplane_msgs::msg::State & msg);
+
+  /**
+   * @brief Integrates every IMU sample received since the last timer update into the estimator
+   * inputs. The gyro and accelerometer inputs become the average rates over the interval, which
+   * are the integrated delta angles and delta velocities divided by the interval.
+   */
+  void integrate_imu_samples();
+
+  /**
+   * @brief Runs the estimator once on each IMU sample waiting in the buffer. Used in event-driven
+   * mode, where the time step is the true time between IMU stamps instead of the timer period.
+   */
+  void process_imu_samples();
+
   /**
-   * @brief This saves parameters to the param file for later use.
+   * @brief Runs the estimator on a single IMU sample.
    *
-   * @param param_name The name of the parameter.
-   * @param param_val The value of the parameter.
+   * @param sample The IMU sample to propagate to.
    */
-  void saveParameter(std::string param_name, double param_val);
-  void airspeedCallback(const rosflight_msgs::msg::Airspeed::SharedPtr msg);
-  void statusCallback(const rosflight_msgs::msg::Status::SharedPtr msg);
+  void imu_update(const ImuSample & sample);
+
+  /**
+   * @brief Checks whether a measurement should be held until the IMU stream reaches its stamp.
+   * Measurements are only held in event-driven mode, once the first IMU sample has been received.
+   *
+   * @param stamp The header stamp of the measurement.
+   * @return True if the measurement is ahead of the latest IMU sample.
+   */
+  bool is_ahead_of_imu(const builtin_interfaces::msg::Time & stamp);
+
+  /**
+   * @brief Applies the held measurements whose stamps are at or before the given IMU stamp.
+   *
+   * @param stamp The header stamp of the current IMU sample.
+   */
+  void release_held_measurements(const rclcpp::Time & stamp);
+
+  /**
+   * @brief Holds a measurement until the IMU stream reaches its stamp, counting it if the queue
+   * was full and the oldest held measurement was dropped.
+   */
+  template<typename MsgPtr, std::size_t Capacity>
+  void hold_measurement(HeldMeasurementQueue<MsgPtr, Capacity> & queue, MsgPtr msg)
+  {
+    if (!queue.push(std::move(msg))) {
+      held_measurements_dropped_++;
+    }
+  }
+
+  /**
+   * @brief Applies the held measurements of one sensor that are at or before the given stamp, or
+   * all of them outside of event-driven mode.
+   */
+  template<typename MsgPtr, std::size_t Capacity, typename Callback>
+  void release_held(HeldMeasurementQueue<MsgPtr, Capacity> & queue, const rclcpp::Time & stamp,
+                    Callback callback)
+  {
+    while (!queue.empty()
+           && (!event_driven_ || rclcpp::Time(queue.front()->header.stamp) <= stamp)) {
+      (this->*callback)(queue.pop());
+    }
+  }
+
+  /**
+   * @brief Logs the number of dropped and duplicated IMU samples when it changes.
+   */
+  void report_imu_sample_counts();
+
+  /**
+   * Arrivals of one sensor's messages, for the diagnostics.
+   */
+  struct SensorStats
+  {
+    double last_stamp = 0.0; /**< Header stamp of the last message (s) */
+    uint32_t count = 0;      /**< Messages since the last diagnostics message */
+    bool received = false;   /**< A message has been received since startup */
+
+    void record(const rclcpp::Time & stamp)
+    {
+      last_stamp = stamp.seconds();
+      count++;
+      received = true;
+    }
+  };
+
+  /**
+   * @brief Accumulates the timing of a tick and publishes the diagnostics every
+   * diagnostics_decimation ticks.
+   *
+   * @param stamp The stamp of the estimate.
+   * @param ran_estimate Whether the tick ran the estimator.
+   * @param estimate_time The execution time of estimate() (s).
+   */
+  void record_diagnostics(const rclcpp::Time & stamp, bool ran_estimate, double estimate_time);
+
+  /**
+   * @brief Publishes the diagnostics accumulated since the last message and starts a new window.
+   *
+   * @param stamp The stamp of the latest estimate.
+   */
+  void finish_diagnostics_window(const rclcpp::Time & stamp);
+
+  /**
+   * @brief Publishes the innovations every innovations_decimation estimates.
+   *
+   * @param stamp The stamp of the estimate.
+   */
+  void record_innovations(const rclcpp::Time & stamp);
 
   rclcpp::TimerBase::SharedPtr update_timer_;
   std::chrono::microseconds update_period_;
   bool params_initialized_;
+
+  /**
+   * Event-driven mode state. When the event_driven_estimation parameter is set, the estimator
+   * runs on every IMU message instead of on the timer.
+   */
+  std::atomic<bool> event_driven_;
+  bool imu_stamp_init_;        /**< Set once the first IMU stamp has been received */
+  rclcpp::Time last_imu_stamp_; /**< Stamp of the last IMU sample used for propagation */
+  int64_t imu_samples_dropped_;    /**< IMU samples missed by the estimator */
+  int64_t imu_samples_duplicated_; /**< IMU samples the estimator used more than once */
+  int64_t imu_samples_reported_;   /**< Dropped + duplicated count at the last report */
+
+  /**
+   * Measurements that arrived ahead of the latest IMU sample in event-driven mode. Each is
+   * applied, in order, once an IMU sample at or after its stamp has been received. A few are held
+   * per sensor; when a queue is full the oldest is dropped and counted. Measurements at or behind
+   * the IMU are applied on arrival, at the current step. Only GPS fixes are fused at their own
+   * stamps, through the position filter's history.
+   */
+  static constexpr std::size_t held_measurement_capacity = 4;
+  HeldMeasurementQueue<rosflight_msgs::msg::Barometer::SharedPtr, held_measurement_capacity>
+    held_baro_;
+  HeldMeasurementQueue<rosflight_msgs::msg::Airspeed::SharedPtr, held_measurement_capacity>
+    held_airspeed_;
+  HeldMeasurementQueue<sensor_msgs::msg::NavSatFix::SharedPtr, held_measurement_capacity>
+    held_gnss_fix_;
+  HeldMeasurementQueue<geometry_msgs::msg::TwistStamped::SharedPtr, held_measurement_capacity>
+    held_gnss_vel_;
+  int64_t held_measurements_dropped_; /**< Held measurements dropped from a full queue */
+
+  /**
+   * IMU samples waiting for the estimator. The IMU callback is the only producer and the estimator
+   * update the only consumer, so in timer mode the IMU subscription runs in its own callback group
+   * and can use a separate executor thread. In event-driven mode the estimator runs inside the IMU
+   * callback, so the subscription is moved to the default group with the other sensor callbacks.
+   */
+  SpscRingBuffer<ImuSample, 64> imu_buffer_;
+  std::atomic<int64_t> imu_samples_overflowed_; /**< IMU samples lost to a full buffer */
+  rclcpp::CallbackGroup::SharedPtr imu_callback_group_;
+  bool imu_sub_event_driven_; /**< The update mode the IMU subscription was created for */
+
+  /**
+   * Diagnostics of the current window. The message and the execution time buffer are reused, so
+   * after the first window the diagnostics do not allocate.
+   */
+  rclcpp::Publisher<rosplane_msgs::msg::EstimatorDiagnostics>::SharedPtr diagnostics_pub_;
+  rosplane_msgs::msg::EstimatorDiagnostics diagnostics_;
+  std::vector<float> estimate_times_; /**< Execution times of estimate() in the window (s) */
+  uint32_t diagnostics_ticks_;        /**< Ticks in the window */
+  double tick_jitter_sum_;            /**< Sum of the absolute tick jitter in the window (s) */
+  double tick_jitter_max_;            /**< Largest absolute tick jitter in the window (s) */
+  uint32_t tick_jitter_count_;        /**< Ticks in the window with a jitter measurement */
+  double diagnostics_window_start_;   /**< Stamp of the last estimate of the previous window (s) */
+  bool diagnostics_window_init_;      /**< The window has a start stamp */
+
+  /**
+   * Innovations, published at a lower rate than the estimates and outside of the timed estimate().
+   */
+  rclcpp::Publisher<rosplane_msgs::msg::EstimatorInnovations>::SharedPtr innovations_pub_;
+  rosplane_msgs::msg::EstimatorInnovations innovations_msg_;
+  int64_t innovations_estimates_; /**< Estimates since the innovations were last published */
+  std::chrono::steady_clock::time_point last_tick_time_;
+  bool last_tick_time_init_;
+  bool intra_process_; /**< Publish the state as a unique pointer to subscribers in this process */
+  SensorStats imu_stats_;
+  SensorStats baro_stats_;
+  SensorStats airspeed_stats_;
+  SensorStats gnss_fix_stats_;
+  SensorStats gnss_vel_stats_;
+
   std::string gnss_fix_topic_ = "navsat_compat/fix";
   std::string gnss_vel_topic_ = "navsat_compat/vel";
   std::string imu_topic_ = "imu/data";
@@ -129,9 +426,52 @@ private:
   std::string status_topic_ = "status";
 
   bool gps_new_;
-  bool armed_first_time_;                 /**< Arm before starting estimation  */
-  int baro_count_;                        /**< Used to grab the first set of baro measurements */
-  std::vector<float> init_static_vector_; /**< Used to grab the first set of baro measurements */
+  bool armed_first_time_; /**< Arm before starting estimation  */
+
+  /**
+   * @brief Adds a pressure measurement to the barometer calibration, and completes the calibration
+   * once enough samples have been accepted.
+   *
+   * Samples outside the fences of the quartiles seen so far are rejected one at a time rather than
+   * restarting the calibration. It is only restarted if the fraction of rejected samples is too
+   * high once enough samples have been accepted.
+   */
+  void calibrate_baro(double pressure, const builtin_interfaces::msg::Time & stamp);
+
+  void reset_baro_calibration();
+
+  /**
+   * @brief Publishes the progress and quality of the barometer calibration.
+   */
+  void publish_baro_calibration(const builtin_interfaces::msg::Time & stamp);
+
+  /**
+   * Statistics of the barometer calibration, which run in constant memory for any number of
+   * samples.
+   */
+  RunningStatistics baro_calibration_stats_; /**< Of the accepted samples */
+  P2QuantileEstimator baro_q1_;              /**< Of all samples */
+  P2QuantileEstimator baro_q3_;              /**< Of all samples */
+  uint32_t baro_outliers_;                   /**< Samples rejected in this calibration */
+  uint32_t baro_calibration_restarts_;
+  rclcpp::Publisher<rosplane_msgs::msg::BaroCalibration>::SharedPtr baro_calibration_pub_;
+
+  ParamHandle<double> gps_ground_speed_threshold_;
+  ParamHandle<double> baro_measurement_gate_;
+  ParamHandle<double> airspeed_measurement_gate_;
+  ParamHandle<int64_t> baro_calibration_count_;
+  ParamHandle<double> baro_calibration_outlier_fence_;
+  ParamHandle<double> baro_calibration_max_outliers_;
+  ParamHandle<int64_t> diagnostics_decimation_;
+  ParamHandle<int64_t> innovations_decimation_;
+  ParamHandle<double> gyro_bias_converged_std_;
+  ParamHandle<double> accel_bias_converged_std_;
+
+  /**
+   * The IMU biases as last saved to the param file.
+   */
+  Eigen::Vector3f persisted_gyro_bias_;
+  Eigen::Vector3f persisted_accel_bias_;
 
   /**
    * This declares each parameter as a parameter so that the ROS2 parameter system can recognize each parameter.
@@ -144,6 +484,12 @@ private:
    */
   void set_timer();
 
+  /**
+   * @brief Creates the IMU subscription in the callback group the update mode needs, recreating
+   * it when the mode has changed.
+   */
+  void create_imu_subscription();
+
   /**
    * ROS2 parameter system interface. This connects ROS2 parameters with the defined update callback, parametersCallback.
    */
@@ -0,0 +1,113 @@
+/**
+ * @file gain_schedule.hpp
+ *
+ * Lookup table of controller gains indexed by a flight condition, such as the airspeed, for
+ * aircraft whose fixed gains are sluggish at one end of the envelope and oscillatory at the other.
+ */
+
+#ifndef GAIN_SCHEDULE_H
+#define GAIN_SCHEDULE_H
+
+#include <array>
+
+namespace rosplane
+{
+
+/**
+ * The flight condition that a gain schedule is indexed by.
+ */
+enum class ScheduleVariable
+{
+  NONE,            /**< Gains are not scheduled */
+  AIRSPEED,        /**< Airspeed (m/s) */
+  ALTITUDE,        /**< Altitude (m) */
+  DYNAMIC_PRESSURE /**< Dynamic pressure, 1/2 rho va^2 (Pa) */
+};
+
+/**
+ * Gains at a few breakpoints of a schedule variable, interpolated linearly in between and held
+ * constant past the first and last breakpoints.
+ *
+ * The table has a fixed capacity and lives inside the object, with the breakpoints and then the
+ * rows of gains each stored contiguously, so an interpolation touches a few cache lines and never
+ * allocates.
+ *
+ * @tparam NUM_GAINS Number of gains in each row.
+ * @tparam MAX_BREAKPOINTS Capacity of the table.
+ */
+template<int NUM_GAINS, int MAX_BREAKPOINTS = 8>
+class GainSchedule
+{
+public:
+  using Row = std::array<float, NUM_GAINS>;
+
+  static constexpr int capacity = MAX_BREAKPOINTS;
+
+  GainSchedule()
+      : size_(0)
+  {}
+
+  void clear() { size_ = 0; }
+
+  /**
+   * Adds a breakpoint after the last one.
+   * @param key The value of the schedule variable at the breakpoint.
+   * @param gains The gains at the breakpoint.
+   * @return False, and the table is unchanged, if it is full or key is not larger than the last
+   * breakpoint.
+   */
+  bool add_breakpoint(float key, const Row & gains)
+  {
+    if (size_ == MAX_BREAKPOINTS || (size_ > 0 && !(key > keys_[size_ - 1]))) {
+      return false;
+    }
+    keys_[size_] = key;
+    rows_[size_] = gains;
+    size_++;
+    return true;
+  }
+
+  int size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /**
+   * Interpolates the gains at a value of the schedule variable. The table must not be empty.
+   * @param key The current value of the schedule variable. A NaN gives the first row.
+   * @param gains The interpolated gains.
+   */
+  void interpolate(float key, Row & gains) const
+  {
+    if (size_ == 1) {
+      gains = rows_[0];
+      return;
+    }
+
+    // There are only a few breakpoints, so a linear search is as fast as a binary one.
+    int i = 0;
+    while (i < size_ - 2 && key >= keys_[i + 1]) {
+      i++;
+    }
+
+    float t = (key - keys_[i]) / (keys_[i + 1] - keys_[i]);
+    if (!(t > 0.0f)) {
+      t = 0.0f;
+    } else if (t > 1.0f) {
+      t = 1.0f;
+    }
+
+    const Row & lower = rows_[i];
+    const Row & upper = rows_[i + 1];
+    for (int j = 0; j < NUM_GAINS; j++) {
+      gains[j] = lower[j] + t * (upper[j] - lower[j]);
+    }
+  }
+
+private:
+  std::array<float, MAX_BREAKPOINTS> keys_;
+  std::array<Row, MAX_BREAKPOINTS> rows_;
+  int size_;
+};
+
+} // namespace rosplane
+
+#endif // GAIN_SCHEDULE_H
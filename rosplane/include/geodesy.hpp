@@ -0,0 +1,203 @@
+/**
+ * @file geodesy.hpp
+ *
+ * Conversions between geodetic coordinates (latitude, longitude and height on the WGS-84
+ * ellipsoid), earth-centered earth-fixed (ECEF) coordinates and a local tangent plane in north,
+ * east, down (NED) or east, north, up (ENU). Latitudes and longitudes are in degrees, everything
+ * else in meters. All math is in double precision, which ECEF coordinates need to resolve
+ * millimeters.
+ */
+
+#ifndef GEODESY_H
+#define GEODESY_H
+
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Dense>
+
+namespace rosplane
+{
+
+/**
+ * The WGS-84 ellipsoid.
+ */
+constexpr double WGS84_A = 6378137.0;                    /**< Semi-major axis (m) */
+constexpr double WGS84_F = 1.0 / 298.257223563;          /**< Flattening */
+constexpr double WGS84_B = WGS84_A * (1.0 - WGS84_F);    /**< Semi-minor axis (m) */
+constexpr double WGS84_E2 = WGS84_F * (2.0 - WGS84_F);   /**< First eccentricity squared */
+constexpr double WGS84_EP2 = WGS84_E2 / (1.0 - WGS84_E2); /**< Second eccentricity squared */
+
+/**
+ * @brief Converts geodetic coordinates to ECEF.
+ *
+ * @param lat Latitude (deg).
+ * @param lon Longitude (deg).
+ * @param alt Height above the ellipsoid (m).
+ */
+inline Eigen::Vector3d lla_to_ecef(double lat, double lon, double alt)
+{
+  const double phi = lat * M_PI / 180.0;
+  const double lambda = lon * M_PI / 180.0;
+  const double sin_phi = sin(phi);
+  const double cos_phi = cos(phi);
+
+  // Radius of curvature in the prime vertical.
+  const double N = WGS84_A / sqrt(1.0 - WGS84_E2 * sin_phi * sin_phi);
+
+  return Eigen::Vector3d((N + alt) * cos_phi * cos(lambda), (N + alt) * cos_phi * sin(lambda),
+                         (N * (1.0 - WGS84_E2) + alt) * sin_phi);
+}
+
+/**
+ * @brief Converts ECEF coordinates to geodetic latitude (deg), longitude (deg) and height (m).
+ *
+ * Uses Bowring's parametric latitude formula followed by one refinement, which is accurate to well
+ * under a millimeter from the earth's surface out to orbital altitudes.
+ */
+inline Eigen::Vector3d ecef_to_lla(const Eigen::Vector3d & ecef)
+{
+  const double p = hypot(ecef(0), ecef(1));
+  const double lambda = atan2(ecef(1), ecef(0));
+
+  double beta = atan2(ecef(2) * WGS84_A, p * WGS84_B);
+  double phi = 0.0;
+  for (int _ = 0; _ < 2; _++) {
+    const double sin_beta = sin(beta);
+    const double cos_beta = cos(beta);
+    phi = atan2(ecef(2) + WGS84_EP2 * WGS84_B * sin_beta * sin_beta * sin_beta,
+                p - WGS84_E2 * WGS84_A * cos_beta * cos_beta * cos_beta);
+    beta = atan2((1.0 - WGS84_F) * sin(phi), cos(phi));
+  }
+
+  const double sin_phi = sin(phi);
+  const double N = WGS84_A / sqrt(1.0 - WGS84_E2 * sin_phi * sin_phi);
+  const double alt = p * cos(phi) + (ecef(2) + WGS84_E2 * N * sin_phi) * sin_phi - N;
+
+  return Eigen::Vector3d(phi * 180.0 / M_PI, lambda * 180.0 / M_PI, alt);
+}
+
+/**
+ * A local tangent plane at a geodetic origin. The origin's ECEF position and the rotation from
+ * ECEF to NED are computed once when the origin is set, so each conversion only needs the trig of
+ * the point being converted.
+ */
+class LocalTangentPlane
+{
+public:
+  LocalTangentPlane() { set_origin(0.0, 0.0, 0.0); }
+
+  LocalTangentPlane(double lat, double lon, double alt) { set_origin(lat, lon, alt); }
+
+  /**
+   * @brief Moves the origin and recomputes the rotation.
+   *
+   * @param lat Latitude of the origin (deg).
+   * @param lon Longitude of the origin (deg).
+   * @param alt Height of the origin above the ellipsoid (m).
+   */
+  void set_origin(double lat, double lon, double alt)
+  {
+    origin_lla_ = Eigen::Vector3d(lat, lon, alt);
+    origin_ecef_ = lla_to_ecef(lat, lon, alt);
+
+    const double phi = lat * M_PI / 180.0;
+    const double lambda = lon * M_PI / 180.0;
+    const double sin_phi = sin(phi);
+    const double cos_phi = cos(phi);
+    const double sin_lambda = sin(lambda);
+    const double cos_lambda = cos(lambda);
+
+    // Rows are the north, east and down unit vectors in ECEF.
+    R_ned_ecef_ << -sin_phi * cos_lambda, -sin_phi * sin_lambda, cos_phi,
+                   -sin_lambda, cos_lambda, 0.0,
+                   -cos_phi * cos_lambda, -cos_phi * sin_lambda, -sin_phi;
+  }
+
+  const Eigen::Vector3d & origin_lla() const { return origin_lla_; }
+  const Eigen::Vector3d & origin_ecef() const { return origin_ecef_; }
+  const Eigen::Matrix3d & rotation_ned_from_ecef() const { return R_ned_ecef_; }
+
+  Eigen::Vector3d ecef_to_ned(const Eigen::Vector3d & ecef) const
+  {
+    return R_ned_ecef_ * (ecef - origin_ecef_);
+  }
+
+  Eigen::Vector3d ned_to_ecef(const Eigen::Vector3d & ned) const
+  {
+    return origin_ecef_ + R_ned_ecef_.transpose() * ned;
+  }
+
+  Eigen::Vector3d ecef_to_enu(const Eigen::Vector3d & ecef) const
+  {
+    return ned_to_enu(ecef_to_ned(ecef));
+  }
+
+  Eigen::Vector3d enu_to_ecef(const Eigen::Vector3d & enu) const
+  {
+    return ned_to_ecef(ned_to_enu(enu));
+  }
+
+  /**
+   * @brief Converts geodetic coordinates to NED.
+   *
+   * @param lat Latitude (deg).
+   * @param lon Longitude (deg).
+   * @param alt Height above the ellipsoid (m).
+   */
+  Eigen::Vector3d lla_to_ned(double lat, double lon, double alt) const
+  {
+    return ecef_to_ned(lla_to_ecef(lat, lon, alt));
+  }
+
+  /**
+   * @brief Converts NED coordinates to latitude (deg), longitude (deg) and height (m).
+   */
+  Eigen::Vector3d ned_to_lla(const Eigen::Vector3d & ned) const
+  {
+    return ecef_to_lla(ned_to_ecef(ned));
+  }
+
+  Eigen::Vector3d lla_to_enu(double lat, double lon, double alt) const
+  {
+    return ned_to_enu(lla_to_ned(lat, lon, alt));
+  }
+
+  Eigen::Vector3d enu_to_lla(const Eigen::Vector3d & enu) const
+  {
+    return ned_to_lla(ned_to_enu(enu));
+  }
+
+  /**
+   * @brief Converts a batch of geodetic coordinates to NED, such as the waypoints of a mission.
+   *
+   * @param lla Latitude (deg), longitude (deg) and height (m) of each point.
+   * @return The NED coordinates of each point, in the same order.
+   */
+  std::vector<Eigen::Vector3d> lla_to_ned(const std::vector<Eigen::Vector3d> & lla) const
+  {
+    std::vector<Eigen::Vector3d> ned;
+    ned.reserve(lla.size());
+    for (const Eigen::Vector3d & point : lla) {
+      ned.push_back(lla_to_ned(point(0), point(1), point(2)));
+    }
+    return ned;
+  }
+
+  /**
+   * @brief Swaps NED and ENU. The conversion is its own inverse.
+   */
+  static Eigen::Vector3d ned_to_enu(const Eigen::Vector3d & v)
+  {
+    return Eigen::Vector3d(v(1), v(0), -v(2));
+  }
+
+private:
+  Eigen::Vector3d origin_lla_;
+  Eigen::Vector3d origin_ecef_;
+  Eigen::Matrix3d R_ned_ecef_;
+};
+
+} // namespace rosplane
+
+#endif // GEODESY_H
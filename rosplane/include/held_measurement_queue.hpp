@@ -0,0 +1,81 @@
+/**
+ * @file held_measurement_queue.hpp
+ *
+ * Fixed-capacity queue of sensor messages that arrived ahead of the IMU stream, so the estimator
+ * can apply them in order once the IMU catches up.
+ */
+
+#ifndef HELD_MEASUREMENT_QUEUE_H
+#define HELD_MEASUREMENT_QUEUE_H
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+namespace rosplane
+{
+
+/**
+ * First in, first out queue of message pointers with storage allocated with the queue. When it
+ * is full, holding another message drops the oldest one.
+ */
+template<typename MsgPtr, std::size_t Capacity>
+class HeldMeasurementQueue
+{
+  static_assert(Capacity >= 1, "HeldMeasurementQueue capacity must be at least one.");
+
+public:
+  HeldMeasurementQueue()
+      : head_(0)
+      , size_(0)
+  {}
+
+  /**
+   * Adds a message to the back of the queue.
+   *
+   * @param msg The message to hold.
+   * @return False if the queue was full and the oldest message was dropped to make room.
+   */
+  bool push(MsgPtr msg)
+  {
+    bool dropped = size_ == Capacity;
+    if (dropped) {
+      pop();
+    }
+    slots_[(head_ + size_) % Capacity] = std::move(msg);
+    size_++;
+    return !dropped;
+  }
+
+  /**
+   * Removes the oldest message. Must not be called on an empty queue.
+   *
+   * @return The oldest message.
+   */
+  MsgPtr pop()
+  {
+    MsgPtr msg = std::move(slots_[head_]);
+    slots_[head_] = MsgPtr();
+    head_ = (head_ + 1) % Capacity;
+    size_--;
+    return msg;
+  }
+
+  /**
+   * @return The oldest message. Must not be called on an empty queue.
+   */
+  const MsgPtr & front() const { return slots_[head_]; }
+
+  bool empty() const { return size_ == 0; }
+
+  std::size_t size() const { return size_; }
+
+private:
+  std::array<MsgPtr, Capacity> slots_;
+  std::size_t head_; /**< Slot of the oldest message */
+  std::size_t size_; /**< Messages held */
+};
+
+} // namespace rosplane
+
+#endif // HELD_MEASUREMENT_QUEUE_H
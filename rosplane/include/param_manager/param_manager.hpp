@@ -9,13 +9,46 @@
 #ifndef PARAM_MANAGER_H
 #define PARAM_MANAGER_H
 
+#include <memory>
 #include <variant>
 
 #include <rclcpp/rclcpp.hpp>
 
+#include "param_persistence.hpp"
+
 namespace rosplane
 {
 
+/**
+ * Typed handle to a parameter stored in a ParamManager object.
+ *
+ * The handle is resolved once by name and then reads the stored value directly, so it can be used
+ * in hot loops without a string lookup. It always reflects the latest value given to the
+ * ParamManager (e.g. through set_parameters_callback).
+ */
+template<typename T>
+class ParamHandle
+{
+public:
+  ParamHandle()
+      : value_{nullptr}
+  {}
+
+  /**
+   * @return The current value of the parameter
+  */
+  const T & get() const { return std::get<T>(*value_); }
+
+private:
+  friend class ParamManager;
+
+  explicit ParamHandle(const ParamValue * value)
+      : value_{value}
+  {}
+
+  const ParamValue * value_;
+};
+
 class ParamManager
 {
 public:
@@ -50,6 +83,38 @@ public:
   */
   std::string get_string(std::string param_name);
 
+  /**
+   * Helper function to access parameter values of type double array stored in param_manager object
+   * @return Double array value of the parameter
+  */
+  std::vector<double> get_double_array(std::string param_name);
+
+  /**
+   * Helper function to get a handle to a previously declared parameter of type double
+   * @return Handle that reads the current value of the parameter without a lookup
+  */
+  ParamHandle<double> get_double_handle(std::string param_name);
+
+  /**
+   * Helper function to get a handle to a previously declared parameter of type bool
+   * @return Handle that reads the current value of the parameter without a lookup
+  */
+  ParamHandle<bool> get_bool_handle(std::string param_name);
+
+  /**
+   * Helper function to get a handle to a previously declared parameter of type integer
+   * @return Handle that reads the current value of the parameter without a lookup
+  */
+  ParamHandle<int64_t> get_int_handle(std::string param_name);
+
+  /**
+   * Counter that is incremented every time the value of any parameter is changed. Classes that
+   * cache values derived from parameters compare it against the last revision they saw to know
+   * when to recompute them.
+   * @return The current parameter revision
+  */
+  uint64_t get_revision() const { return revision_; }
+
   /**
    * Helper function to declare parameters in the param_manager object
    * Inserts a parameter into the parameter object and declares it with the ROS system
@@ -75,8 +140,14 @@ public:
   void declare_string(std::string param_name, std::string value);
 
   /**
-   * This sets the parameters with the values in the params_ object from the supplied parameter file, or sets them to
-   * the default if no value is given for a parameter.
+   * Helper function to declare parameters in the param_manager object
+   * Inserts a parameter into the parameter object and declares it with the ROS system
+  */
+  void declare_double_array(std::string param_name, std::vector<double> value);
+
+  /**
+   * This sets the parameters with the values in the params_ object from the supplied parameter
+   * file, or sets them to the default if no value is given for a parameter.
    */
   void set_parameters();
 
@@ -113,12 +184,57 @@ public:
   */
   bool set_parameters_callback(const std::vector<rclcpp::Parameter> & parameters);
 
+  /**
+   * Sets the parameter file that persist() writes to. The writes happen on a background thread.
+   *
+   * @param file_path: Path to the parameter YAML file
+   * @param node_section: Top level key of this node's parameters in the file
+  */
+  void set_persistence_file(std::string file_path, std::string node_section);
+
+  /**
+   * Queues a value to be saved to the parameter file for the next run, without blocking. Does not
+   * change the current value of the parameter. Writes queued close together are batched into one
+   * rewrite of the file.
+   *
+   * @param param_name: Name of the parameter. It must already be in the parameter file.
+   * @param value: Value to save
+  */
+  void persist(std::string param_name, ParamValue value);
+
+  /**
+   * Queues the current value of a declared parameter to be saved to the parameter file.
+  */
+  void persist(std::string param_name);
+
+  /**
+   * Blocks until every value queued by persist() has been written to the parameter file.
+  */
+  void flush_persistence();
+
 private:
   /**
    * Data structure to hold all of the parameters
   */
-  std::map<std::string, std::variant<double, bool, int64_t, std::string>> params_;
+  std::map<std::string, ParamValue> params_;
   rclcpp::Node * container_node_;
+
+  /**
+   * Incremented on every parameter change. See get_revision.
+  */
+  uint64_t revision_;
+
+  /**
+   * Writer for persist(). Null until set_persistence_file is called.
+  */
+  std::unique_ptr<ParamPersistence> persistence_;
+
+  /**
+   * Finds a declared parameter that holds a value of type T.
+   * Entries in a std::map are never moved, so the returned pointer stays valid.
+  */
+  template<typename T>
+  const ParamValue * find_param(const std::string & param_name);
 };
 
 } // namespace rosplane
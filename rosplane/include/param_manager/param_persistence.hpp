@@ -0,0 +1,99 @@
+/**
+ * @file param_persistence.hpp
+ *
+ * Background writer that saves parameter values to a ROS2 parameter YAML file without blocking the
+ * caller.
+ */
+
+#ifndef PARAM_PERSISTENCE_H
+#define PARAM_PERSISTENCE_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <rclcpp/rclcpp.hpp>
+
+namespace rosplane
+{
+
+/**
+ * The value of a parameter, of any of the types the ParamManager supports.
+ */
+using ParamValue = std::variant<double, bool, int64_t, std::string, std::vector<double>>;
+
+/**
+ * Saves parameter values to a parameter file on a worker thread.
+ *
+ * save() only queues the value, so it can be called from a callback. Values queued while the worker
+ * is busy are coalesced: the worker writes all of them, and only the latest value of each
+ * parameter, in one rewrite of the file. The file is replaced atomically by writing a temporary
+ * file next to it, syncing it, renaming it over the original and syncing the directory, so a crash
+ * or power loss mid-write leaves either the old or the new file, never a truncated one.
+ */
+class ParamPersistence
+{
+public:
+  /**
+   * @param file_path The parameter file. If it is a symlink, as in a symlink install, the file it
+   * points to is the one replaced.
+   * @param node_section The top level key of the node's parameters in the file, which holds the
+   * ros__parameters map.
+   * @param logger The logger to report write failures with.
+   */
+  ParamPersistence(std::string file_path, std::string node_section, rclcpp::Logger logger);
+
+  /**
+   * Writes any queued values and stops the worker.
+   */
+  ~ParamPersistence();
+
+  ParamPersistence(const ParamPersistence &) = delete;
+  ParamPersistence & operator=(const ParamPersistence &) = delete;
+
+  /**
+   * Queues a parameter value to be written. Returns immediately. Only parameters that are already
+   * in the file are written; others are reported and skipped.
+   */
+  void save(const std::string & param_name, const ParamValue & value);
+
+  /**
+   * Blocks until every value queued before the call has been written.
+   */
+  void flush();
+
+private:
+  void run();
+
+  /**
+   * Rewrites the file with the given values. Runs on the worker thread.
+   */
+  void write(const std::map<std::string, ParamValue> & values);
+
+  const std::string file_path_;
+  const std::string node_section_;
+  rclcpp::Logger logger_;
+
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable work_done_;
+
+  /**
+   * Values waiting for the worker, by parameter name. A newer value of the same parameter replaces
+   * the queued one.
+   */
+  std::map<std::string, ParamValue> pending_;
+  uint64_t queued_count_;  /**< Calls to save() so far */
+  uint64_t written_count_; /**< Calls to save() whose values have been written */
+  bool stopping_;
+
+  std::thread worker_; /**< Declared last, so it starts after the state above is initialized */
+};
+
+} // namespace rosplane
+
+#endif // PARAM_PERSISTENCE_H
@@ -23,7 +23,7 @@ enum class PathType
 class PathFollowerBase : public rclcpp::Node
 {
 public:
-  PathFollowerBase();
+  explicit PathFollowerBase(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
   float spin();
 
 protected:
@@ -91,12 +91,12 @@ private:
   /**
    * @brief Callback for the subscribed state messages from the estimator
    */
-  void vehicle_state_callback(const rosplane_msgs::msg::State::SharedPtr msg);
+  void vehicle_state_callback(const rosplane_msgs::msg::State::ConstSharedPtr msg);
 
   /**
    * @brief Callback for the subscribed current_path messages from the path_manager
    */
-  void current_path_callback(const rosplane_msgs::msg::CurrentPath::SharedPtr msg);
+  void current_path_callback(const rosplane_msgs::msg::CurrentPath::ConstSharedPtr msg);
 
   /**
    * @brief Calculates and publishes the commands messages
@@ -9,10 +9,18 @@ namespace rosplane
 class PathFollowerExample : public PathFollowerBase
 {
 public:
-  PathFollowerExample();
+  explicit PathFollowerExample(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
 
 private:
   virtual void follow(const Input & input, Output & output);
+
+  /**
+   * Handles to the parameters used in follow, resolved once in the constructor.
+   */
+  ParamHandle<double> k_path_;
+  ParamHandle<double> k_orbit_;
+  ParamHandle<double> chi_infty_;
+  ParamHandle<double> gravity_;
 };
 
 } // namespace rosplane
@@ -26,7 +26,7 @@ namespace rosplane
 class PathManagerBase : public rclcpp::Node
 {
 public:
-  PathManagerBase();
+  explicit PathManagerBase(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
 
 protected:
   struct Waypoint
@@ -81,7 +81,7 @@ private:
   rclcpp::Publisher<rosplane_msgs::msg::CurrentPath>::SharedPtr
     current_path_pub_; /**< controller commands publication */
 
-  rosplane_msgs::msg::State vehicle_state_; /**< vehicle state */
+  rosplane_msgs::msg::State::ConstSharedPtr vehicle_state_; /**< vehicle state */
 
   bool params_initialized_;
   bool state_init_;
@@ -89,7 +89,7 @@ private:
   rclcpp::TimerBase::SharedPtr update_timer_;
   OnSetParametersCallbackHandle::SharedPtr parameter_callback_handle_;
 
-  void vehicle_state_callback(const rosplane_msgs::msg::State &
+  void vehicle_state_callback(const rosplane_msgs::msg::State::ConstSharedPtr
                                 msg); /** subscribes to the estimated state from the estimator */
   void new_waypoint_callback(const rosplane_msgs::msg::Waypoint &
                                msg); /** subscribes to waypoint messages from the path_planner */
@@ -31,7 +31,7 @@ enum class DubinState
 class PathManagerExample : public PathManagerBase
 {
 public:
-  PathManagerExample();
+  explicit PathManagerExample(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
 
 private:
   std::chrono::time_point<std::chrono::system_clock> start_time_;
@@ -147,6 +147,14 @@ private:
    * It also sets the default parameter, which will then be overridden by a parameter file
    */
   void declare_parameters();
+
+  /**
+   * Handles to the parameters used while managing the path, resolved once in the constructor.
+   */
+  ParamHandle<double> R_min_;
+  ParamHandle<double> default_altitude_;
+  ParamHandle<double> default_airspeed_;
+  ParamHandle<bool> orbit_last_;
 };
 } // namespace rosplane
 #endif // PATH_MANAGER_EXAMPLE_H
@@ -3,20 +3,19 @@
 #include <rosflight_msgs/srv/param_file.hpp>
 #include <std_srvs/srv/trigger.hpp>
 
+#include "geodesy.hpp"
 #include "param_manager.hpp"
 #include "rosplane_msgs/msg/state.hpp"
 #include "rosplane_msgs/msg/waypoint.hpp"
 #include "rosplane_msgs/srv/add_waypoint.hpp"
 
-#define EARTH_RADIUS 6378145.0f
-
 namespace rosplane
 {
 
 class PathPlanner : public rclcpp::Node
 {
 public:
-  PathPlanner();
+  explicit PathPlanner(const rclcpp::NodeOptions & options = rclcpp::NodeOptions());
   ~PathPlanner();
 
   ParamManager params_; /** Holds the parameters for the path_planner*/
@@ -147,6 +146,19 @@ private:
    */
   std::array<double, 3> lla2ned(std::array<float, 3> lla);
 
+  /**
+   * @brief Converts a batch of LLA coordinates, such as the waypoints of a mission file, to NED
+   *
+   * @param lla: Vector of [latitude, longitude, altitude] arrays
+   * @return Vector of the NED coordinates of each point, in the same order
+   */
+  std::vector<std::array<double, 3>> lla2ned(const std::vector<std::array<float, 3>> & lla);
+
+  /**
+   * @brief Warns if the origin looks like it came from a GPS error rather than a fix
+   */
+  void check_origin();
+
   /**
    * @brief This declares each parameter as a parameter so that the ROS2 parameter system can recognize each parameter. It also sets the default parameter, which will then be overridden by a launch script.
    */
@@ -165,6 +177,7 @@ private:
   double initial_lat_;
   double initial_lon_;
   double initial_alt_;
+  LocalTangentPlane origin_; /**< Tangent plane at the estimator's initial position */
 
   /**
    * Vector of waypoints
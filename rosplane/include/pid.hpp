@@ -0,0 +1,193 @@
+/**
+ * @file pid.hpp
+ *
+ * PID block shared by the control loops. How the derivative is taken and how the integrator is
+ * kept from winding up are template parameters, so each loop only pays for the branches it uses.
+ * Nothing is allocated and the gains are passed in on every update, so they can come from a
+ * compiled or scheduled gain set.
+ */
+
+#ifndef PID_H
+#define PID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace rosplane
+{
+
+/**
+ * Source of the derivative term of a PID.
+ */
+enum class PidDerivative
+{
+  ERROR, /**< Dirty derivative of the error, low pass filtered with time constant tau */
+  RATE   /**< Measured rate of the controlled value, e.g. from the gyros */
+};
+
+/**
+ * Method used to keep the integrator from winding up while the output is saturated.
+ */
+enum class PidAntiWindup
+{
+  CLAMP,           /**< Keep the integrator at its last value while the output saturates */
+  BACK_CALCULATION /**< Bleed the integrator by kb times the amount of saturation */
+};
+
+/**
+ * Gains and limits of a PID, with the constants derived from the time step.
+ */
+struct PidGains
+{
+  float kp;
+  float ki;
+  float kd;
+  float min;        /**< Lower limit of the output */
+  float max;        /**< Upper limit of the output */
+  float Ts;         /**< Time step (s) */
+  float tau;        /**< Time constant of the dirty derivative filter (s) */
+  float diff_decay; /**< Dirty derivative weight of the last value, (2 tau - Ts)/(2 tau + Ts) */
+  float diff_gain;  /**< Dirty derivative weight of the error change, 2/(2 tau + Ts) */
+  float kb;         /**< Back-calculation tracking gain (1/s), often about ki/kp */
+
+  /**
+   * @param tau Time constant of the dirty derivative filter (s). Unused with a measured rate.
+   * @param kb Back-calculation tracking gain (1/s). Unused when clamping.
+   */
+  static constexpr PidGains make(float kp, float ki, float kd, float min, float max, float Ts,
+                                 float tau = 0.0f, float kb = 0.0f)
+  {
+    PidGains gains{kp, ki, kd, min, max, 0.0f, tau, 0.0f, 0.0f, kb};
+    gains.set_period(Ts);
+    return gains;
+  }
+
+  /**
+   * Changes the time step and the constants derived from it.
+   */
+  constexpr void set_period(float period)
+  {
+    Ts = period;
+    diff_decay = (2.0f * tau - Ts) / (2.0f * tau + Ts);
+    diff_gain = 2.0f / (2.0f * tau + Ts);
+  }
+};
+
+/**
+ * Bits of Pid::nan_terms().
+ */
+constexpr uint8_t PID_P_TERM = 1;
+constexpr uint8_t PID_I_TERM = 2;
+constexpr uint8_t PID_D_TERM = 4;
+
+/**
+ * PID control of one value.
+ *
+ * The integral is trapezoidal and kept in output units, ki times the integral of the error, so a
+ * change of ki changes only how fast it grows and does not bump the output. Terms that come out
+ * NaN are replaced with zero (a NaN integral resets the integrator) and reported by nan_terms().
+ *
+ * @tparam derivative Source of the derivative term.
+ * @tparam anti_windup Method used to stop integrator windup.
+ */
+template<PidDerivative derivative, PidAntiWindup anti_windup = PidAntiWindup::CLAMP>
+class Pid
+{
+public:
+  Pid() { reset(); }
+
+  /**
+   * Clears the integrator, the derivative and the last error.
+   */
+  void reset()
+  {
+    integrator_ = 0.0f;
+    differentiator_ = 0.0f;
+    last_error_ = 0.0f;
+    nan_terms_ = 0;
+  }
+
+  void reset_integrator() { integrator_ = 0.0f; }
+
+  /**
+   * Runs the PID for one time step.
+   *
+   * @param error The commanded value minus the current value.
+   * @param gains The gains, limits and derived constants.
+   * @param rate The measured rate of the current value. Only used with PidDerivative::RATE.
+   * @param offset Trim or feed forward added to the output before saturation.
+   * @param integrate False to hold the integrator at its current value for this step.
+   * @return The saturated output.
+   */
+  float update(float error, const PidGains & gains, float rate = 0.0f, float offset = 0.0f,
+               bool integrate = true)
+  {
+    nan_terms_ = 0;
+
+    float integrator_prev = integrator_;
+    if (integrate) {
+      integrator_ += gains.ki * (gains.Ts / 2.0f) * (error + last_error_);
+    }
+
+    float ud;
+    if constexpr (derivative == PidDerivative::ERROR) {
+      differentiator_ =
+        gains.diff_decay * differentiator_ + gains.diff_gain * (error - last_error_);
+      ud = gains.kd * differentiator_;
+    } else {
+      // The error rate is the command rate minus the measured rate; the command rate is ignored.
+      ud = -gains.kd * rate;
+    }
+
+    float up = gains.kp * error;
+    if (std::isnan(up)) {
+      up = 0.0f;
+      nan_terms_ |= PID_P_TERM;
+    }
+    if (std::isnan(integrator_)) {
+      integrator_ = 0.0f;
+      integrator_prev = 0.0f;
+      nan_terms_ |= PID_I_TERM;
+    }
+    if (std::isnan(ud)) {
+      ud = 0.0f;
+      nan_terms_ |= PID_D_TERM;
+    }
+
+    float unsaturated = offset + up + integrator_ + ud;
+    float output = std::min(std::max(unsaturated, gains.min), gains.max);
+
+    if constexpr (anti_windup == PidAntiWindup::CLAMP) {
+      if (fabs(output - unsaturated) > 0.0001f) {
+        integrator_ = integrator_prev;
+      }
+    } else {
+      integrator_ += gains.kb * gains.Ts * (output - unsaturated);
+    }
+
+    last_error_ = error;
+    return output;
+  }
+
+  /**
+   * @return The terms of the last update that were NaN, as a combination of PID_P_TERM,
+   * PID_I_TERM and PID_D_TERM.
+   */
+  uint8_t nan_terms() const { return nan_terms_; }
+
+  /**
+   * @return The integral term, in output units.
+   */
+  float integrator() const { return integrator_; }
+
+private:
+  float integrator_;     /**< ki times the integral of the error */
+  float differentiator_; /**< Filtered derivative of the error */
+  float last_error_;
+  uint8_t nan_terms_;
+};
+
+} // namespace rosplane
+
+#endif // PID_H
@@ -0,0 +1,168 @@
+/**
+ * @file sensor_fed_estimator.hpp
+ *
+ * An estimator node fed directly through its sensor callbacks rather than its subscriptions, for
+ * the offline replay, the tests and the benchmarks. It is still a ROS node, so it needs an rclcpp
+ * context, but it is never spun.
+ */
+
+#ifndef SENSOR_FED_ESTIMATOR_H
+#define SENSOR_FED_ESTIMATOR_H
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <rclcpp/rclcpp.hpp>
+
+#include "estimator_ros.hpp"
+
+namespace rosplane
+{
+
+/**
+ * An estimator stepped on the stamps of the IMU samples fed to it, in event-driven mode. The
+ * diagnostics and innovations are dropped and calibrations are not written to the parameter file.
+ * The estimated state still goes to publish_state, which users override to keep it.
+ *
+ * The feed functions reuse one message per sensor, so feeding does not allocate, unless the
+ * previous message is still held for the IMU stream.
+ */
+template<typename Estimator>
+class SensorFedEstimator : public Estimator
+{
+public:
+  explicit SensorFedEstimator(const rclcpp::NodeOptions & options = rclcpp::NodeOptions())
+      : Estimator(event_driven(options))
+      , imu_(std::make_shared<sensor_msgs::msg::Imu>())
+      , baro_(std::make_shared<rosflight_msgs::msg::Barometer>())
+      , airspeed_(std::make_shared<rosflight_msgs::msg::Airspeed>())
+      , gnss_fix_(std::make_shared<sensor_msgs::msg::NavSatFix>())
+      , gnss_vel_(std::make_shared<geometry_msgs::msg::TwistStamped>())
+      , status_(std::make_shared<rosflight_msgs::msg::Status>())
+  {}
+
+  /**
+   * @param seconds A time in seconds.
+   * @return The time as a message stamp, rounded to the nearest nanosecond.
+   */
+  static builtin_interfaces::msg::Time to_stamp(double seconds)
+  {
+    builtin_interfaces::msg::Time stamp;
+    double whole_seconds = std::floor(seconds);
+    stamp.sec = static_cast<int32_t>(whole_seconds);
+    stamp.nanosec = static_cast<uint32_t>(std::llround((seconds - whole_seconds) * 1e9));
+    if (stamp.nanosec >= 1000000000u) {
+      stamp.sec += 1;
+      stamp.nanosec -= 1000000000u;
+    }
+    return stamp;
+  }
+
+  /**
+   * @brief Feeds an IMU sample, which steps the estimator to its stamp.
+   */
+  void feed_imu(const builtin_interfaces::msg::Time & stamp, double gyro_x, double gyro_y,
+                double gyro_z, double accel_x, double accel_y, double accel_z)
+  {
+    sensor_msgs::msg::Imu & msg = writable(imu_);
+    msg.header.stamp = stamp;
+    msg.angular_velocity.x = gyro_x;
+    msg.angular_velocity.y = gyro_y;
+    msg.angular_velocity.z = gyro_z;
+    msg.linear_acceleration.x = accel_x;
+    msg.linear_acceleration.y = accel_y;
+    msg.linear_acceleration.z = accel_z;
+    this->imuCallback(imu_);
+  }
+
+  void feed_baro(const builtin_interfaces::msg::Time & stamp, double pressure)
+  {
+    rosflight_msgs::msg::Barometer & msg = writable(baro_);
+    msg.header.stamp = stamp;
+    msg.pressure = pressure;
+    this->baroAltCallback(baro_);
+  }
+
+  void feed_airspeed(const builtin_interfaces::msg::Time & stamp, double differential_pressure)
+  {
+    rosflight_msgs::msg::Airspeed & msg = writable(airspeed_);
+    msg.header.stamp = stamp;
+    msg.differential_pressure = differential_pressure;
+    this->airspeedCallback(airspeed_);
+  }
+
+  void feed_gnss_fix(const builtin_interfaces::msg::Time & stamp, int8_t status, double latitude,
+                     double longitude, double altitude)
+  {
+    sensor_msgs::msg::NavSatFix & msg = writable(gnss_fix_);
+    msg.header.stamp = stamp;
+    msg.status.status = status;
+    msg.latitude = latitude;
+    msg.longitude = longitude;
+    msg.altitude = altitude;
+    this->gnssFixCallback(gnss_fix_);
+  }
+
+  void feed_gnss_vel(const builtin_interfaces::msg::Time & stamp, double v_n, double v_e,
+                     double v_d)
+  {
+    geometry_msgs::msg::TwistStamped & msg = writable(gnss_vel_);
+    msg.header.stamp = stamp;
+    msg.twist.linear.x = v_n;
+    msg.twist.linear.y = v_e;
+    msg.twist.linear.z = v_d;
+    this->gnssVelCallback(gnss_vel_);
+  }
+
+  void feed_status(const builtin_interfaces::msg::Time & stamp, bool armed)
+  {
+    rosflight_msgs::msg::Status & msg = writable(status_);
+    msg.header.stamp = stamp;
+    msg.armed = armed;
+    this->statusCallback(status_);
+  }
+
+protected:
+  void publish_diagnostics(const rosplane_msgs::msg::EstimatorDiagnostics &) override {}
+
+  void publish_innovations(const rosplane_msgs::msg::EstimatorInnovations &) override {}
+
+  /**
+   * Calibration values found while fed from a log or a synthetic stream must not overwrite the
+   * parameter file.
+   */
+  void saveParameter(std::string, double) override {}
+
+private:
+  static rclcpp::NodeOptions event_driven(const rclcpp::NodeOptions & options)
+  {
+    std::vector<rclcpp::Parameter> overrides = options.parameter_overrides();
+    overrides.emplace_back("event_driven_estimation", true);
+    return rclcpp::NodeOptions(options).parameter_overrides(overrides);
+  }
+
+  /**
+   * @return The message to fill, replaced by a new one if the estimator still holds the old one.
+   */
+  template<typename Msg>
+  static Msg & writable(std::shared_ptr<Msg> & msg)
+  {
+    if (msg.use_count() > 1) {
+      msg = std::make_shared<Msg>();
+    }
+    return *msg;
+  }
+
+  std::shared_ptr<sensor_msgs::msg::Imu> imu_;
+  std::shared_ptr<rosflight_msgs::msg::Barometer> baro_;
+  std::shared_ptr<rosflight_msgs::msg::Airspeed> airspeed_;
+  std::shared_ptr<sensor_msgs::msg::NavSatFix> gnss_fix_;
+  std::shared_ptr<geometry_msgs::msg::TwistStamped> gnss_vel_;
+  std::shared_ptr<rosflight_msgs::msg::Status> status_;
+};
+
+} // namespace rosplane
+
+#endif // SENSOR_FED_ESTIMATOR_H
@@ -0,0 +1,92 @@
+/**
+ * @file spsc_ring_buffer.hpp
+ *
+ * Lock-free single-producer/single-consumer ring buffer. One thread may push while another pops
+ * without any locking, which lets a sensor callback run on its own executor thread and hand its
+ * samples to the thread that consumes them.
+ */
+
+#ifndef SPSC_RING_BUFFER_H
+#define SPSC_RING_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace rosplane
+{
+
+/**
+ * Fixed-capacity ring buffer with one producer thread and one consumer thread.
+ *
+ * The storage is allocated with the buffer, so pushing and popping never allocate. Capacity must
+ * be a power of two; one slot is always left empty to tell a full buffer from an empty one.
+ */
+template<typename T, std::size_t Capacity>
+class SpscRingBuffer
+{
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "SpscRingBuffer capacity must be a power of two.");
+
+public:
+  SpscRingBuffer()
+      : head_(0)
+      , tail_(0)
+  {}
+
+  /**
+   * Adds an element to the buffer. Must only be called from the producer thread.
+   *
+   * @param value The element to add.
+   * @return False if the buffer was full and the element was not added.
+   */
+  bool push(const T & value)
+  {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    const std::size_t next = (head + 1) & (Capacity - 1);
+    if (next == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    buffer_[head] = value;
+    head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Removes the oldest element from the buffer. Must only be called from the consumer thread.
+   *
+   * @param value Set to the removed element.
+   * @return False if the buffer was empty.
+   */
+  bool pop(T & value)
+  {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    value = buffer_[tail];
+    tail_.store((tail + 1) & (Capacity - 1), std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @return True if there is nothing to pop. Only exact when called from the consumer thread.
+   */
+  bool empty() const
+  {
+    return tail_.load(std::memory_order_relaxed) == head_.load(std::memory_order_acquire);
+  }
+
+private:
+  std::array<T, Capacity> buffer_;
+
+  // Keep the indices on separate cache lines so the two threads do not contend on them.
+  alignas(64) std::atomic<std::size_t> head_; /**< Next slot to write, owned by the producer */
+  alignas(64) std::atomic<std::size_t> tail_; /**< Next slot to read, owned by the consumer */
+};
+
+} // namespace rosplane
+
+#endif // SPSC_RING_BUFFER_H
@@ -0,0 +1,180 @@
+/**
+ * @file streaming_statistics.hpp
+ *
+ * Statistics of a stream of samples computed one sample at a time in constant memory, for
+ * calibrations that would otherwise have to store and sort every sample.
+ */
+
+#ifndef STREAMING_STATISTICS_H
+#define STREAMING_STATISTICS_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace rosplane
+{
+
+/**
+ * Running mean and variance using Welford's algorithm, which stays accurate when the mean is large
+ * compared to the spread, as with static pressure.
+ */
+class RunningStatistics
+{
+public:
+  RunningStatistics() { reset(); }
+
+  void reset()
+  {
+    count_ = 0;
+    mean_ = 0.0;
+    m2_ = 0.0;
+  }
+
+  void add(double x)
+  {
+    count_++;
+    double delta = x - mean_;
+    mean_ += delta / count_;
+    m2_ += delta * (x - mean_);
+  }
+
+  uint32_t count() const { return count_; }
+  double mean() const { return mean_; }
+
+  /**
+   * @return The sample variance, or 0 with fewer than two samples.
+   */
+  double variance() const { return count_ > 1 ? m2_ / (count_ - 1) : 0.0; }
+  double std_dev() const { return sqrt(variance()); }
+
+private:
+  uint32_t count_;
+  double mean_;
+  double m2_; /**< Sum of squared differences from the mean */
+};
+
+/**
+ * Approximate quantile of a stream using the P-squared algorithm (Jain and Chlamtac, 1985).
+ *
+ * Keeps five markers: the minimum, the maximum, the quantile and the quantiles halfway between
+ * them. Each sample moves the markers' positions, and markers that drift from their desired
+ * positions are adjusted with a piecewise-parabolic fit. Until five samples have been seen the
+ * quantile is computed exactly from the samples.
+ */
+class P2QuantileEstimator
+{
+public:
+  /**
+   * @param p The quantile to estimate, between 0 and 1.
+   */
+  explicit P2QuantileEstimator(double p)
+      : p_(p)
+  {
+    reset();
+  }
+
+  void reset() { count_ = 0; }
+
+  void add(double x)
+  {
+    if (count_ < 5) {
+      heights_[count_++] = x;
+      if (count_ == 5) {
+        std::sort(heights_.begin(), heights_.end());
+        positions_ = {0.0, 1.0, 2.0, 3.0, 4.0};
+        desired_ = {0.0, 2.0 * p_, 4.0 * p_, 2.0 + 2.0 * p_, 4.0};
+        increments_ = {0.0, p_ / 2.0, p_, (1.0 + p_) / 2.0, 1.0};
+      }
+      return;
+    }
+    count_++;
+
+    // Find the cell the sample falls in, extending the extremes if needed.
+    int k;
+    if (x < heights_[0]) {
+      heights_[0] = x;
+      k = 0;
+    } else if (x >= heights_[4]) {
+      heights_[4] = x;
+      k = 3;
+    } else {
+      k = 0;
+      while (x >= heights_[k + 1]) {
+        k++;
+      }
+    }
+
+    for (int i = k + 1; i < 5; i++) {
+      positions_[i] += 1.0;
+    }
+    for (int i = 0; i < 5; i++) {
+      desired_[i] += increments_[i];
+    }
+
+    // Move the middle markers that are at least one position from where they should be.
+    for (int i = 1; i < 4; i++) {
+      double d = desired_[i] - positions_[i];
+      if ((d >= 1.0 && positions_[i + 1] - positions_[i] > 1.0)
+          || (d <= -1.0 && positions_[i - 1] - positions_[i] < -1.0)) {
+        int step = d >= 0.0 ? 1 : -1;
+        double height = parabolic(i, step);
+        if (heights_[i - 1] < height && height < heights_[i + 1]) {
+          heights_[i] = height;
+        } else {
+          heights_[i] = linear(i, step);
+        }
+        positions_[i] += step;
+      }
+    }
+  }
+
+  uint32_t count() const { return count_; }
+
+  /**
+   * @return The estimated quantile, or 0 if no samples have been added.
+   */
+  double quantile() const
+  {
+    if (count_ >= 5) {
+      return heights_[2];
+    }
+    if (count_ == 0) {
+      return 0.0;
+    }
+
+    std::array<double, 5> sorted = heights_;
+    std::sort(sorted.begin(), sorted.begin() + count_);
+    return sorted[static_cast<int>(std::round(p_ * (count_ - 1)))];
+  }
+
+private:
+  double parabolic(int i, int step) const
+  {
+    const double d = step;
+    return heights_[i]
+      + d / (positions_[i + 1] - positions_[i - 1])
+      * ((positions_[i] - positions_[i - 1] + d) * (heights_[i + 1] - heights_[i])
+           / (positions_[i + 1] - positions_[i])
+         + (positions_[i + 1] - positions_[i] - d) * (heights_[i] - heights_[i - 1])
+           / (positions_[i] - positions_[i - 1]));
+  }
+
+  double linear(int i, int step) const
+  {
+    return heights_[i]
+      + step * (heights_[i + step] - heights_[i]) / (positions_[i + step] - positions_[i]);
+  }
+
+  double p_;
+  uint32_t count_;
+  std::array<double, 5> heights_;    /**< Marker heights, the estimated quantiles */
+  std::array<double, 5> positions_;  /**< Marker positions, the ranks of the heights */
+  std::array<double, 5> desired_;    /**< Desired marker positions */
+  std::array<double, 5> increments_; /**< Change of the desired positions per sample */
+};
+
+} // namespace rosplane
+
+#endif // STREAMING_STATISTICS_H
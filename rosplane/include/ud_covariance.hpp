@@ -0,0 +1,243 @@
+/**
+ * @file ud_covariance.hpp
+ *
+ * UD-factorized covariance operations for the EKF estimators. The covariance is kept as
+ * P = U D U' with U unit upper triangular and D diagonal, and is propagated with Thornton's
+ * modified weighted Gram-Schmidt time update and Bierman's scalar measurement update. P built from
+ * the factors is symmetric and positive definite by construction as long as D stays positive,
+ * which these updates preserve in float32 where the conventional Kalman form update loses it, e.g.
+ * when a precise measurement corrects a large prior (test/test_position_covariance.cpp).
+ */
+
+#ifndef UD_COVARIANCE_H
+#define UD_COVARIANCE_H
+
+#include <Eigen/Dense>
+
+#include "ekf_core.hpp"
+
+namespace rosplane
+{
+
+/**
+ * UD covariance operations for a filter with N states driven by an input vector of size U.
+ */
+template<int N, int U>
+class UDCovariance
+{
+public:
+  using StateVector = typename EKFCore<N, U>::StateVector;
+  using StateMatrix = typename EKFCore<N, U>::StateMatrix;
+  using InputVector = typename EKFCore<N, U>::InputVector;
+
+  /**
+   * Factors a symmetric positive definite covariance as P = U D U'.
+   *
+   * @param P The covariance. Only the upper triangle is read.
+   * @param U Set to the unit upper triangular factor.
+   * @param D Set to the diagonal factor.
+   */
+  static void factor(const StateMatrix & P, StateMatrix & U_factor, StateVector & D)
+  {
+    U_factor.setIdentity();
+    for (int j = N - 1; j >= 0; j--) {
+      float d = P(j, j);
+      for (int k = j + 1; k < N; k++) {
+        d -= D(k) * U_factor(j, k) * U_factor(j, k);
+      }
+      D(j) = d;
+
+      for (int i = j - 1; i >= 0; i--) {
+        float u = P(i, j);
+        for (int k = j + 1; k < N; k++) {
+          u -= D(k) * U_factor(i, k) * U_factor(j, k);
+        }
+        U_factor(i, j) = u / d;
+      }
+    }
+  }
+
+  /**
+   * @return The covariance U D U' rebuilt from its factors.
+   */
+  static StateMatrix reconstruct(const StateMatrix & U_factor, const StateVector & D)
+  {
+    StateMatrix P;
+    P.noalias() = U_factor * D.asDiagonal() * U_factor.transpose();
+    return P;
+  }
+
+  /**
+   * Propagates the state and the factored covariance forward by Ts, the same way as
+   * EKFCore::propagate, but with a diagonal process noise.
+   *
+   * @param x The state estimate, updated in place.
+   * @param U_factor The unit upper triangular covariance factor, updated in place.
+   * @param D The diagonal covariance factor, updated in place.
+   * @param inputs The inputs to the dynamic model.
+   * @param dynamic_model Callable (x, inputs) -> StateVector with the time derivative of the state.
+   * @param jacobian Callable (x, inputs) -> StateMatrix with the jacobian of the dynamic model.
+   * @param Q_diagonal The diagonal of the process noise covariance.
+   * @param Ts The time to propagate over, in seconds.
+   * @param num_steps The number of integration steps to split Ts into.
+   */
+  template<typename DynamicModel, typename Jacobian>
+  static void propagate(StateVector & x, StateMatrix & U_factor, StateVector & D,
+                        const InputVector & inputs, DynamicModel && dynamic_model,
+                        Jacobian && jacobian, const StateVector & Q_diagonal, float Ts,
+                        int num_steps)
+  {
+    const float dt = Ts / num_steps;
+    const StateVector Q_d = Q_diagonal * (dt * dt);
+
+    for (int _ = 0; _ < num_steps; _++) {
+      // Propagate model by a step.
+      x += dynamic_model(x, inputs) * dt;
+
+      const StateMatrix A = jacobian(x, inputs);
+
+      // Find the second order approx of the matrix exponential.
+      StateMatrix A_d = StateMatrix::Identity() + dt * A;
+      A_d.noalias() += (dt * dt / 2.0f) * A * A;
+
+      time_update(U_factor, D, A_d, Q_d);
+    }
+  }
+
+  /**
+   * Thornton's time update, the factors of A_d U D U' A_d' + diag(Q_d), by modified weighted
+   * Gram-Schmidt orthogonalization of the rows of [A_d U, I] weighted by diag(D, Q_d).
+   */
+  static void time_update(StateMatrix & U_factor, StateVector & D, const StateMatrix & A_d,
+                          const StateVector & Q_d)
+  {
+    Eigen::Matrix<float, N, 2 * N> W;
+    W.template leftCols<N>().noalias() = A_d * U_factor;
+    W.template rightCols<N>().setIdentity();
+
+    Eigen::Matrix<float, 2 * N, 1> D_w;
+    D_w << D, Q_d;
+
+    U_factor.setIdentity();
+    for (int j = N - 1; j >= 0; j--) {
+      const Eigen::Matrix<float, 2 * N, 1> weighted_row = W.row(j).transpose().cwiseProduct(D_w);
+      D(j) = W.row(j).dot(weighted_row);
+
+      const Eigen::Matrix<float, 2 * N, 1> scaled_row = weighted_row / D(j);
+      for (int i = 0; i < j; i++) {
+        U_factor(i, j) = W.row(i).dot(scaled_row);
+        W.row(i) -= U_factor(i, j) * W.row(j);
+      }
+    }
+  }
+
+  /**
+   * Bierman's scalar measurement update of the state and the factored covariance.
+   *
+   * @param x The state estimate, updated in place.
+   * @param U_factor The unit upper triangular covariance factor, updated in place.
+   * @param D The diagonal covariance factor, updated in place.
+   * @param measurement The measured value.
+   * @param measurement_prediction The value the measurement model predicts.
+   * @param measurement_variance The variance of the measurement.
+   * @param measurement_jacobian The (transposed) row of the measurement jacobian.
+   * @param gate_threshold The largest accepted normalized innovation squared. Zero disables it.
+   * @return The innovation and whether the measurement was accepted.
+   */
+  static MeasurementInnovation<1>
+  single_measurement_update(StateVector & x, StateMatrix & U_factor, StateVector & D,
+                            float measurement, float measurement_prediction,
+                            float measurement_variance, const StateVector & measurement_jacobian,
+                            float gate_threshold = 0.0f)
+  {
+    MeasurementInnovation<1> innovation;
+
+    const StateVector f = U_factor.transpose() * measurement_jacobian;
+    const StateVector v = D.cwiseProduct(f);
+    const float S = measurement_variance + f.dot(v);
+
+    innovation.residual(0) = measurement - measurement_prediction;
+    innovation.nis = innovation.residual(0) * innovation.residual(0) / S;
+    innovation.accepted = passes_gate(innovation.nis, gate_threshold);
+    if (!innovation.accepted) {
+      return innovation;
+    }
+
+    // Build the unnormalized gain b while updating U and D one column at a time.
+    StateVector b = StateVector::Zero();
+    float alpha = measurement_variance;
+    for (int j = 0; j < N; j++) {
+      const float alpha_prev = alpha;
+      alpha += f(j) * v(j);
+      D(j) *= alpha_prev / alpha;
+
+      const float lambda = -f(j) / alpha_prev;
+      for (int i = 0; i < j; i++) {
+        const float u = U_factor(i, j);
+        U_factor(i, j) = u + lambda * b(i);
+        b(i) += u * v(j);
+      }
+      b(j) = v(j);
+    }
+
+    x += b * (innovation.residual(0) / alpha);
+
+    return innovation;
+  }
+
+  /**
+   * Fuses a measurement vector of size M with a diagonal covariance as M Bierman updates. Like
+   * EKFCore::sequential_measurement_update, the model is linearized once about the prior and the
+   * gate is applied to the total normalized innovation squared.
+   *
+   * @param x The state estimate, updated in place.
+   * @param U_factor The unit upper triangular covariance factor, updated in place.
+   * @param D The diagonal covariance factor, updated in place.
+   * @param inputs Any additional values the measurement model needs.
+   * @param measurement_model Callable (x, inputs) -> M vector with the predicted measurement.
+   * @param measurement_jacobian Callable (x, inputs) -> M x N jacobian of the measurement model.
+   * @param y The measurement.
+   * @param R_diagonal The diagonal of the measurement covariance.
+   * @param gate_threshold The largest accepted normalized innovation squared. Zero disables it.
+   * @return The innovation and whether the measurement was accepted.
+   */
+  template<int M, int V, typename MeasurementModel, typename MeasurementJacobian>
+  static MeasurementInnovation<M> sequential_measurement_update(
+    StateVector & x, StateMatrix & U_factor, StateVector & D,
+    const Eigen::Matrix<float, V, 1> & inputs, MeasurementModel && measurement_model,
+    MeasurementJacobian && measurement_jacobian, const Eigen::Matrix<float, M, 1> & y,
+    const Eigen::Matrix<float, M, 1> & R_diagonal, float gate_threshold = 0.0f)
+  {
+    MeasurementInnovation<M> innovation;
+
+    const Eigen::Matrix<float, M, 1> h = measurement_model(x, inputs);
+    const Eigen::Matrix<float, M, N> C = measurement_jacobian(x, inputs);
+    innovation.residual = y - h;
+
+    // Keep the prior to correct the later innovations and to restore a rejected measurement.
+    const StateVector x_prior = x;
+    const StateMatrix U_prior = U_factor;
+    const StateVector D_prior = D;
+
+    innovation.nis = 0.0f;
+    for (int i = 0; i < M; i++) {
+      const StateVector c = C.row(i).transpose();
+      const float prediction = h(i) + c.dot(x - x_prior);
+      innovation.nis +=
+        single_measurement_update(x, U_factor, D, y(i), prediction, R_diagonal(i), c).nis;
+    }
+
+    innovation.accepted = passes_gate(innovation.nis, gate_threshold);
+    if (!innovation.accepted) {
+      x = x_prior;
+      U_factor = U_prior;
+      D = D_prior;
+    }
+
+    return innovation;
+  }
+};
+
+} // namespace rosplane
+
+#endif // UD_COVARIANCE_H
@@ -14,6 +14,7 @@ def generate_launch_description():
     control_type = "default"
     aircraft = "anaconda" # Default aircraft
     use_params = 'false'
+    estimator_type = 'continuous_discrete'
 
     for arg in sys.argv:
         if arg.startswith("control_type:="):
@@ -25,6 +26,9 @@ def generate_launch_description():
         if arg.startswith("seed_estimator:="):
             use_params = arg.split(":=")[1].lower()
 
+        if arg.startswith("estimator_type:="):
+            estimator_type = arg.split(":=")[1].lower()
+
     autopilot_params = os.path.join(
         rosplane_dir,
         'params',
@@ -77,6 +81,6 @@ def generate_launch_description():
             name='estimator',
             output='screen',
             parameters = [autopilot_params],
-            arguments = [use_params]
+            arguments = [use_params, estimator_type]
         )
     ])
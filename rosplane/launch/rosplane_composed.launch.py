@@ -0,0 +1,111 @@
+import os
+import sys
+import launch.actions
+from launch import LaunchDescription
+from launch_ros.actions import ComposableNodeContainer
+from launch_ros.descriptions import ComposableNode
+from ament_index_python.packages import get_package_share_directory
+
+
+def generate_launch_description():
+    # Runs the same nodes as rosplane.launch.py, but as components in a single process. Messages
+    # between them, such as the estimated state, are passed intra-process without serialization.
+
+    # Create the package directory
+    rosplane_dir = get_package_share_directory('rosplane')
+
+    # Determine the appropriate control scheme.
+    control_type = "default"
+    aircraft = "anaconda" # Default aircraft
+    use_params = 'false'
+    estimator_type = 'continuous_discrete'
+
+    for arg in sys.argv:
+        if arg.startswith("control_type:="):
+            control_type = arg.split(":=")[1]
+
+        if arg.startswith("aircraft:="):
+            aircraft = arg.split(":=")[1]
+
+        if arg.startswith("seed_estimator:="):
+            use_params = arg.split(":=")[1].lower()
+
+        if arg.startswith("estimator_type:="):
+            estimator_type = arg.split(":=")[1].lower()
+
+    autopilot_params = os.path.join(
+        rosplane_dir,
+        'params',
+        aircraft + '_autopilot_params.yaml'
+    )
+
+    controller_plugin = 'rosplane::ControllerSucessiveLoop'
+    if control_type == 'total_energy':
+        controller_plugin = 'rosplane::ControllerTotalEnergy'
+
+    estimator_plugin = 'rosplane::EstimatorContinuousDiscrete'
+    if estimator_type == 'quaternion_ins':
+        estimator_plugin = 'rosplane::EstimatorQuaternionINS'
+
+    intra_process = [{'use_intra_process_comms': True}]
+
+    return LaunchDescription([
+        launch.actions.DeclareLaunchArgument(
+            'command_publisher_remap',
+            default_value='/command',
+        ),
+        launch.actions.DeclareLaunchArgument(
+            'controller_command_publisher_remap',
+            default_value='/controller_command',
+        ),
+        ComposableNodeContainer(
+            name='rosplane',
+            namespace='',
+            package='rclcpp_components',
+            # Single threaded, so the estimator can also run in event-driven mode.
+            executable='component_container',
+            output='screen',
+            composable_node_descriptions=[
+                ComposableNode(
+                    package='rosplane',
+                    plugin=estimator_plugin,
+                    name='estimator',
+                    parameters=[autopilot_params, {'seed_estimator': use_params == 'true'}],
+                    extra_arguments=intra_process,
+                ),
+                ComposableNode(
+                    package='rosplane',
+                    plugin=controller_plugin,
+                    name='autopilot',
+                    parameters=[autopilot_params],
+                    remappings=[
+                        ('/command', launch.substitutions.LaunchConfiguration('command_publisher_remap'))
+                    ],
+                    extra_arguments=intra_process,
+                ),
+                ComposableNode(
+                    package='rosplane',
+                    plugin='rosplane::PathFollowerExample',
+                    name='path_follower',
+                    parameters=[autopilot_params],
+                    remappings=[
+                        ('/controller_command', launch.substitutions.LaunchConfiguration('controller_command_publisher_remap'))
+                    ],
+                    extra_arguments=intra_process,
+                ),
+                ComposableNode(
+                    package='rosplane',
+                    plugin='rosplane::PathManagerExample',
+                    name='path_manager',
+                    parameters=[autopilot_params],
+                    extra_arguments=intra_process,
+                ),
+                ComposableNode(
+                    package='rosplane',
+                    plugin='rosplane::PathPlanner',
+                    name='path_planner',
+                    extra_arguments=intra_process,
+                ),
+            ],
+        ),
+    ])
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Write the estimator's input topics from a rosbag2 recording as a sensor log for
+rosplane_estimator_replay.
+
+Usage: estimator_log_from_bag.py <bag_directory> <sensor_log.csv>
+
+Messages are written in the order they were recorded, stamped with their header stamps. The
+topic names match the estimator node's default subscriptions.
+"""
+
+import sys
+
+import rosbag2_py
+from rclpy.serialization import deserialize_message
+from rosidl_runtime_py.utilities import get_message
+
+TOPICS = {
+    '/imu/data': 'imu',
+    '/baro': 'baro',
+    '/airspeed': 'airspeed',
+    '/navsat_compat/fix': 'gnss_fix',
+    '/navsat_compat/vel': 'gnss_vel',
+    '/status': 'status',
+}
+
+
+def stamp_of(msg):
+    return msg.header.stamp.sec + msg.header.stamp.nanosec * 1e-9
+
+
+def fields_of(kind, msg):
+    if kind == 'imu':
+        return [msg.angular_velocity.x, msg.angular_velocity.y, msg.angular_velocity.z,
+                msg.linear_acceleration.x, msg.linear_acceleration.y, msg.linear_acceleration.z]
+    if kind == 'baro':
+        return [msg.pressure]
+    if kind == 'airspeed':
+        return [msg.differential_pressure]
+    if kind == 'gnss_fix':
+        return [msg.status.status, msg.latitude, msg.longitude, msg.altitude]
+    if kind == 'gnss_vel':
+        return [msg.twist.linear.x, msg.twist.linear.y, msg.twist.linear.z]
+    if kind == 'status':
+        return [int(msg.armed)]
+    raise ValueError(kind)
+
+
+def main(argv):
+    if len(argv) != 3:
+        print(__doc__)
+        return 1
+
+    reader = rosbag2_py.SequentialReader()
+    reader.open(rosbag2_py.StorageOptions(uri=argv[1]),
+                rosbag2_py.ConverterOptions(input_serialization_format='cdr',
+                                            output_serialization_format='cdr'))
+    types = {topic.name: get_message(topic.type) for topic in reader.get_all_topics_and_types()
+             if topic.name in TOPICS}
+    reader.set_filter(rosbag2_py.StorageFilter(topics=list(types)))
+
+    count = 0
+    with open(argv[2], 'w') as log:
+        while reader.has_next():
+            topic, data, _ = reader.read_next()
+            kind = TOPICS[topic]
+            msg = deserialize_message(data, types[topic])
+            values = [repr(stamp_of(msg))] + [repr(v) for v in fields_of(kind, msg)]
+            log.write(kind + ',' + ','.join(values) + '\n')
+            count += 1
+
+    print(f'Wrote {count} messages to {argv[2]}')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -1,18 +1,28 @@
+#include <cmath>
 #include <functional>
+#include <string>
 
 #include <rclcpp/logging.hpp>
 
-#include "controller_successive_loop.hpp"
-#include "controller_total_energy.hpp"
-
 #include "controller_base.hpp"
 
 namespace rosplane
 {
 
-ControllerBase::ControllerBase()
-    : Node("controller_base")
+ControllerBase::ControllerBase(const rclcpp::NodeOptions & options)
+    : Node("controller_base", options)
     , params_(this)
+    , control_on_state_(false)
+    , state_timeout_(0, 0)
+    , command_timeout_(0, 0)
+    , failsafe_mode_(FailsafeMode::WINGS_LEVEL)
+    , state_received_(false)
+    , state_stale_(false)
+    , command_stale_(false)
+    , watchdog_published_(false)
+    , failsafe_chi_(0.0)
+    , failsafe_h_(0.0)
+    , failsafe_va_(0.0)
     , params_initialized_(false)
 {
 
@@ -20,6 +30,14 @@ ControllerBase::ControllerBase()
   actuators_pub_ = this->create_publisher<rosflight_msgs::msg::Command>("command", 10);
   controller_internals_pub_ =
     this->create_publisher<rosplane_msgs::msg::ControllerInternals>("controller_internals", 10);
+  // Transient local so a ground station that starts late still sees whether the failsafe is active.
+  // Intra-process communication does not support transient_local, so it is disabled for this topic.
+  rclcpp::QoS qos_transient_local_1_(1);
+  qos_transient_local_1_.transient_local();
+  rclcpp::PublisherOptions watchdog_pub_options;
+  watchdog_pub_options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
+  watchdog_pub_ = this->create_publisher<rosplane_msgs::msg::ControllerWatchdog>(
+    "controller_watchdog", qos_transient_local_1_, watchdog_pub_options);
 
   // Advertise subscribed topics and set bound callbacks.
   controller_commands_sub_ = this->create_subscription<rosplane_msgs::msg::ControllerCommands>(
@@ -29,6 +47,8 @@ ControllerBase::ControllerBase()
 
   // This flag indicates whether the first set of commands have been received.
   command_recieved_ = false;
+  controller_commands_ = std::make_shared<const rosplane_msgs::msg::ControllerCommands>();
+  vehicle_state_ = std::make_shared<const rosplane_msgs::msg::State>();
 
   // Set the parameter callback, for when parameters are changed.
   parameter_callback_handle_ = this->add_on_set_parameters_callback(
@@ -39,6 +59,14 @@ ControllerBase::ControllerBase()
   // Set the values for the parameters, from the param file or use the deafault value.
   params_.set_parameters();
 
+  pwm_rad_e_ = params_.get_double_handle("pwm_rad_e");
+  pwm_rad_a_ = params_.get_double_handle("pwm_rad_a");
+  pwm_rad_r_ = params_.get_double_handle("pwm_rad_r");
+  failsafe_throttle_ = params_.get_double_handle("failsafe_throttle");
+  failsafe_loiter_roll_ = params_.get_double_handle("failsafe_loiter_roll");
+
+  update_watchdog_parameters();
+
   params_initialized_ = true;
 
   set_timer();
@@ -51,98 +79,283 @@ void ControllerBase::declare_parameters()
   params_.declare_double("pwm_rad_a", 1.0);
   params_.declare_double("pwm_rad_r", 1.0);
   params_.declare_double("controller_output_frequency", 100.0);
+  params_.declare_bool("control_on_state", false);
+  params_.declare_double("state_timeout", 0.1);
+  params_.declare_double("command_timeout", 1.0);
+  params_.declare_string("failsafe_mode", "wings_level");
+  params_.declare_double("failsafe_throttle", 0.0);
+  params_.declare_double("failsafe_loiter_roll", 15.0 * M_PI / 180.0);
+}
+
+void ControllerBase::update_watchdog_parameters()
+{
+  state_timeout_ = rclcpp::Duration::from_seconds(params_.get_double("state_timeout"));
+  command_timeout_ = rclcpp::Duration::from_seconds(params_.get_double("command_timeout"));
+
+  std::string failsafe_mode = params_.get_string("failsafe_mode");
+  if (failsafe_mode == "wings_level") {
+    failsafe_mode_ = FailsafeMode::WINGS_LEVEL;
+  } else if (failsafe_mode == "fixed_throttle") {
+    failsafe_mode_ = FailsafeMode::FIXED_THROTTLE;
+  } else if (failsafe_mode == "loiter") {
+    failsafe_mode_ = FailsafeMode::LOITER;
+  } else {
+    RCLCPP_ERROR(this->get_logger(),
+                 "Unknown failsafe_mode %s, expected wings_level, fixed_throttle or loiter. "
+                 "Using fixed_throttle.",
+                 failsafe_mode.c_str());
+    failsafe_mode_ = FailsafeMode::FIXED_THROTTLE;
+  }
+
+  // Publish the new timeouts and mode on the next tick.
+  watchdog_published_ = false;
 }
 
 void ControllerBase::controller_commands_callback(
-  const rosplane_msgs::msg::ControllerCommands::SharedPtr msg)
+  const rosplane_msgs::msg::ControllerCommands::ConstSharedPtr msg)
 {
 
   // Set the flag that a command has been received.
   command_recieved_ = true;
+  last_command_receive_time_ = this->get_clock()->now();
+
+  // Keep the message to use in calculations. Holding the pointer rather than copying the message
+  // lets intra-process publishers hand the same message to every subscriber.
+  controller_commands_ = msg;
+}
+
+void ControllerBase::vehicle_state_callback(const rosplane_msgs::msg::State::ConstSharedPtr msg)
+{
+
+  rclcpp::Time now = this->get_clock()->now();
+
+  if (!control_on_state_) {
+    // Keep the message to use in calculations.
+    vehicle_state_ = msg;
+    last_state_receive_time_ = now;
+    state_received_ = true;
+    return;
+  }
+
+  // Skip states that are not newer than the last one, so the control never runs twice on the same
+  // state.
+  rclcpp::Time stamp(msg->header.stamp);
+  if (stamp <= last_state_stamp_) {
+    return;
+  }
+
+  // Use the time elapsed between the states as the time step, unless this is the first state or
+  // the state stopped arriving for a while, when the nominal period is used.
+  float Ts = timer_period_.count() * 1e-6;
+  if (stamp - last_state_stamp_ <= state_timeout_) {
+    Ts = (stamp - last_state_stamp_).seconds();
+  }
+
+  vehicle_state_ = msg;
+  last_state_stamp_ = stamp;
+  last_state_receive_time_ = now;
+  state_received_ = true;
+
+  actuator_controls_publish(Ts, now);
+}
+
+void ControllerBase::state_watchdog()
+{
+  rclcpp::Time now = this->get_clock()->now();
+  if (!command_recieved_) {
+    return;
+  }
+
+  // The control runs as states arrive, so only fly the failsafe here when they stop.
+  check_inputs(now);
+  if (state_stale_) {
+    publish_fixed_throttle(now);
+  }
+}
+
+void ControllerBase::check_inputs(const rclcpp::Time & now)
+{
+  bool state_stale = !state_received_ || now - last_state_receive_time_ > state_timeout_;
+  bool command_stale = now - last_command_receive_time_ > command_timeout_;
+
+  if (watchdog_published_ && state_stale == state_stale_ && command_stale == command_stale_) {
+    return;
+  }
+
+  if (state_stale != state_stale_) {
+    if (state_stale) {
+      RCLCPP_WARN(this->get_logger(),
+                  "No state received within %.3f s, flying open loop at the failsafe throttle.",
+                  state_timeout_.seconds());
+    } else {
+      RCLCPP_INFO(this->get_logger(), "State received again.");
+    }
+  }
+
+  if (command_stale != command_stale_) {
+    if (command_stale) {
+      RCLCPP_WARN(this->get_logger(),
+                  "No controller commands received within %.3f s, flying the failsafe.",
+                  command_timeout_.seconds());
+
+      // Hold the last commanded altitude and airspeed, and the course at the time of the loss.
+      failsafe_chi_ = vehicle_state_->chi;
+      failsafe_h_ = controller_commands_->h_c;
+      failsafe_va_ = controller_commands_->va_c;
+    } else {
+      RCLCPP_INFO(this->get_logger(), "Controller commands received again.");
+    }
+  }
+
+  state_stale_ = state_stale;
+  command_stale_ = command_stale;
+  publish_watchdog(now);
+}
+
+void ControllerBase::publish_watchdog(const rclcpp::Time & now)
+{
+  rosplane_msgs::msg::ControllerWatchdog watchdog;
+  watchdog.header.stamp = now;
+  watchdog.state_stale = state_stale_;
+  watchdog.command_stale = command_stale_;
+  watchdog.failsafe_active = state_stale_ || command_stale_;
+
+  FailsafeMode mode = state_stale_ ? FailsafeMode::FIXED_THROTTLE : failsafe_mode_;
+  switch (mode) {
+    case FailsafeMode::WINGS_LEVEL:
+      watchdog.failsafe_mode = watchdog.FAILSAFE_WINGS_LEVEL;
+      break;
+    case FailsafeMode::FIXED_THROTTLE:
+      watchdog.failsafe_mode = watchdog.FAILSAFE_FIXED_THROTTLE;
+      break;
+    case FailsafeMode::LOITER:
+      watchdog.failsafe_mode = watchdog.FAILSAFE_LOITER;
+      break;
+  }
+
+  watchdog.state_age = state_received_ ? (now - last_state_receive_time_).seconds() : -1.0;
+  watchdog.command_age = command_recieved_ ? (now - last_command_receive_time_).seconds() : -1.0;
+  watchdog.state_timeout = state_timeout_.seconds();
+  watchdog.command_timeout = command_timeout_.seconds();
 
-  // Save the message to use in calculations.
-  controller_commands_ = *msg;
+  watchdog_pub_->publish(watchdog);
+  watchdog_published_ = true;
 }
 
-void ControllerBase::vehicle_state_callback(const rosplane_msgs::msg::State::SharedPtr msg)
+void ControllerBase::publish_fixed_throttle(const rclcpp::Time & now)
 {
+  Output output;
+  output.delta_a = 0.0;
+  output.delta_e = 0.0;
+  output.delta_r = 0.0;
+  output.delta_t = failsafe_throttle_.get();
+  publish_actuators(output, now);
+}
 
-  // Save the message to use in calculations.
-  vehicle_state_ = *msg;
+void ControllerBase::apply_failsafe_commands(Input & input)
+{
+  input.h_c = failsafe_h_;
+  input.va_c = failsafe_va_;
+
+  if (failsafe_mode_ == FailsafeMode::LOITER) {
+    // Command the current course, so the course loop adds nothing to the feed forward bank angle.
+    input.chi_c = input.chi;
+    input.phi_ff = failsafe_loiter_roll_.get();
+  } else {
+    input.chi_c = failsafe_chi_;
+    input.phi_ff = 0.0;
+  }
 }
 
-void ControllerBase::actuator_controls_publish()
+void ControllerBase::actuator_controls_publish(float Ts, const rclcpp::Time & now)
 {
+  // If no command was received, there is nothing to control to yet.
+  if (!command_recieved_) {
+    return;
+  }
+
+  check_inputs(now);
+
+  // Without a recent state the loops would be closed on stale data.
+  if (state_stale_ || (command_stale_ && failsafe_mode_ == FailsafeMode::FIXED_THROTTLE)) {
+    publish_fixed_throttle(now);
+    return;
+  }
 
   // Assemble inputs for the control algorithm.
   Input input;
-  input.h = -vehicle_state_.position[2];
-  input.va = vehicle_state_.va;
-  input.phi = vehicle_state_.phi;
-  input.theta = vehicle_state_.theta;
-  input.chi = vehicle_state_.chi;
-  input.p = vehicle_state_.p;
-  input.q = vehicle_state_.q;
-  input.r = vehicle_state_.r;
-  input.va_c = controller_commands_.va_c;
-  input.h_c = controller_commands_.h_c;
-  input.chi_c = controller_commands_.chi_c;
-  input.phi_ff = controller_commands_.phi_ff;
+  input.Ts = Ts;
+  input.h = -vehicle_state_->position[2];
+  input.va = vehicle_state_->va;
+  input.phi = vehicle_state_->phi;
+  input.theta = vehicle_state_->theta;
+  input.chi = vehicle_state_->chi;
+  input.p = vehicle_state_->p;
+  input.q = vehicle_state_->q;
+  input.r = vehicle_state_->r;
+  input.va_c = controller_commands_->va_c;
+  input.h_c = controller_commands_->h_c;
+  input.chi_c = controller_commands_->chi_c;
+  input.phi_ff = controller_commands_->phi_ff;
+
+  if (command_stale_) {
+    apply_failsafe_commands(input);
+  }
 
   Output output;
 
-  // If a command was received, begin control.
-  if (command_recieved_ == true) {
-
-    // Control based off of inputs and parameters.
-    control(input, output);
-
-    // Convert control outputs to pwm.
-    convert_to_pwm(output);
-
-    rosflight_msgs::msg::Command actuators;
-
-    // Find the current time, and save as a timestamp.
-    rclcpp::Time now = this->get_clock()->now();
-
-    // Attach the timestamp.
-    actuators.header.stamp = now;
-
-    // Do not ignore any of the actuators.
-    actuators.ignore = 0;
-
-    // Indicate that commands are for the actuators directly.
-    actuators.mode = rosflight_msgs::msg::Command::MODE_PASS_THROUGH;
-
-    // Package control efforts. If the output is infinite replace with 0.
-    actuators.qx = (std::isfinite(output.delta_a)) ? output.delta_a : 0.0f;
-    actuators.qy = (std::isfinite(output.delta_e)) ? output.delta_e : 0.0f;
-    actuators.qz = (std::isfinite(output.delta_r)) ? output.delta_r : 0.0f;
-    actuators.fx = (std::isfinite(output.delta_t)) ? output.delta_t : 0.0f;
-
-    // Publish actuators.
-    actuators_pub_->publish(actuators);
-
-    // Publish the current control values
-    rosplane_msgs::msg::ControllerInternals controller_internals;
-    controller_internals.header.stamp = now;
-    controller_internals.phi_c = output.phi_c;
-    controller_internals.theta_c = output.theta_c;
-    switch (output.current_zone) {
-      case AltZones::TAKE_OFF:
-        controller_internals.alt_zone = controller_internals.ZONE_TAKE_OFF;
-        break;
-      case AltZones::CLIMB:
-        controller_internals.alt_zone = controller_internals.ZONE_CLIMB;
-        break;
-      case AltZones::ALTITUDE_HOLD:
-        controller_internals.alt_zone = controller_internals.ZONE_ALTITUDE_HOLD;
-        break;
-      default:
-        break;
-    }
-    controller_internals_pub_->publish(controller_internals);
+  // Control based off of inputs and parameters.
+  control(input, output);
+
+  publish_actuators(output, now);
+
+  // Publish the current control values
+  rosplane_msgs::msg::ControllerInternals controller_internals;
+  controller_internals.header.stamp = now;
+  controller_internals.phi_c = output.phi_c;
+  controller_internals.theta_c = output.theta_c;
+  switch (output.current_zone) {
+    case AltZones::TAKE_OFF:
+      controller_internals.alt_zone = controller_internals.ZONE_TAKE_OFF;
+      break;
+    case AltZones::CLIMB:
+      controller_internals.alt_zone = controller_internals.ZONE_CLIMB;
+      break;
+    case AltZones::ALTITUDE_HOLD:
+      controller_internals.alt_zone = controller_internals.ZONE_ALTITUDE_HOLD;
+      break;
+    default:
+      break;
   }
+  controller_internals_pub_->publish(controller_internals);
+}
+
+void ControllerBase::publish_actuators(const Output & output, const rclcpp::Time & now)
+{
+  Output scaled = output;
+
+  // Convert control outputs to pwm.
+  convert_to_pwm(scaled);
+
+  auto actuators = std::make_unique<rosflight_msgs::msg::Command>();
+
+  // Attach the timestamp.
+  actuators->header.stamp = now;
+
+  // Do not ignore any of the actuators.
+  actuators->ignore = 0;
+
+  // Indicate that commands are for the actuators directly.
+  actuators->mode = rosflight_msgs::msg::Command::MODE_PASS_THROUGH;
+
+  // Package control efforts. If the output is infinite replace with 0.
+  actuators->qx = (std::isfinite(scaled.delta_a)) ? scaled.delta_a : 0.0f;
+  actuators->qy = (std::isfinite(scaled.delta_e)) ? scaled.delta_e : 0.0f;
+  actuators->qz = (std::isfinite(scaled.delta_r)) ? scaled.delta_r : 0.0f;
+  actuators->fx = (std::isfinite(scaled.delta_t)) ? scaled.delta_t : 0.0f;
+
+  // Publish actuators.
+  actuators_pub_->publish(std::move(actuators));
 }
 
 rcl_interfaces::msg::SetParametersResult
@@ -161,10 +374,14 @@ ControllerBase::parametersCallback(const std::vector<rclcpp::Parameter> & parame
   if (params_initialized_ && success) {
     std::chrono::microseconds curr_period = std::chrono::microseconds(
       static_cast<long long>(1.0 / params_.get_double("controller_output_frequency") * 1'000'000));
-    if (timer_period_ != curr_period) {
+    if (timer_period_ != curr_period || control_on_state_ != params_.get_bool("control_on_state")) {
       timer_->cancel();
       set_timer();
     }
+
+    update_watchdog_parameters();
+
+    parameters_changed();
   }
 
   return result;
@@ -176,18 +393,30 @@ void ControllerBase::set_timer()
   double frequency = params_.get_double("controller_output_frequency");
   timer_period_ = std::chrono::microseconds(static_cast<long long>(1.0 / frequency * 1'000'000));
 
+  control_on_state_ = params_.get_bool("control_on_state");
+  // Time the first state after the mode changes with the nominal period.
+  last_state_stamp_ = rclcpp::Time(0, 0, RCL_ROS_TIME);
+
+  if (control_on_state_) {
+    // The control runs on each new state, and the timer only checks that states keep arriving.
+    timer_ = this->create_wall_timer(timer_period_,
+                                     std::bind(&ControllerBase::state_watchdog, this));
+    return;
+  }
+
   // Set timer to trigger bound callback (actuator_controls_publish) at the given periodicity.
-  timer_ = this->create_wall_timer(timer_period_,
-                                   std::bind(&ControllerBase::actuator_controls_publish, this));
+  float Ts = timer_period_.count() * 1e-6;
+  timer_ = this->create_wall_timer(
+    timer_period_, [this, Ts]() { actuator_controls_publish(Ts, this->get_clock()->now()); });
 }
 
 void ControllerBase::convert_to_pwm(Output & output)
 {
 
   // Assign parameters from parameters object
-  double pwm_rad_e = params_.get_double("pwm_rad_e");
-  double pwm_rad_a = params_.get_double("pwm_rad_a");
-  double pwm_rad_r = params_.get_double("pwm_rad_r");
+  double pwm_rad_e = pwm_rad_e_.get();
+  double pwm_rad_a = pwm_rad_a_.get();
+  double pwm_rad_r = pwm_rad_r_.get();
 
   // Multiply each control effort (in radians) by a scaling factor to a pwm.
   // TODO investigate why this is named "pwm". The actual scaling to pwm happens in rosflight_io.
@@ -197,26 +426,3 @@ void ControllerBase::convert_to_pwm(Output & output)
 }
 
 } // namespace rosplane
-
-int main(int argc, char * argv[])
-{
-
-  // Initialize ROS2 and then begin to spin control node.
-  rclcpp::init(argc, argv);
-
-  if (strcmp(argv[1], "total_energy") == 0) {
-    auto node = std::make_shared<rosplane::ControllerTotalEnergy>();
-    RCLCPP_INFO_STREAM(node->get_logger(), "Using total energy control.");
-    rclcpp::spin(node);
-  } else if (strcmp(argv[1], "default") == 0) {
-    auto node = std::make_shared<rosplane::ControllerSucessiveLoop>();
-    RCLCPP_INFO_STREAM(node->get_logger(), "Using default control.");
-    rclcpp::spin(node);
-  } else {
-    auto node = std::make_shared<rosplane::ControllerSucessiveLoop>();
-    RCLCPP_INFO_STREAM(node->get_logger(), "Invalid control type, using default control.");
-    rclcpp::spin(node);
-  }
-
-  return 0;
-}
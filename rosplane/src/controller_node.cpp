@@ -0,0 +1,35 @@
+#include <cstring>
+
+#include "controller_successive_loop.hpp"
+#include "controller_total_energy.hpp"
+
+/**
+ * Usage: rosplane_controller [control_type]
+ *
+ * control_type is "default" (successive loop closure) or "total_energy".
+ *
+ * The controllers are also registered as components, rosplane::ControllerSucessiveLoop and
+ * rosplane::ControllerTotalEnergy, to run in a component container with the rest of the autopilot.
+ */
+int main(int argc, char * argv[])
+{
+
+  // Initialize ROS2 and then begin to spin control node.
+  rclcpp::init(argc, argv);
+
+  if (argc >= 2 && strcmp(argv[1], "total_energy") == 0) {
+    auto node = std::make_shared<rosplane::ControllerTotalEnergy>();
+    RCLCPP_INFO_STREAM(node->get_logger(), "Using total energy control.");
+    rclcpp::spin(node);
+  } else if (argc >= 2 && strcmp(argv[1], "default") == 0) {
+    auto node = std::make_shared<rosplane::ControllerSucessiveLoop>();
+    RCLCPP_INFO_STREAM(node->get_logger(), "Using default control.");
+    rclcpp::spin(node);
+  } else {
+    auto node = std::make_shared<rosplane::ControllerSucessiveLoop>();
+    RCLCPP_INFO_STREAM(node->get_logger(), "Invalid control type, using default control.");
+    rclcpp::spin(node);
+  }
+
+  return 0;
+}
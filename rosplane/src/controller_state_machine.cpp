@@ -3,7 +3,8 @@
 namespace rosplane
 {
 
-ControllerStateMachine::ControllerStateMachine()
+ControllerStateMachine::ControllerStateMachine(const rclcpp::NodeOptions & options)
+    : ControllerBase(options)
 {
 
   // Initialize controller in take_off zone.
@@ -14,14 +15,17 @@ ControllerStateMachine::ControllerStateMachine()
 
   // Set parameters according to the parameters in the launch file, otherwise use the default values
   params_.set_parameters();
+
+  alt_toz_ = params_.get_double_handle("alt_toz");
+  alt_hz_ = params_.get_double_handle("alt_hz");
 }
 
 void ControllerStateMachine::control(const Input & input, Output & output)
 {
 
   // For readability, declare parameters that will be used in this controller
-  double alt_toz = params_.get_double("alt_toz");
-  double alt_hz = params_.get_double("alt_hz");
+  double alt_toz = alt_toz_.get();
+  double alt_hz = alt_hz_.get();
 
   // This state machine changes the controls used based on the zone of flight path the aircraft is currently on.
   switch (current_zone_) {
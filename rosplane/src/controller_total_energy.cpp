@@ -5,7 +5,8 @@
 namespace rosplane
 {
 
-ControllerTotalEnergy::ControllerTotalEnergy()
+ControllerTotalEnergy::ControllerTotalEnergy(const rclcpp::NodeOptions & options)
+    : ControllerSucessiveLoop(options)
 {
   // Initialize course hold, roll hold and pitch hold errors and integrators to zero.
   L_integrator_ = 0;
@@ -15,21 +16,66 @@ ControllerTotalEnergy::ControllerTotalEnergy()
   declare_parameters();
   // Set parameters according to the parameters in the launch file, otherwise use the default values
   params_.set_parameters();
+
+  compile_energy_gains();
 }
 
-void ControllerTotalEnergy::take_off_longitudinal_control(const Input & input, Output & output)
+void ControllerTotalEnergy::load_gains(const Input & input)
 {
-  // For readability, declare parameters here that will be used in this function
-  double max_takeoff_throttle = params_.get_double("max_takeoff_throttle");
-  double cmd_takeoff_pitch =
-    params_.get_double("cmd_takeoff_pitch"); // Declared in controller_successive_loop
+  ControllerSucessiveLoop::load_gains(input);
+
+  tick_energy_gains_ = std::atomic_load(&latest_energy_gains_);
+  energy_gains_ = tick_energy_gains_.get();
+
+  if (energy_gains_->schedule.empty()) {
+    return;
+  }
 
+  scheduled_energy_gains_ = *energy_gains_;
+  GainSchedule<4>::Row row;
+  energy_gains_->schedule.interpolate(schedule_key(input), row);
+  scheduled_energy_gains_.e_kp = row[0];
+  scheduled_energy_gains_.e_ki = row[1];
+  scheduled_energy_gains_.l_kp = row[2];
+  scheduled_energy_gains_.l_ki = row[3];
+
+  energy_gains_ = &scheduled_energy_gains_;
+}
+
+void ControllerTotalEnergy::parameters_changed()
+{
+  ControllerSucessiveLoop::parameters_changed();
+
+  // Parameters declared while this controller is being constructed are compiled at its end.
+  if (std::atomic_load(&latest_energy_gains_)) {
+    compile_energy_gains();
+  }
+}
+
+void ControllerTotalEnergy::compile_energy_gains()
+{
+  auto gains = std::make_shared<EnergyGains>();
+
+  gains->e_kp = params_.get_double("e_kp");
+  gains->e_ki = params_.get_double("e_ki");
+  gains->l_kp = params_.get_double("l_kp");
+  gains->l_ki = params_.get_double("l_ki");
+  gains->mass = params_.get_double("mass");
+  gains->gravity = params_.get_double("gravity");
+  gains->max_alt_error = params_.get_double("max_alt_error");
+  gains->schedule = build_schedule<4>({"e_kp", "e_ki", "l_kp", "l_ki"});
+
+  std::atomic_store(&latest_energy_gains_, std::shared_ptr<const EnergyGains>(std::move(gains)));
+}
+
+void ControllerTotalEnergy::take_off_longitudinal_control(const Input & input, Output & output)
+{
   // Set throttle to not overshoot altitude.
-  output.delta_t =
-    sat(total_energy_throttle(input.va_c, input.va, input.h_c, input.h), max_takeoff_throttle, 0);
+  output.delta_t = sat(total_energy_throttle(input.va_c, input.va, input.h_c, input.h),
+                       gains_->max_takeoff_throttle, 0);
 
   // Command a shallow pitch angle to gain altitude.
-  output.theta_c = cmd_takeoff_pitch * M_PI / 180.0;
+  output.theta_c = gains_->cmd_takeoff_pitch;
   output.delta_e = pitch_hold(output.theta_c, input.theta, input.q);
 }
 
@@ -47,7 +93,7 @@ void ControllerTotalEnergy::take_off_exit()
 void ControllerTotalEnergy::climb_longitudinal_control(const Input & input, Output & output)
 {
   // For readability, declare parameters here that will be used in this function
-  double alt_hz = params_.get_double("alt_hz");
+  double alt_hz = gains_->alt_hz; // Declared in controller_state_machine
 
   double adjusted_hc = adjust_h_c(input.h_c, input.h, alt_hz / 2.0);
   // Find the control efforts for throttle and find the commanded pitch angle using total energy.
@@ -70,7 +116,7 @@ void ControllerTotalEnergy::climb_exit()
 void ControllerTotalEnergy::alt_hold_longitudinal_control(const Input & input, Output & output)
 {
   // For readability, declare parameters here that will be used in this function
-  double alt_hz = params_.get_double("alt_hz");
+  double alt_hz = gains_->alt_hz; // Declared in controller_state_machine
 
   // Saturate altitude command.
   double adjusted_hc = adjust_h_c(input.h_c, input.h, alt_hz);
@@ -94,12 +140,11 @@ void ControllerTotalEnergy::altitude_hold_exit()
 float ControllerTotalEnergy::total_energy_throttle(float va_c, float va, float h_c, float h)
 {
   // For readability, declare parameters here that will be used in this function
-  double frequency = params_.get_double("controller_output_frequency");
-  double e_kp = params_.get_double("e_kp");
-  double e_ki = params_.get_double("e_ki");
-  double e_kd = params_.get_double("e_kd");
-  double max_t = params_.get_double("max_t");   // Declared in controller_successive_loop
-  double trim_t = params_.get_double("trim_t"); // Declared in controller_successive_loop
+  double Ts = gains_->Ts;
+  double e_kp = energy_gains_->e_kp;
+  double e_ki = energy_gains_->e_ki;
+  double max_t = gains_->airspeed.max; // Declared in controller_successive_loop
+  double trim_t = gains_->trim_t;       // Declared in controller_successive_loop
 
   // Update energies based off of most recent data.
   update_energies(va_c, va, h_c, h);
@@ -107,8 +152,6 @@ float ControllerTotalEnergy::total_energy_throttle(float va_c, float va, float h
   // Calculate total energy error, and normalize relative to the desired kinetic energy.
   float E_error = (K_error_ + U_error_) / K_ref_;
 
-  float Ts = 1.0 / frequency;
-
   // Integrate error.
   E_integrator_ = E_integrator_ + (Ts / 2.0) * (E_error + E_error_prev_);
 
@@ -126,11 +169,10 @@ float ControllerTotalEnergy::total_energy_throttle(float va_c, float va, float h
 float ControllerTotalEnergy::total_energy_pitch(float va_c, float va, float h_c, float h)
 {
   // For readability, declare parameters here that will be used in this function
-  double frequency = params_.get_double("controller_output_frequency");
-  double l_kp = params_.get_double("l_kp");
-  double l_ki = params_.get_double("l_ki");
-  double l_kd = params_.get_double("l_kd");
-  double max_roll = params_.get_double("max_roll"); // Declared in controller_successive_loop
+  double Ts = gains_->Ts;
+  double l_kp = energy_gains_->l_kp;
+  double l_ki = energy_gains_->l_ki;
+  double max_roll = gains_->course.max; // Declared in controller_successive_loop
 
   // Update energies based off of most recent data.
   update_energies(va_c, va, h_c, h);
@@ -139,24 +181,21 @@ float ControllerTotalEnergy::total_energy_pitch(float va_c, float va, float h_c,
 
   float L_error = (U_error_ - K_error_) / K_ref_;
 
-  float Ts = 1.0 / frequency;
-
   // Integrate error.
   L_integrator_ = L_integrator_ + (Ts / 2.0) * (L_error + L_error_prev_);
 
   L_error_prev_ = L_error;
 
   // Return saturated pitch command.
-  return sat(l_kp * L_error + l_ki * L_integrator_, max_roll * M_PI / 180.0,
-             -max_roll * M_PI / 180.0);
+  return sat(l_kp * L_error + l_ki * L_integrator_, max_roll, -max_roll);
 }
 
 void ControllerTotalEnergy::update_energies(float va_c, float va, float h_c, float h)
 {
   // For readability, declare parameters here that will be used in this function
-  double mass = params_.get_double("mass");
-  double gravity = params_.get_double("gravity");
-  double max_alt_error = params_.get_double("max_alt_error");
+  double mass = energy_gains_->mass;
+  double gravity = energy_gains_->gravity;
+  double max_alt_error = energy_gains_->max_alt_error;
 
   // Calculate the error in kinetic energy.
   K_error_ = 0.5 * mass * (pow(va_c, 2) - pow(va, 2));
@@ -182,5 +221,14 @@ void ControllerTotalEnergy::declare_parameters()
   params_.declare_double("mass", 2.28);
   params_.declare_double("gravity", 9.8);
   params_.declare_double("max_alt_error", 5.0);
+
+  // Schedules of the energy gains, with one value per gain_schedule_breakpoints value.
+  params_.declare_double_array("e_kp_schedule", {});
+  params_.declare_double_array("e_ki_schedule", {});
+  params_.declare_double_array("l_kp_schedule", {});
+  params_.declare_double_array("l_ki_schedule", {});
 }
 } // namespace rosplane
+
+#include <rclcpp_components/register_node_macro.hpp>
+RCLCPP_COMPONENTS_REGISTER_NODE(rosplane::ControllerTotalEnergy)
@@ -1,39 +1,37 @@
-#include <functional>
-#include <tuple>
+#include <algorithm>
+#include <chrono>
 
+#include "angles.hpp"
 #include "estimator_continuous_discrete.hpp"
 #include "estimator_ros.hpp"
 
 namespace rosplane
 {
 
-float radians(float degrees) { return M_PI * degrees / 180.0; }
+using namespace continuous_discrete;
 
-double wrap_within_180(double fixed_heading, double wrapped_heading)
-{
-  // wrapped_heading - number_of_times_to_wrap * 2pi
-  return wrapped_heading - floor((wrapped_heading - fixed_heading) / (2 * M_PI) + 0.5) * 2 * M_PI;
-}
-
-EstimatorContinuousDiscrete::EstimatorContinuousDiscrete()
-    : EstimatorEKF()
+EstimatorContinuousDiscrete::EstimatorContinuousDiscrete(const rclcpp::NodeOptions & options)
+    : EstimatorEKF(options)
     , xhat_a_(Eigen::Vector2f::Zero())
     , P_a_(Eigen::Matrix2f::Identity())
-    , xhat_p_(Eigen::VectorXf::Zero(7))
-    , P_p_(Eigen::MatrixXf::Identity(7, 7))
+    , xhat_p_(Eigen::Vector<float, 7>::Zero())
+    , P_p_(Eigen::Matrix<float, 7, 7>::Identity())
     , Q_a_(Eigen::Matrix2f::Identity())
     , Q_g_(Eigen::Matrix3f::Identity())
     , R_accel_(Eigen::Matrix3f::Identity())
-    , Q_p_(Eigen::MatrixXf::Identity(7, 7))
-    , R_p_(Eigen::MatrixXf::Zero(7, 7))
-    , f_p_(7)
-    , A_p_(7, 7)
-    , C_p_(7)
-    , L_p_(7)
+    , Q_p_(Eigen::Matrix<float, 7, 7>::Identity())
+    , R_p_(Eigen::Matrix<float, 6, 6>::Zero())
+    , xhat_v_(Eigen::Vector3f::Zero())
+    , P_v_(Eigen::Matrix3f::Identity())
+    , gyro_bias_(Eigen::Vector3f::Zero())
+    , gyro_bias_var_(Eigen::Vector3f::Zero())
+    , accel_bias_(Eigen::Vector3f::Zero())
+    , U_p_(Eigen::Matrix<float, 7, 7>::Identity())
+    , D_p_(Eigen::Vector<float, 7>::Ones())
+    , position_ud_valid_(false)
+    , position_elapsed_(0.0f)
+    , position_inputs_sum_(Eigen::Vector<float, 6>::Zero())
 {
-
-  bind_functions(); // TODO: Document what the _models are.
-
   phat_ = 0;
   qhat_ = 0;
   rhat_ = 0;
@@ -46,41 +44,41 @@ EstimatorContinuousDiscrete::EstimatorContinuousDiscrete()
   lpf_diff_ = 0.0;
 
   alpha_ = 0.0f;
+  alpha1_ = 0.0f;
+
+  position_history_head_ = 0;
+  position_history_count_ = 0;
+
+  gps_replay_count_ = 0;
+  gps_too_old_count_ = 0;
+  gps_over_budget_count_ = 0;
+  gps_dropped_count_ = 0;
+  gps_replay_time_last_ = 0.0;
+  gps_replay_time_max_ = 0.0;
+  gps_replay_step_cost_ = 0.0;
+
+  accel_consecutive_rejections_ = 0;
+  gps_consecutive_rejections_ = 0;
+  reinitializations_ = 0;
 
   // Declare and set parameters with the ROS2 system
   declare_parameters();
   params_.set_parameters();
+  bind_parameters();
 
   // Initialize covariance matrices from ROS2 parameters
   initialize_uncertainties();
 
   // Inits R matrix and alpha values with ROS2 parameters
   update_measurement_model_parameters();
+  update_lpf_alphas(1.0 / update_frequency_.get());
+  measurement_model_params_revision_ = params_.get_revision();
 
-  N_ = params_.get_int("num_propagation_steps");
-}
-
-EstimatorContinuousDiscrete::EstimatorContinuousDiscrete(bool use_params)
-    : EstimatorContinuousDiscrete()
-{
-  double init_lat = params_.get_double("init_lat");
-  double init_long = params_.get_double("init_lon");
-  double init_alt = params_.get_double("init_alt");
-  double init_static = params_.get_double("baro_calibration_val");
-
-  RCLCPP_INFO_STREAM(this->get_logger(), "Using seeded estimator values.");
-  RCLCPP_INFO_STREAM(this->get_logger(), "Seeded initial latitude: " << init_lat);
-  RCLCPP_INFO_STREAM(this->get_logger(), "Seeded initial longitude: " << init_long);
-  RCLCPP_INFO_STREAM(this->get_logger(), "Seeded initial altitude: " << init_alt);
-  RCLCPP_INFO_STREAM(this->get_logger(), "Seeded barometer calibration value: " << init_static);
-
-  gps_init_ = true;
-  init_lat_ = init_lat;
-  init_lon_ = init_long;
-  init_alt_ = init_alt;
-
-  baro_init_ = true;
-  init_static_ = init_static;
+  if (params_.get_bool("seed_estimator")) {
+    seed_from_parameters();
+    gyro_bias_ = gyro_bias_seed_;
+    accel_bias_ = accel_bias_seed_;
+  }
 }
 
 void EstimatorContinuousDiscrete::initialize_state_covariances()
@@ -93,7 +91,7 @@ void EstimatorContinuousDiscrete::initialize_state_covariances()
   double wind_e_initial_cov = params_.get_double("wind_e_initial_cov");
   double psi_initial_cov = params_.get_double("psi_initial_cov");
 
-  P_p_ = Eigen::MatrixXf::Identity(7, 7);
+  P_p_ = Eigen::Matrix<float, 7, 7>::Identity();
   P_p_(0, 0) = pos_n_initial_cov;
   P_p_(1, 1) = pos_e_initial_cov;
   P_p_(2, 2) = vg_initial_cov;
@@ -101,6 +99,7 @@ void EstimatorContinuousDiscrete::initialize_state_covariances()
   P_p_(4, 4) = wind_n_initial_cov;
   P_p_(5, 5) = wind_e_initial_cov;
   P_p_(6, 6) = radians(psi_initial_cov);
+  position_ud_valid_ = false;
 }
 
 void EstimatorContinuousDiscrete::initialize_uncertainties()
@@ -120,7 +119,22 @@ void EstimatorContinuousDiscrete::initialize_uncertainties()
 
   Q_p_ *= position_process_noise;
 
+  gyro_bias_var_.setConstant(params_.get_double("gyro_bias_initial_cov"));
+
   initialize_state_covariances();
+  initialize_vertical_covariance();
+}
+
+void EstimatorContinuousDiscrete::initialize_vertical_covariance()
+{
+  double h_initial_cov = params_.get_double("h_initial_cov");
+  double h_dot_initial_cov = params_.get_double("h_dot_initial_cov");
+  double baro_bias_initial_cov = params_.get_double("baro_bias_initial_cov");
+
+  P_v_ = Eigen::Matrix3f::Zero();
+  P_v_(0, 0) = h_initial_cov;
+  P_v_(1, 1) = h_dot_initial_cov;
+  P_v_(2, 2) = baro_bias_initial_cov;
 }
 
 void EstimatorContinuousDiscrete::update_measurement_model_parameters()
@@ -133,11 +147,6 @@ void EstimatorContinuousDiscrete::update_measurement_model_parameters()
   double sigma_accel = params_.get_double("sigma_accel");
   double sigma_pseudo_wind_n = params_.get_double("sigma_pseudo_wind_n");
   double sigma_pseudo_wind_e = params_.get_double("sigma_pseudo_wind_e");
-  double sigma_heading = params_.get_double("sigma_heading");
-  double frequency = params_.get_double("estimator_update_frequency");
-  double Ts = 1.0 / frequency;
-  float lpf_a = params_.get_double("lpf_a");
-  float lpf_a1 = params_.get_double("lpf_a1");
 
   R_accel_ = Eigen::Matrix3f::Identity() * pow(sigma_accel, 2);
 
@@ -147,29 +156,47 @@ void EstimatorContinuousDiscrete::update_measurement_model_parameters()
   R_p_(3, 3) = powf(sigma_course_gps, 2);
   R_p_(4, 4) = sigma_pseudo_wind_n;
   R_p_(5, 5) = sigma_pseudo_wind_e;
-  R_p_(6, 6) = sigma_heading;
+}
+
+void EstimatorContinuousDiscrete::update_lpf_alphas(float Ts)
+{
+  // For readability, declare the parameters used in the function here
+  float lpf_a = lpf_a_.get();
+  float lpf_a1 = lpf_a1_.get();
 
   alpha_ = exp(-lpf_a * Ts);
   alpha1_ = exp(-lpf_a1 * Ts);
+  alpha_Ts_ = Ts;
 }
 
 void EstimatorContinuousDiscrete::estimate(const Input & input, Output & output)
 {
   // For readability, declare the parameters here
-  double rho = params_.get_double("rho");
-  double gravity = params_.get_double("gravity");
-  double frequency = params_.get_double("estimator_update_frequency");
-  double gps_n_lim = params_.get_double("gps_n_lim");
-  double gps_e_lim = params_.get_double("gps_e_lim");
-  double Ts = 1.0 / frequency;
+  double rho = rho_.get();
+  double gravity = gravity_.get();
+  int attitude_propagation_steps = attitude_propagation_steps_.get();
+  int position_propagation_steps = position_propagation_steps_.get();
+  float accel_gate_threshold = accel_gate_threshold_.get();
+  float Ts = input.Ts;
+
+  // Only recompute the R matrices when a ROS2 parameter has changed, and the alpha values when
+  // either a parameter or the time step has changed.
+  if (params_.get_revision() != measurement_model_params_revision_) {
+    update_measurement_model_parameters();
+    update_lpf_alphas(Ts);
+    measurement_model_params_revision_ = params_.get_revision();
+  } else if (Ts != alpha_Ts_) {
+    update_lpf_alphas(Ts);
+  }
 
-  // Inits R matrix and alpha values with ROS2 parameters
-  update_measurement_model_parameters();
+  if (gyro_bias_estimation_.get()) {
+    update_gyro_bias(input, Ts);
+  }
 
   // low pass filter gyros to estimate angular rates
-  lpf_gyro_x_ = alpha_ * lpf_gyro_x_ + (1 - alpha_) * input.gyro_x;
-  lpf_gyro_y_ = alpha_ * lpf_gyro_y_ + (1 - alpha_) * input.gyro_y;
-  lpf_gyro_z_ = alpha_ * lpf_gyro_z_ + (1 - alpha_) * input.gyro_z;
+  lpf_gyro_x_ = alpha_ * lpf_gyro_x_ + (1 - alpha_) * (input.gyro_x - gyro_bias_(0));
+  lpf_gyro_y_ = alpha_ * lpf_gyro_y_ + (1 - alpha_) * (input.gyro_y - gyro_bias_(1));
+  lpf_gyro_z_ = alpha_ * lpf_gyro_z_ + (1 - alpha_) * (input.gyro_z - gyro_bias_(2));
 
   float phat = lpf_gyro_x_;
   float qhat = lpf_gyro_y_;
@@ -188,6 +215,10 @@ void EstimatorContinuousDiscrete::estimate(const Input & input, Output & output)
     hhat = 0.0;
   }
 
+  if (vertical_channel_.get()) {
+    hhat = step_vertical(input, Ts);
+  }
+
   // low pass filter diff pressure sensor and invert to estimate va
   lpf_diff_ = alpha1_ * lpf_diff_ + (1 - alpha1_) * input.diff_pres;
 
@@ -200,9 +231,9 @@ void EstimatorContinuousDiscrete::estimate(const Input & input, Output & output)
   float vahat = sqrt(2 / rho * lpf_diff_);
 
   // low pass filter accelerometers
-  lpf_accel_x_ = alpha_ * lpf_accel_x_ + (1 - alpha_) * input.accel_x;
-  lpf_accel_y_ = alpha_ * lpf_accel_y_ + (1 - alpha_) * input.accel_y;
-  lpf_accel_z_ = alpha_ * lpf_accel_z_ + (1 - alpha_) * input.accel_z;
+  lpf_accel_x_ = alpha_ * lpf_accel_x_ + (1 - alpha_) * (input.accel_x - accel_bias_(0));
+  lpf_accel_y_ = alpha_ * lpf_accel_y_ + (1 - alpha_) * (input.accel_y - accel_bias_(1));
+  lpf_accel_z_ = alpha_ * lpf_accel_z_ + (1 - alpha_) * (input.accel_z - accel_bias_(2));
 
   // These are the current states that will allow us to predict our measurement.
   Eigen::Vector4f att_curr_state_info;
@@ -214,15 +245,37 @@ void EstimatorContinuousDiscrete::estimate(const Input & input, Output & output)
 
   // ATTITUDE (ROLL AND PITCH) ESTIMATION
   // Prediction step
-  std::tie(P_a_, xhat_a_) =
-    propagate_model(xhat_a_, attitude_dynamics_model, attitude_jacobian_model, angular_rates,
-                    attitude_input_jacobian_model, P_a_, Q_a_, Q_g_, Ts);
+  // Both attitude states have a nonzero jacobian row, so the structured propagation has nothing to
+  // skip here and the generic one is as fast.
+  AttitudeEKF::propagate(
+    xhat_a_, P_a_, angular_rates,
+    [](const auto & x, const auto & u) { return attitude_dynamics(x, u); },
+    [](const auto & x, const auto & u) { return attitude_jacobian(x, u); },
+    [](const auto & x, const auto & u) { return attitude_input_jacobian(x, u); }, Q_a_, Q_g_, Ts,
+    attitude_propagation_steps);
 
   // Measurement update
-  std::tie(P_a_, xhat_a_) = measurement_update(
-    xhat_a_, att_curr_state_info, attitude_measurement_model, y_att,
-    attitude_measurement_jacobian_model, // TODO: change these std::ties to just pass by reference.
-    R_accel_, P_a_);
+  MeasurementInnovation<3> accel_innovation = AttitudeEKF::measurement_update(
+    xhat_a_, P_a_, att_curr_state_info,
+    [gravity](const auto & x, const auto & u) {
+      return attitude_measurement_prediction(x, u, gravity);
+    },
+    [gravity](const auto & x, const auto & u) {
+      return attitude_measurement_jacobian(x, u, gravity);
+    },
+    y_att, R_accel_, gate_for(accel_gate_threshold, accel_consecutive_rejections_));
+
+  for (int i = 0; i < 3; i++) {
+    innovations_.accel_innovation[i] = accel_innovation.residual(i);
+  }
+  innovations_.accel_nis = accel_innovation.nis;
+  innovations_.accel_accepted = accel_innovation.accepted;
+  if (!accel_innovation.accepted) {
+    innovations_.accel_rejections++;
+    accel_consecutive_rejections_++;
+  } else {
+    accel_consecutive_rejections_ = 0;
+  }
 
   // Check the estimate for errors
   check_xhat_a();
@@ -232,25 +285,78 @@ void EstimatorContinuousDiscrete::estimate(const Input & input, Output & output)
   thetahat_ = xhat_a_(1);
 
   // Implement continous-discrete EKF to estimate pn, pe, chi, Vg, wn, we
-  // Prediction step
-
-  if (fabsf(xhat_p_(2)) < 0.01f) {
-    xhat_p_(2) = 0.01; // prevent divide by zero
-  }
 
   // These are the state that will allow us to propagate our state model for the position state.
   Eigen::Vector<float, 6> attitude_states;
-  attitude_states << angular_rates, xhat_a_(0), xhat_a_(1), vahat;
+  attitude_states << angular_rates, phihat_, thetahat_, vahat;
+
+  // Hand the attitude estimates off to the position filter, which may run at a lower rate.
+  position_elapsed_ += Ts;
+  position_inputs_sum_ += Ts * attitude_states;
+
+  if (position_step_due(Ts, input.gps_new)) {
+    step_position(input, attitude_states, position_propagation_steps);
+  }
+
+  float pnhat = xhat_p_(0);
+  float pehat = xhat_p_(1);
+  float Vghat = xhat_p_(2);
+  float chihat = xhat_p_(3);
+  float wnhat = xhat_p_(4);
+  float wehat = xhat_p_(5);
+  float psihat = xhat_p_(6);
+
+  output.pn = pnhat;
+  output.pe = pehat;
+  output.h = hhat;
+  output.va = vahat;
+  output.alpha = 0;
+  output.beta = 0;
+  output.phi = phihat_;
+  output.theta = thetahat_;
+  output.chi = chihat;
+  output.p = phat;
+  output.q = qhat;
+  output.r = rhat;
+  output.Vg = Vghat;
+  output.wn = wnhat;
+  output.we = wehat;
+  output.psi = psihat;
+}
+
+bool EstimatorContinuousDiscrete::position_step_due(float Ts, bool gps_new)
+{
+  // For readability, declare the parameters here
+  double position_update_frequency = position_update_frequency_.get();
+
+  if (gps_new || position_update_frequency <= 0.0) {
+    return true;
+  }
+
+  // Step on the estimator step that ends closest to the position period.
+  return position_elapsed_ + Ts / 2.0f >= 1.0 / position_update_frequency;
+}
+
+void EstimatorContinuousDiscrete::step_position(const Input & input,
+                                                const Eigen::Vector<float, 6> & attitude_states,
+                                                int position_propagation_steps)
+{
+  // For readability, declare the parameters here
+  double gps_n_lim = gps_n_lim_.get();
+  double gps_e_lim = gps_e_lim_.get();
+  float vahat = attitude_states(5);
+
+  // Propagate over the time since the last position step with the mean attitude filter outputs.
+  float Ts = position_elapsed_;
+  Eigen::Vector<float, 6> inputs =
+    Ts > 0.0f ? (position_inputs_sum_ / Ts).eval() : attitude_states;
+  position_elapsed_ = 0.0f;
+  position_inputs_sum_.setZero();
 
   // POSITION AND COURSE ESTIMATION
   // Prediction step
-  std::tie(P_p_, xhat_p_) =
-    propagate_model(xhat_p_, position_dynamics_model, position_jacobian_model, attitude_states,
-                    position_input_jacobian_model, P_p_, Q_p_, Eigen::MatrixXf::Zero(7, 7), Ts);
+  propagate_position(inputs, Ts, position_propagation_steps);
 
-  // Check wrapping of the heading and course.
-  xhat_p_(3) = wrap_within_180(0.0, xhat_p_(3));
-  xhat_p_(6) = wrap_within_180(0.0, xhat_p_(6));
   if (xhat_p_(3) > radians(180.0f) || xhat_p_(3) < radians(-180.0f)) {
     RCLCPP_WARN(this->get_logger(), "Course estimate not wrapped from -pi to pi");
     xhat_p_(3) = 0;
@@ -260,24 +366,21 @@ void EstimatorContinuousDiscrete::estimate(const Input & input, Output & output)
     xhat_p_(6) = 0;
   }
 
+  // Record the step so delayed GPS measurements can be fused at the time they were taken.
+  push_position_history(input.stamp, Ts, inputs);
+
   // Measurement updates.
   // Only update if new GPS information is available.
   if (input.gps_new) {
-    Eigen::VectorXf pos_curr_state_info(1);
-    pos_curr_state_info << vahat;
-
     //wrap course measurement
     float gps_course = fmodf(input.gps_course, radians(360.0f));
-    gps_course = wrap_within_180(xhat_p_(3), gps_course);
 
     // Measurements for the postional states.
     Eigen::Vector<float, 6> y_pos;
     y_pos << input.gps_n, input.gps_e, input.gps_Vg, gps_course, 0.0, 0.0;
 
     // Update the state and covariance with based on the predicted and actual measurements.
-    std::tie(P_p_, xhat_p_) =
-      measurement_update(xhat_p_, pos_curr_state_info, position_measurement_model, y_pos,
-                         position_measurement_jacobian_model, R_p_, P_p_);
+    fuse_delayed_gps(y_pos, vahat, input.gps_stamp, position_propagation_steps);
 
     if (xhat_p_(0) > gps_n_lim || xhat_p_(0) < -gps_n_lim) {
       RCLCPP_WARN(this->get_logger(), "gps n limit reached");
@@ -321,6 +424,9 @@ void EstimatorContinuousDiscrete::estimate(const Input & input, Output & output)
     }
   }
   if (problem) {
+    // The history no longer leads to the current state, so it cannot be replayed.
+    position_history_count_ = std::min<std::size_t>(position_history_count_, 1);
+    reinitializations_++;
     RCLCPP_WARN(this->get_logger(), "position estimator reinitialized due to non-finite state %d",
                 prob_index);
   }
@@ -328,289 +434,397 @@ void EstimatorContinuousDiscrete::estimate(const Input & input, Output & output)
     xhat_p_(6) = fmodf(xhat_p_(6), 2.0 * M_PI);
   }
 
-  float pnhat = xhat_p_(0);
-  float pehat = xhat_p_(1);
-  float Vghat = xhat_p_(2);
-  float chihat = xhat_p_(3);
-  float wnhat = xhat_p_(4);
-  float wehat = xhat_p_(5);
-  float psihat = xhat_p_(6);
-
-  output.pn = pnhat;
-  output.pe = pehat;
-  output.h = hhat;
-  output.va = vahat;
-  output.alpha = 0;
-  output.beta = 0;
-  output.phi = phihat_;
-  output.theta = thetahat_;
-  output.chi = chihat;
-  output.p = phat;
-  output.q = qhat;
-  output.r = rhat;
-  output.Vg = Vghat;
-  output.wn = wnhat;
-  output.we = wehat;
-  output.psi = psihat;
+  // Keep the newest step in the history in line with the final estimate.
+  position_history_at(0).xhat = xhat_p_;
+  position_history_at(0).P = P_p_;
 }
 
-Eigen::VectorXf
-EstimatorContinuousDiscrete::attitude_dynamics(const Eigen::VectorXf & state,
-                                               const Eigen::VectorXf & angular_rates)
+EstimatorContinuousDiscrete::PositionSnapshot &
+EstimatorContinuousDiscrete::position_history_at(std::size_t age)
 {
-  float cp = cosf(state(0)); // cos(phi)
-  float sp = sinf(state(0)); // sin(phi)
-  float tt = tanf(state(1)); // tan(theta)
-
-  float p = angular_rates(0);
-  float q = angular_rates(1);
-  float r = angular_rates(2);
-
-  Eigen::Vector2f f;
-
-  f(0) = p + (q * sp + r * cp) * tt;
-  f(1) = q * cp - r * sp;
-
-  return f;
+  return position_history_[(position_history_head_ + position_history_capacity_ - age)
+                           % position_history_capacity_];
 }
 
-Eigen::VectorXf EstimatorContinuousDiscrete::position_dynamics(const Eigen::VectorXf & state,
-                                                               const Eigen::VectorXf & measurements)
+void EstimatorContinuousDiscrete::push_position_history(double stamp, float Ts,
+                                                        const Eigen::Vector<float, 6> & inputs)
 {
+  if (position_history_count_ > 0) {
+    position_history_head_ = (position_history_head_ + 1) % position_history_capacity_;
+  }
+  position_history_count_ = std::min(position_history_count_ + 1, position_history_capacity_);
+
+  PositionSnapshot & step = position_history_[position_history_head_];
+  step.stamp = stamp;
+  step.Ts = Ts;
+  step.inputs = inputs;
+  step.xhat = xhat_p_;
+  step.P = P_p_;
+  step.gps_new = false;
+}
 
-  double gravity = params_.get_double("gravity");
-
-  float Vg = state(2);
-  float chi = state(3);
-  float wn = state(4);
-  float we = state(5);
-  float psi = state(6);
-
-  float p = measurements(0);
-  float q = measurements(1);
-  float r = measurements(2);
-  float phi = measurements(3);
-  float theta = measurements(4);
-  float va = measurements(5);
-
-  float psidot = (q * sinf(phi) + r * cosf(phi)) / cosf(theta);
+void EstimatorContinuousDiscrete::propagate_position(const Eigen::Vector<float, 6> & inputs,
+                                                     float Ts, int num_propagation_steps)
+{
+  // For readability, declare the parameters here
+  double gravity = gravity_.get();
 
-  float Vgdot = va / Vg * psidot * (we * cosf(psi) - wn * sinf(psi));
+  if (fabsf(xhat_p_(2)) < 0.01f) {
+    xhat_p_(2) = 0.01; // prevent divide by zero
+  }
 
-  Eigen::VectorXf f;
-  f = Eigen::VectorXf::Zero(7);
+  if (position_ud_covariance_.get()) {
+    // The position filter has no input noise and a diagonal Q_p_, as the UD propagation needs.
+    if (!position_ud_valid_) {
+      PositionUD::factor(P_p_, U_p_, D_p_);
+      position_ud_valid_ = true;
+    }
 
-  f(0) = state(2) * cosf(state(3));
-  f(1) = state(2) * sinf(state(3));
-  f(2) = Vgdot;
-  f(3) = gravity / state(2) * tanf(phi) * cosf(chi - psi);
-  f(6) = psidot;
+    PositionUD::propagate(
+      xhat_p_, U_p_, D_p_, inputs,
+      [gravity](const auto & x, const auto & u) { return position_dynamics(x, u, gravity); },
+      [gravity](const auto & x, const auto & u) { return position_jacobian(x, u, gravity); },
+      Q_p_.diagonal().eval(), Ts, num_propagation_steps);
+    P_p_ = PositionUD::reconstruct(U_p_, D_p_);
+  } else {
+    // Only the first four rows of the position jacobian are nonzero: the wind and heading
+    // derivatives do not depend on the state.
+    PositionEKF::propagate_structured<4>(
+      xhat_p_, P_p_, inputs,
+      [gravity](const auto & x, const auto & u) { return position_dynamics(x, u, gravity); },
+      [gravity](const auto & x, const auto & u) { return position_jacobian(x, u, gravity); },
+      Q_p_.diagonal().eval(), Ts, num_propagation_steps);
+    position_ud_valid_ = false;
+  }
 
-  return f;
+  // Check wrapping of the heading and course.
+  xhat_p_(3) = wrap_within_180(0.0, xhat_p_(3));
+  xhat_p_(6) = wrap_within_180(0.0, xhat_p_(6));
 }
 
-Eigen::MatrixXf
-EstimatorContinuousDiscrete::attitude_jacobian(const Eigen::VectorXf & state,
-                                               const Eigen::VectorXf & angular_rates)
+MeasurementInnovation<6>
+EstimatorContinuousDiscrete::fuse_gps(const Eigen::Vector<float, 6> & y_pos, float vahat,
+                                      float gate_threshold)
 {
-  float cp = cosf(state(0)); // cos(phi)
-  float sp = sinf(state(0)); // sin(phi)
-  float tt = tanf(state(1)); // tan(theta)
-  float ct = cosf(state(1)); // cos(theta)
-
-  float q = angular_rates(1);
-  float r = angular_rates(2);
+  // For readability, declare the parameters here
+  bool sequential_update = gps_sequential_update_.get();
+  bool joseph_form = sequential_update_joseph_form_.get();
 
-  Eigen::Matrix2f A = Eigen::Matrix2f::Zero();
-  A(0, 0) = (q * cp - r * sp) * tt;
-  A(0, 1) = (q * sp + r * cp) / ct / ct;
-  A(1, 0) = -q * sp - r * cp;
+  Eigen::Vector<float, 1> pos_curr_state_info;
+  pos_curr_state_info << vahat;
 
-  return A;
-}
+  // Wrap the course measurement to be near the current course estimate.
+  Eigen::Vector<float, 6> y = y_pos;
+  y(3) = wrap_within_180(xhat_p_(3), y(3));
 
-Eigen::MatrixXf EstimatorContinuousDiscrete::position_jacobian(const Eigen::VectorXf & state,
-                                                               const Eigen::VectorXf & measurements)
-{
-  double gravity = params_.get_double("gravity");
-
-  float p = measurements(0);
-  float q = measurements(1);
-  float r = measurements(2);
-  float phi = measurements(3);
-  float theta = measurements(4);
-  float va = measurements(5);
-
-  float Vg = state(2);
-  float chi = state(3);
-  float wn = state(4);
-  float we = state(5);
-  float psi = state(6);
-
-  float psidot = (q * sinf(phi) + r * cosf(phi)) / cosf(theta);
-
-  float tmp = -psidot * va * (state(4) * cosf(state(6)) + state(5) * sinf(state(6))) / state(2);
-
-  float Vgdot = va / Vg * psidot * (wn * cosf(psi) - we * sinf(psi));
-
-  Eigen::MatrixXf A;
-  A = Eigen::MatrixXf::Zero(7, 7);
-  A(0, 2) = cos(state(3));
-  A(0, 3) = -state(2) * sinf(state(3));
-  A(1, 2) = sin(state(3));
-  A(1, 3) = state(2) * cosf(state(3));
-  A(2, 2) = -Vgdot / state(2);
-  A(2, 4) = -psidot * va * sinf(state(6)) / state(2);
-  A(2, 5) = psidot * va * cosf(state(6)) / state(2);
-  A(2, 6) = tmp;
-  A(3, 2) = -gravity / powf(state(2), 2) * tanf(phihat_);
-
-  return A;
-}
+  // The UD factors are updated one scalar measurement at a time, which R_p_ being diagonal allows.
+  if (position_ud_covariance_.get()) {
+    if (!position_ud_valid_) {
+      PositionUD::factor(P_p_, U_p_, D_p_);
+      position_ud_valid_ = true;
+    }
 
-Eigen::MatrixXf EstimatorContinuousDiscrete::attitude_input_jacobian(const Eigen::VectorXf & state,
-                                                                     const Eigen::VectorXf & inputs)
-{
-  float cp = cosf(state(0)); // cos(phi)
-  float sp = sinf(state(0)); // sin(phi)
-  float tt = tanf(state(1)); // tan(theta)
+    MeasurementInnovation<6> innovation = PositionUD::sequential_measurement_update(
+      xhat_p_, U_p_, D_p_, pos_curr_state_info,
+      [](const auto & x, const auto & u) { return position_measurement_prediction(x, u); },
+      [](const auto & x, const auto & u) { return position_measurement_jacobian(x, u); }, y,
+      R_p_.diagonal().eval(), gate_threshold);
+    P_p_ = PositionUD::reconstruct(U_p_, D_p_);
+    return innovation;
+  }
 
-  Eigen::Matrix<float, 2, 3> G;
-  G << 1, sp * tt, cp * tt, 0.0, cp, -sp;
+  // R_p_ is diagonal, so the measurements can be fused one at a time without inverting S.
+  if (sequential_update) {
+    return PositionEKF::sequential_measurement_update(
+      xhat_p_, P_p_, pos_curr_state_info,
+      [](const auto & x, const auto & u) { return position_measurement_prediction(x, u); },
+      [](const auto & x, const auto & u) { return position_measurement_jacobian(x, u); }, y,
+      R_p_.diagonal().eval(), gate_threshold, joseph_form);
+  }
 
-  return G;
+  return PositionEKF::measurement_update(
+    xhat_p_, P_p_, pos_curr_state_info,
+    [](const auto & x, const auto & u) { return position_measurement_prediction(x, u); },
+    [](const auto & x, const auto & u) { return position_measurement_jacobian(x, u); }, y,
+    R_p_, gate_threshold);
 }
 
-Eigen::MatrixXf EstimatorContinuousDiscrete::position_input_jacobian(const Eigen::VectorXf & state,
-                                                                     const Eigen::VectorXf & inputs)
+float EstimatorContinuousDiscrete::gate_for(float gate_threshold, int consecutive_rejections)
 {
-
-  Eigen::MatrixXf G;
-  G = Eigen::MatrixXf::Zero(7, 7);
-
-  return G;
+  if (consecutive_rejections >= gate_max_consecutive_rejections_.get()) {
+    return 0.0f;
+  }
+  return gate_threshold;
 }
 
-Eigen::VectorXf
-EstimatorContinuousDiscrete::attitude_measurement_prediction(const Eigen::VectorXf & state,
-                                                             const Eigen::VectorXf & inputs)
+void EstimatorContinuousDiscrete::record_gps_innovation(const MeasurementInnovation<6> & innovation)
 {
-  double gravity = params_.get_double("gravity");
-  float cp = cosf(state(0)); // cos(phi)
-  float sp = sinf(state(0)); // sin(phi)
-  float st = sinf(state(1)); // sin(theta)
-  float ct = cosf(state(1)); // cos(theta)
-
-  float p = inputs(0);
-  float q = inputs(1);
-  float r = inputs(2);
-  float va = inputs(3);
-
-  Eigen::Vector3f h;
-  h = Eigen::Vector3f::Zero(3);
-  h(0) = q * va * st + gravity * st;
-  h(1) = r * va * ct - p * va * st - gravity * ct * sp;
-  h(2) = -q * va * ct - gravity * ct * cp;
-
-  return h;
+  for (int i = 0; i < 6; i++) {
+    innovations_.gps_innovation[i] = innovation.residual(i);
+  }
+  innovations_.gps_nis = innovation.nis;
+  innovations_.gps_accepted = innovation.accepted;
+  if (innovation.accepted) {
+    gps_consecutive_rejections_ = 0;
+  } else {
+    gps_consecutive_rejections_++;
+    innovations_.gps_rejections++;
+    RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 5000,
+                         "GPS measurement rejected by the innovation gate (NIS %.1f).",
+                         innovation.nis);
+  }
 }
 
-Eigen::VectorXf
-EstimatorContinuousDiscrete::position_measurement_prediction(const Eigen::VectorXf & state,
-                                                             const Eigen::VectorXf & input)
+void EstimatorContinuousDiscrete::fuse_delayed_gps(const Eigen::Vector<float, 6> & y_pos,
+                                                   float vahat, double gps_stamp,
+                                                   int num_propagation_steps)
 {
-  float va = input(0);
-
-  Eigen::VectorXf h = Eigen::VectorXf::Zero(6);
-
-  // GPS north
-  h(0) = state(0);
-
-  // GPS east
-  h(1) = state(1);
-
-  // GPS ground speed
-  h(2) = state(2);
+  // For readability, declare the parameters here
+  double replay_budget = gps_replay_budget_.get();
+
+  // Find the oldest step that ends at or after the measurement. The step before it is where the
+  // filter is rewound to.
+  std::size_t age = 0;
+  bool fuse_now = gps_stamp >= position_history_at(0).stamp || position_history_count_ < 2;
+  if (!fuse_now) {
+    while (age + 1 < position_history_count_ && position_history_at(age + 1).stamp >= gps_stamp) {
+      age++;
+    }
 
-  // GPS course
-  h(3) = state(3);
+    if (age + 1 >= position_history_count_) {
+      gps_too_old_count_++;
+      fuse_now = true;
+    } else if ((age + 1) * gps_replay_step_cost_ > replay_budget) {
+      gps_over_budget_count_++;
+      fuse_now = true;
+    }
+  }
 
-  // Pseudo Measurement north
-  h(4) = va * cosf(state(6)) + state(4) - state(2) * cosf(state(3));
+  if (fuse_now) {
+    PositionSnapshot & newest = position_history_at(0);
+    if (gps_step_taken(newest)) {
+      return;
+    }
+    newest.gps_new = true;
+    newest.gps_offset = newest.Ts;
+    newest.y_gps = y_pos;
+    newest.gps_vahat = vahat;
+    newest.gps_gate_threshold = gate_for(gps_gate_threshold_.get(), gps_consecutive_rejections_);
+    newest.gps_innovation = fuse_gps(y_pos, vahat, newest.gps_gate_threshold);
+    record_gps_innovation(newest.gps_innovation);
+    return;
+  }
 
-  // Pseudo Measurement east
-  h(5) = va * sinf(state(6)) + state(5) - state(2) * sinf(state(3));
+  PositionSnapshot & step = position_history_at(age);
+  if (gps_step_taken(step)) {
+    return;
+  }
 
-  // To add a new measurement, simply use the state and any input you need as another entry to h. Be sure to update the measurement jacobian C.
+  step.gps_new = true;
+  step.gps_offset =
+    std::clamp(static_cast<float>(gps_stamp - (step.stamp - step.Ts)), 0.0f, step.Ts);
+  step.y_gps = y_pos;
+  step.gps_vahat = vahat;
+  step.gps_gate_threshold = gate_for(gps_gate_threshold_.get(), gps_consecutive_rejections_);
+
+  auto replay_start = std::chrono::steady_clock::now();
+
+  // Rewind to the end of the step before the measurement and replay every step since.
+  xhat_p_ = position_history_at(age + 1).xhat;
+  P_p_ = position_history_at(age + 1).P;
+  position_ud_valid_ = false;
+  for (std::size_t i = age + 1; i-- > 0;) {
+    replay_position_step(position_history_at(i), num_propagation_steps);
+  }
 
-  return h;
+  std::chrono::duration<double> replay_time = std::chrono::steady_clock::now() - replay_start;
+  record_gps_innovation(position_history_at(age).gps_innovation);
+  gps_replay_count_++;
+  gps_replay_time_last_ = replay_time.count();
+  gps_replay_time_max_ = std::max(gps_replay_time_max_, gps_replay_time_last_);
+
+  // Track the cost of a step so that replays that would not fit in the budget can be skipped.
+  double step_cost = gps_replay_time_last_ / (age + 1);
+  gps_replay_step_cost_ =
+    gps_replay_step_cost_ == 0.0 ? step_cost : 0.9 * gps_replay_step_cost_ + 0.1 * step_cost;
+
+  if (gps_replay_time_last_ > replay_budget) {
+    RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 5000,
+                         "GPS re-propagation over %lu steps took %.2f ms, over the budget.",
+                         static_cast<unsigned long>(age + 1), gps_replay_time_last_ * 1000.0);
+  }
 }
 
-Eigen::MatrixXf
-EstimatorContinuousDiscrete::position_measurement_jacobian(const Eigen::VectorXf & state,
-                                                           const Eigen::VectorXf & input)
+bool EstimatorContinuousDiscrete::gps_step_taken(const PositionSnapshot & step)
 {
-  float va = input(0);
-
-  Eigen::MatrixXf C = Eigen::MatrixXf::Zero(6, 7);
+  if (!step.gps_new) {
+    return false;
+  }
 
-  // GPS north
-  C(0, 0) = 1;
+  gps_dropped_count_++;
+  RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 5000,
+                       "GPS measurement dropped, its position step already holds one (%ld so far).",
+                       static_cast<long>(gps_dropped_count_));
+  return true;
+}
 
-  // GPS east
-  C(1, 1) = 1;
+void EstimatorContinuousDiscrete::replay_position_step(PositionSnapshot & step,
+                                                       int num_propagation_steps)
+{
+  if (step.gps_new) {
+    if (step.gps_offset > 0.0f) {
+      propagate_position(step.inputs, step.gps_offset, num_propagation_steps);
+    }
+    step.gps_innovation = fuse_gps(step.y_gps, step.gps_vahat, step.gps_gate_threshold);
+    if (step.Ts - step.gps_offset > 0.0f) {
+      propagate_position(step.inputs, step.Ts - step.gps_offset, num_propagation_steps);
+    }
+  } else {
+    propagate_position(step.inputs, step.Ts, num_propagation_steps);
+  }
 
-  // GPS ground speed
-  C(2, 2) = 1;
+  step.xhat = xhat_p_;
+  step.P = P_p_;
+}
 
-  // GPS course
-  C(3, 3) = 1;
+float EstimatorContinuousDiscrete::step_vertical(const Input & input, float Ts)
+{
+  // For readability, declare the parameters here
+  double rho = rho_.get();
+  double gravity = gravity_.get();
+  float vertical_accel_noise = vertical_accel_noise_.get();
+  float baro_bias_random_walk = baro_bias_random_walk_.get();
+  float sigma_baro_alt = sigma_baro_alt_.get();
+  float sigma_gps_alt = sigma_gps_alt_.get();
+  float sigma_gps_vd = sigma_gps_vd_.get();
+  bool joseph_form = sequential_update_joseph_form_.get();
+
+  // Hold the channel at its initial state until the barometer is calibrated, which is when the
+  // altitude has a reference. Until then the altitude is reported as zero, as without the channel.
+  if (!baro_init_) {
+    xhat_v_.setZero();
+    initialize_vertical_covariance();
+    return 0.0f;
+  }
 
-  // Pseudo Measurement north
-  C(4, 2) = -cos(state(3));
-  C(4, 3) = state(2) * sinf(state(3));
-  C(4, 4) = 1;
-  C(4, 6) = -va * sinf(state(6));
+  // Rotate the bias-corrected specific force into the down axis with the roll and pitch estimates.
+  // Adding gravity gives the down acceleration, the negative of the input to the climb rate.
+  float sp = sinf(phihat_);
+  float cp = cosf(phihat_);
+  float st = sinf(thetahat_);
+  float ct = cosf(thetahat_);
+  float accel_x = input.accel_x - accel_bias_(0);
+  float accel_y = input.accel_y - accel_bias_(1);
+  float accel_z = input.accel_z - accel_bias_(2);
+  float accel_down = -st * accel_x + sp * ct * accel_y + cp * ct * accel_z + gravity;
+
+  // h and h_dot are a double integrator of the up acceleration, the baro bias is a random walk.
+  Eigen::Vector3f Q_diagonal(0.0f, 0.0f, baro_bias_random_walk * baro_bias_random_walk / Ts);
+  Eigen::Vector<float, 1> Q_g_diagonal(vertical_accel_noise * vertical_accel_noise);
+  Eigen::Vector<float, 1> up_accel(-accel_down);
+
+  VerticalEKF::propagate_structured<2, 1>(
+    xhat_v_, P_v_, up_accel,
+    [](const Eigen::Vector3f & x, const Eigen::Vector<float, 1> & u) {
+      return Eigen::Vector3f(x(1), u(0), 0.0f);
+    },
+    [](const Eigen::Vector3f &, const Eigen::Vector<float, 1> &) {
+      Eigen::Matrix3f A = Eigen::Matrix3f::Zero();
+      A(0, 1) = 1.0f;
+      return A;
+    },
+    [](const Eigen::Vector3f &, const Eigen::Vector<float, 1> &) {
+      return Eigen::Vector2f(0.0f, 1.0f);
+    },
+    Q_diagonal, Q_g_diagonal, Ts, 1);
+
+  // The calibrated static pressure measures the altitude above the arming point plus a slowly
+  // drifting bias.
+  if (input.baro_new && input.static_pres != 0.0) {
+    float baro_alt = input.static_pres / rho / gravity;
+    VerticalEKF::single_measurement_update(
+      xhat_v_, P_v_, baro_alt, xhat_v_(0) + xhat_v_(2), sigma_baro_alt * sigma_baro_alt,
+      Eigen::Vector3f(1.0f, 0.0f, 1.0f), 0.0f, joseph_form);
+  }
 
-  // Pseudo Measurement east
-  C(5, 2) = -sin(state(3));
-  C(5, 3) = -state(2) * cosf(state(3));
-  C(5, 5) = 1;
-  C(5, 6) = va * cosf(state(6));
+  // The GNSS altitude is relative to the first fix and has no bias. It is fused on arrival rather
+  // than at its measurement time, the vertical errors from the latency being well under its noise.
+  if (input.gps_new) {
+    VerticalEKF::single_measurement_update(xhat_v_, P_v_, input.gps_h, xhat_v_(0),
+                                           sigma_gps_alt * sigma_gps_alt,
+                                           Eigen::Vector3f(1.0f, 0.0f, 0.0f), 0.0f, joseph_form);
+    VerticalEKF::single_measurement_update(xhat_v_, P_v_, -input.gps_vd, xhat_v_(1),
+                                           sigma_gps_vd * sigma_gps_vd,
+                                           Eigen::Vector3f(0.0f, 1.0f, 0.0f), 0.0f, joseph_form);
+  }
 
-  // To add a new measurement use the inputs and the state to add another row to the matrix C. Be sure to update the measurment prediction vector h.
+  if (!xhat_v_.allFinite()) {
+    xhat_v_.setZero();
+    initialize_vertical_covariance();
+    reinitializations_++;
+    RCLCPP_WARN(this->get_logger(), "vertical estimator reinitialized due to non-finite state");
+  }
 
-  return C;
+  return xhat_v_(0);
 }
 
-Eigen::MatrixXf
-EstimatorContinuousDiscrete::attitude_measurement_jacobian(const Eigen::VectorXf & state,
-                                                           const Eigen::VectorXf & inputs)
+void EstimatorContinuousDiscrete::update_gyro_bias(const Input & input, float Ts)
 {
-  double gravity = params_.get_double("gravity");
-  float cp = cosf(state(0));
-  float sp = sinf(state(0));
-  float ct = cosf(state(1));
-  float st = sinf(state(1));
+  // For readability, declare the parameters here
+  double rho = rho_.get();
+  double gravity = gravity_.get();
+  float gyro_bias_random_walk = gyro_bias_random_walk_.get();
+  float stationary_gyro_threshold = stationary_gyro_threshold_.get();
+  float stationary_accel_threshold = stationary_accel_threshold_.get();
+  float stationary_speed_threshold = stationary_speed_threshold_.get();
+  float sigma_gyro = radians(gyro_process_noise_.get());
+
+  Eigen::Vector3f gyro(input.gyro_x, input.gyro_y, input.gyro_z);
+  Eigen::Vector3f accel(input.accel_x, input.accel_y, input.accel_z);
+
+  gyro_bias_var_.array() += gyro_bias_random_walk * gyro_bias_random_walk * Ts;
+
+  // Stationary means no rotation, a specific force of one g and no air or ground speed. Steady
+  // level flight passes the first two checks, so the speeds are what rule it out.
+  float va = sqrtf(2.0 / rho * std::max(input.diff_pres, 0.0f));
+  bool stationary = (gyro - gyro_bias_).norm() < stationary_gyro_threshold
+    && fabsf(accel.norm() - gravity) < stationary_accel_threshold
+    && va < stationary_speed_threshold && input.gps_Vg < stationary_speed_threshold;
+
+  if (stationary) {
+    // While stationary the gyros measure their bias directly, so each axis is a scalar update.
+    Eigen::Vector3f gain =
+      gyro_bias_var_.array() / (gyro_bias_var_.array() + sigma_gyro * sigma_gyro);
+    gyro_bias_ += gain.cwiseProduct(gyro - gyro_bias_);
+    gyro_bias_var_ = (1.0f - gain.array()) * gyro_bias_var_.array();
+  }
 
-  float p = inputs(0);
-  float q = inputs(1);
-  float r = inputs(2);
-  float va = inputs(3);
+  persist_imu_biases(gyro_bias_, gyro_bias_var_, accel_bias_, Eigen::Vector3f::Constant(INFINITY));
+}
 
-  Eigen::Matrix<float, 3, 2> C;
+void EstimatorContinuousDiscrete::fill_diagnostics(
+  rosplane_msgs::msg::EstimatorDiagnostics & diagnostics)
+{
+  diagnostics.covariance_diagonal.resize(12);
+  Eigen::Map<Eigen::Vector<float, 12>> covariance(diagnostics.covariance_diagonal.data());
+  covariance << P_a_.diagonal(), P_p_.diagonal(), P_v_.diagonal();
 
-  C << 0.0, q * va * ct + gravity * ct, -gravity * cp * ct,
-    -r * va * st - p * va * ct + gravity * sp * st, gravity * sp * ct, (q * va + gravity * cp) * st;
+  diagnostics.reinitializations = reinitializations_;
+  diagnostics.innovations = innovations_;
+}
 
-  return C;
+bool EstimatorContinuousDiscrete::fill_innovations(
+  rosplane_msgs::msg::EstimatorInnovations & innovations)
+{
+  innovations = innovations_;
+  return true;
 }
 
 void EstimatorContinuousDiscrete::check_xhat_a()
 {
-  double max_phi = params_.get_double("max_estimated_phi");
-  double max_theta = params_.get_double("max_estimated_theta");
-  double buff = params_.get_double("estimator_max_buffer");
+  double max_phi = max_estimated_phi_.get();
+  double max_theta = max_estimated_theta_.get();
+  double buff = estimator_max_buffer_.get();
 
   if (xhat_a_(0) > radians(85.0) || xhat_a_(0) < radians(-85.0) || !std::isfinite(xhat_a_(0))) {
 
@@ -618,6 +832,7 @@ void EstimatorContinuousDiscrete::check_xhat_a()
       xhat_a_(0) = 0;
       P_a_ = Eigen::Matrix2f::Identity();
       P_a_ *= powf(radians(20.0f), 2);
+      reinitializations_++;
       RCLCPP_WARN(this->get_logger(), "attiude estimator reinitialized due to non-finite roll");
     } else if (xhat_a_(0) > radians(max_phi)) {
       xhat_a_(0) = radians(max_phi - buff);
@@ -632,6 +847,7 @@ void EstimatorContinuousDiscrete::check_xhat_a()
     xhat_a_(1) = 0;
     P_a_ = Eigen::Matrix2f::Identity();
     P_a_ *= powf(radians(20.0f), 2);
+    reinitializations_++;
     RCLCPP_WARN(this->get_logger(), "attiude estimator reinitialized due to non-finite pitch");
   } else if (xhat_a_(1) > radians(max_theta)) {
     xhat_a_(1) = radians(max_theta - buff);
@@ -671,42 +887,88 @@ void EstimatorContinuousDiscrete::declare_parameters()
   params_.declare_double("wind_e_initial_cov", 0.04);
   params_.declare_double("psi_initial_cov", 5.0); // Deg
 
+  // Vertical channel. With it off, the default, the altitude is the low pass filtered barometer.
+  params_.declare_bool("vertical_channel", false);
+  params_.declare_double("vertical_accel_noise", 0.2);   // m/s^2
+  params_.declare_double("baro_bias_random_walk", 0.01); // m/sqrt(s)
+  params_.declare_double("sigma_baro_alt", 0.5);         // m
+  params_.declare_double("sigma_gps_alt", 1.5);          // m
+  params_.declare_double("sigma_gps_vd", 0.1);           // m/s
+  params_.declare_double("h_initial_cov", 1.0);
+  params_.declare_double("h_dot_initial_cov", 0.1);
+  params_.declare_double("baro_bias_initial_cov", 4.0);
+
+  // Gyro bias estimation. The bias is measured while the aircraft is stationary and held in flight.
+  // Off by default, so the gyros are used as before unless it is turned on.
+  params_.declare_bool("gyro_bias_estimation", false);
+  params_.declare_double("gyro_bias_random_walk", 1e-4);      // rad/s/sqrt(s)
+  params_.declare_double("gyro_bias_initial_cov", 1e-4);      // rad^2/s^2
+  params_.declare_double("stationary_gyro_threshold", 0.05);  // rad/s
+  params_.declare_double("stationary_accel_threshold", 0.5);  // m/s^2
+  params_.declare_double("stationary_speed_threshold", 2.0);  // m/s
+
+  // Integration steps per attitude and per position step. num_propagation_steps set both before
+  // they were split, so it stays as the default of each and existing overrides keep working.
   params_.declare_int("num_propagation_steps", 10);
+  int64_t num_propagation_steps = this->get_parameter("num_propagation_steps").as_int();
+  params_.declare_int("attitude_propagation_steps", num_propagation_steps);
+  params_.declare_int("position_propagation_steps", num_propagation_steps);
+  // Rate of the position filter (Hz). It runs on the estimator step closest to each period and on
+  // every GPS measurement. Zero runs it on every estimator step, in lockstep with the attitude.
+  params_.declare_double("position_update_frequency", 0.0);
+  params_.declare_double("gps_replay_budget", 0.010); // Max time to re-propagate a late fix (s)
+
+  // Chi-squared innovation gates on the NIS, zero disables a gate. They are off by default, as for
+  // the INS, because the default sigmas above are far below real sensor noise and would fail
+  // almost every measurement. With R tuned to the sensors, chi2(q = .001) is 16.27 for the three
+  // accelerometer axes and 22.46 for the six GPS measurements.
+  params_.declare_double("accel_gate_threshold", 0.0);
+  params_.declare_double("gps_gate_threshold", 0.0);
+  params_.declare_int("gate_max_consecutive_rejections", 5);
+
+  params_.declare_bool("gps_sequential_update", true); // Fuse GPS as scalar updates
+  params_.declare_bool("sequential_update_joseph_form", true);
+  params_.declare_bool("position_ud_covariance", false); // Keep the position P as UD factors
 
   params_.declare_double("max_estimated_phi", 85.0);   // Deg
   params_.declare_double("max_estimated_theta", 80.0); // Deg
   params_.declare_double("estimator_max_buffer", 3.0); // Deg
 }
 
-void EstimatorContinuousDiscrete::bind_functions()
+void EstimatorContinuousDiscrete::bind_parameters()
 {
-  // This creates references to the functions that are necessary estimate. This means we can pass them to the EKF class's functions.
-  // std::bind creates a forwarding reference to a function. So when we pass the binding object to another method, that method can call the
-  // original function.
-  attitude_dynamics_model = std::bind(&EstimatorContinuousDiscrete::attitude_dynamics, this,
-                                      std::placeholders::_1, std::placeholders::_2);
-  attitude_jacobian_model = std::bind(&EstimatorContinuousDiscrete::attitude_jacobian, this,
-                                      std::placeholders::_1, std::placeholders::_2);
-  attitude_input_jacobian_model = std::bind(&EstimatorContinuousDiscrete::attitude_input_jacobian,
-                                            this, std::placeholders::_1, std::placeholders::_2);
-  attitude_measurement_model =
-    std::bind(&EstimatorContinuousDiscrete::attitude_measurement_prediction, this,
-              std::placeholders::_1, std::placeholders::_2);
-  attitude_measurement_jacobian_model =
-    std::bind(&EstimatorContinuousDiscrete::attitude_measurement_jacobian, this,
-              std::placeholders::_1, std::placeholders::_2);
-  position_dynamics_model = std::bind(&EstimatorContinuousDiscrete::position_dynamics, this,
-                                      std::placeholders::_1, std::placeholders::_2);
-  position_jacobian_model = std::bind(&EstimatorContinuousDiscrete::position_jacobian, this,
-                                      std::placeholders::_1, std::placeholders::_2);
-  position_input_jacobian_model = std::bind(&EstimatorContinuousDiscrete::position_input_jacobian,
-                                            this, std::placeholders::_1, std::placeholders::_2);
-  position_measurement_model =
-    std::bind(&EstimatorContinuousDiscrete::position_measurement_prediction, this,
-              std::placeholders::_1, std::placeholders::_2);
-  position_measurement_jacobian_model =
-    std::bind(&EstimatorContinuousDiscrete::position_measurement_jacobian, this,
-              std::placeholders::_1, std::placeholders::_2);
+  gps_n_lim_ = params_.get_double_handle("gps_n_lim");
+  gps_e_lim_ = params_.get_double_handle("gps_e_lim");
+  attitude_propagation_steps_ = params_.get_int_handle("attitude_propagation_steps");
+  position_propagation_steps_ = params_.get_int_handle("position_propagation_steps");
+  position_update_frequency_ = params_.get_double_handle("position_update_frequency");
+  max_estimated_phi_ = params_.get_double_handle("max_estimated_phi");
+  max_estimated_theta_ = params_.get_double_handle("max_estimated_theta");
+  estimator_max_buffer_ = params_.get_double_handle("estimator_max_buffer");
+  lpf_a_ = params_.get_double_handle("lpf_a");
+  lpf_a1_ = params_.get_double_handle("lpf_a1");
+  gps_replay_budget_ = params_.get_double_handle("gps_replay_budget");
+  accel_gate_threshold_ = params_.get_double_handle("accel_gate_threshold");
+  gps_gate_threshold_ = params_.get_double_handle("gps_gate_threshold");
+  gate_max_consecutive_rejections_ = params_.get_int_handle("gate_max_consecutive_rejections");
+  gps_sequential_update_ = params_.get_bool_handle("gps_sequential_update");
+  sequential_update_joseph_form_ = params_.get_bool_handle("sequential_update_joseph_form");
+  position_ud_covariance_ = params_.get_bool_handle("position_ud_covariance");
+  vertical_channel_ = params_.get_bool_handle("vertical_channel");
+  vertical_accel_noise_ = params_.get_double_handle("vertical_accel_noise");
+  baro_bias_random_walk_ = params_.get_double_handle("baro_bias_random_walk");
+  sigma_baro_alt_ = params_.get_double_handle("sigma_baro_alt");
+  sigma_gps_alt_ = params_.get_double_handle("sigma_gps_alt");
+  sigma_gps_vd_ = params_.get_double_handle("sigma_gps_vd");
+  gyro_bias_estimation_ = params_.get_bool_handle("gyro_bias_estimation");
+  gyro_bias_random_walk_ = params_.get_double_handle("gyro_bias_random_walk");
+  stationary_gyro_threshold_ = params_.get_double_handle("stationary_gyro_threshold");
+  stationary_accel_threshold_ = params_.get_double_handle("stationary_accel_threshold");
+  stationary_speed_threshold_ = params_.get_double_handle("stationary_speed_threshold");
+  gyro_process_noise_ = params_.get_double_handle("gyro_process_noise");
 }
 
 } // namespace rosplane
+
+#include <rclcpp_components/register_node_macro.hpp>
+RCLCPP_COMPONENTS_REGISTER_NODE(rosplane::EstimatorContinuousDiscrete)
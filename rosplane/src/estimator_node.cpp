@@ -0,0 +1,52 @@
+#include <cstring>
+
+#include "estimator_continuous_discrete.hpp"
+#include "estimator_quaternion_ins.hpp"
+
+/**
+ * Usage: rosplane_estimator_node [seed_estimator] [estimator_type]
+ *
+ * seed_estimator is "true" or "false" (the default), and sets the seed_estimator parameter.
+ * estimator_type is "continuous_discrete" (the default) or "quaternion_ins".
+ *
+ * The estimators are also registered as components, rosplane::EstimatorContinuousDiscrete and
+ * rosplane::EstimatorQuaternionINS, to run in a component container with the rest of the autopilot.
+ */
+int main(int argc, char ** argv)
+{
+
+  rclcpp::init(argc, argv);
+
+  const char * use_params = "false";
+  if (argc >= 2) {
+    use_params = argv[1];
+  }
+
+  const char * estimator_type = "continuous_discrete";
+  if (argc >= 3) {
+    estimator_type = argv[2];
+  }
+
+  rclcpp::NodeOptions options;
+  options.append_parameter_override("seed_estimator", !strcmp(use_params, "true"));
+
+  std::shared_ptr<rosplane::EstimatorROS> estimator_node;
+  if (!strcmp(estimator_type, "quaternion_ins")) {
+    estimator_node = std::make_shared<rosplane::EstimatorQuaternionINS>(options);
+  } else {
+    estimator_node = std::make_shared<rosplane::EstimatorContinuousDiscrete>(options);
+    if (strcmp(estimator_type, "continuous_discrete")) {
+      RCLCPP_WARN(estimator_node->get_logger(),
+                  "Unknown estimator type %s, defaulting to continuous_discrete.", estimator_type);
+    }
+  }
+
+  if (strcmp(use_params, "true") && strcmp(use_params, "false")) {
+    RCLCPP_WARN(estimator_node->get_logger(),
+                "Invalid option for seeding estimator, defaulting to unseeded.");
+  }
+
+  rclcpp::spin(estimator_node);
+
+  return 0;
+}
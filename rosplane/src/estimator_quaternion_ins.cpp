@@ -0,0 +1,480 @@
+#include <algorithm>
+#include <cmath>
+
+#include "estimator_quaternion_ins.hpp"
+
+namespace rosplane
+{
+
+namespace
+{
+
+constexpr float deg_to_rad = M_PI / 180.0;
+
+/**
+ * Skew symmetric matrix of v, so that skew(v) * u is the cross product of v and u.
+ */
+Eigen::Matrix3f skew(const Eigen::Vector3f & v)
+{
+  Eigen::Matrix3f S;
+  S << 0.0f, -v(2), v(1), v(2), 0.0f, -v(0), -v(1), v(0), 0.0f;
+  return S;
+}
+
+/**
+ * The rotation by a rotation vector, as a quaternion.
+ */
+Eigen::Quaternionf rotation_vector_to_quaternion(const Eigen::Vector3f & theta)
+{
+  float angle = theta.norm();
+  if (angle < 1e-6f) {
+    // First order, to avoid dividing by the angle.
+    return Eigen::Quaternionf(1.0f, theta(0) / 2.0f, theta(1) / 2.0f, theta(2) / 2.0f).normalized();
+  }
+  return Eigen::Quaternionf(Eigen::AngleAxisf(angle, theta / angle));
+}
+
+Eigen::Quaternionf euler_to_quaternion(float phi, float theta, float psi)
+{
+  return Eigen::Quaternionf(Eigen::AngleAxisf(psi, Eigen::Vector3f::UnitZ())
+                            * Eigen::AngleAxisf(theta, Eigen::Vector3f::UnitY())
+                            * Eigen::AngleAxisf(phi, Eigen::Vector3f::UnitX()));
+}
+
+/**
+ * Roll, pitch and yaw of a body to NED rotation.
+ */
+Eigen::Vector3f quaternion_to_euler(const Eigen::Quaternionf & q)
+{
+  const Eigen::Matrix3f R = q.toRotationMatrix();
+  return Eigen::Vector3f(atan2f(R(2, 1), R(2, 2)), -asinf(std::clamp(R(2, 0), -1.0f, 1.0f)),
+                         atan2f(R(1, 0), R(0, 0)));
+}
+
+} // namespace
+
+EstimatorQuaternionINS::EstimatorQuaternionINS(const rclcpp::NodeOptions & options)
+    : EstimatorEKF(options)
+    , position_(Eigen::Vector3f::Zero())
+    , velocity_(Eigen::Vector3f::Zero())
+    , attitude_(Eigen::Quaternionf::Identity())
+    , gyro_bias_(Eigen::Vector3f::Zero())
+    , accel_bias_(Eigen::Vector3f::Zero())
+    , wind_(Eigen::Vector2f::Zero())
+    , P_(ErrorEKF::StateMatrix::Identity())
+    , initialized_(false)
+    , heading_aligned_(false)
+    , reinitializations_(0)
+{
+  // Declare and set parameters with the ROS2 system
+  declare_parameters();
+  params_.set_parameters();
+  bind_parameters();
+
+  if (params_.get_bool("seed_estimator")) {
+    seed_from_parameters();
+  }
+}
+
+void EstimatorQuaternionINS::initialize(const Input & input)
+{
+  // Level the attitude from the specific force, which at rest points up: (0, 0, -g) when level.
+  float phi = atan2f(-input.accel_y, -input.accel_z);
+  float theta = atan2f(input.accel_x, sqrtf(input.accel_y * input.accel_y
+                                            + input.accel_z * input.accel_z));
+
+  position_ << input.gps_n, input.gps_e, -input.gps_h;
+  velocity_.setZero();
+  attitude_ = euler_to_quaternion(phi, theta, 0.0f);
+  gyro_bias_ = gyro_bias_seed_;
+  accel_bias_ = accel_bias_seed_;
+  wind_.setZero();
+
+  initialize_covariance();
+
+  initialized_ = true;
+  heading_aligned_ = false;
+}
+
+void EstimatorQuaternionINS::initialize_covariance()
+{
+  double position_initial_cov = params_.get_double("ins_position_initial_cov");
+  double velocity_initial_cov = params_.get_double("ins_velocity_initial_cov");
+  double attitude_initial_cov = params_.get_double("ins_attitude_initial_cov");
+  double gyro_bias_initial_cov = params_.get_double("ins_gyro_bias_initial_cov");
+  double accel_bias_initial_cov = params_.get_double("ins_accel_bias_initial_cov");
+  double wind_initial_cov = params_.get_double("ins_wind_initial_cov");
+
+  ErrorEKF::StateVector P_diagonal;
+  P_diagonal.segment<3>(position_index_).setConstant(position_initial_cov);
+  P_diagonal.segment<3>(velocity_index_).setConstant(velocity_initial_cov);
+  P_diagonal.segment<3>(attitude_index_).setConstant(powf(attitude_initial_cov * deg_to_rad, 2));
+  P_diagonal.segment<3>(gyro_bias_index_).setConstant(gyro_bias_initial_cov);
+  P_diagonal.segment<3>(accel_bias_index_).setConstant(accel_bias_initial_cov);
+  P_diagonal.segment<2>(wind_index_).setConstant(wind_initial_cov);
+
+  P_ = P_diagonal.asDiagonal();
+}
+
+void EstimatorQuaternionINS::estimate(const Input & input, Output & output)
+{
+  // For readability, declare the parameters here
+  double ground_speed_threshold = ground_speed_threshold_.get();
+
+  if (!initialized_) {
+    initialize(input);
+  }
+
+  // Bias-corrected IMU measurements.
+  Eigen::Vector3f angular_rate =
+    Eigen::Vector3f(input.gyro_x, input.gyro_y, input.gyro_z) - gyro_bias_;
+  Eigen::Vector3f specific_force =
+    Eigen::Vector3f(input.accel_x, input.accel_y, input.accel_z) - accel_bias_;
+
+  propagate(angular_rate, specific_force, input.Ts);
+
+  if (input.gps_new) {
+    if (!heading_aligned_ && input.gps_Vg > ground_speed_threshold) {
+      align_heading(input.gps_Vg, input.gps_course);
+    }
+    fuse_gps(input);
+  }
+
+  if (input.baro_new && baro_init_) {
+    fuse_baro(input.static_pres);
+  }
+
+  if (input.airspeed_new) {
+    fuse_air_data(input.diff_pres);
+  }
+
+  check_state(input);
+
+  persist_imu_biases(gyro_bias_, P_.diagonal().segment<3>(gyro_bias_index_), accel_bias_,
+                     P_.diagonal().segment<3>(accel_bias_index_));
+
+  Eigen::Vector3f euler = quaternion_to_euler(attitude_);
+  Eigen::Vector3f air_velocity = air_relative_velocity_body();
+  float va = air_velocity.norm();
+
+  output.pn = position_(0);
+  output.pe = position_(1);
+  output.h = -position_(2);
+  output.va = va;
+  // The flow angles are undefined when not moving through the air.
+  output.alpha = 0.0f;
+  output.beta = 0.0f;
+  if (va > 1.0f) {
+    output.alpha = atan2f(air_velocity(2), air_velocity(0));
+    output.beta = asinf(std::clamp(air_velocity(1) / va, -1.0f, 1.0f));
+  }
+  output.phi = euler(0);
+  output.theta = euler(1);
+  output.psi = euler(2);
+  output.chi = atan2f(velocity_(1), velocity_(0));
+  output.p = angular_rate(0);
+  output.q = angular_rate(1);
+  output.r = angular_rate(2);
+  output.Vg = velocity_.head<2>().norm();
+  output.wn = wind_(0);
+  output.we = wind_(1);
+}
+
+void EstimatorQuaternionINS::propagate(const Eigen::Vector3f & angular_rate,
+                                       const Eigen::Vector3f & specific_force, float Ts)
+{
+  // For readability, declare the parameters here
+  double gravity = gravity_.get();
+  double sigma_gyro = sigma_gyro_.get();
+  double sigma_accel = sigma_accel_.get();
+  double gyro_bias_random_walk = gyro_bias_random_walk_.get();
+  double accel_bias_random_walk = accel_bias_random_walk_.get();
+  double wind_random_walk = wind_random_walk_.get();
+
+  const Eigen::Matrix3f R = attitude_.toRotationMatrix();
+
+  // The error dynamics, linearized about the nominal state at the start of the step.
+  ErrorEKF::StateMatrix A = ErrorEKF::StateMatrix::Zero();
+  A.block<3, 3>(position_index_, velocity_index_).setIdentity();
+  A.block<3, 3>(velocity_index_, attitude_index_) = -R * skew(specific_force);
+  A.block<3, 3>(velocity_index_, accel_bias_index_) = -R;
+  A.block<3, 3>(attitude_index_, attitude_index_) = -skew(angular_rate);
+  A.block<3, 3>(attitude_index_, gyro_bias_index_) = -Eigen::Matrix3f::Identity();
+
+  // The gyro noise drives the attitude error and the accelerometer noise the velocity error.
+  Eigen::Matrix<float, num_dynamic_states_, 6> G;
+  G.setZero();
+  G.block<3, 3>(attitude_index_, 0) = -Eigen::Matrix3f::Identity();
+  G.block<3, 3>(velocity_index_, 3) = -R;
+
+  Eigen::Vector<float, 6> Q_g_diagonal;
+  Q_g_diagonal << Eigen::Vector3f::Constant(sigma_gyro * sigma_gyro),
+    Eigen::Vector3f::Constant(sigma_accel * sigma_accel);
+
+  // The biases and the wind are random walks, whose variance grows linearly with time. EKFCore
+  // scales the process noise by Ts^2, so it is divided by Ts here.
+  ErrorEKF::StateVector Q_diagonal = ErrorEKF::StateVector::Zero();
+  Q_diagonal.segment<3>(gyro_bias_index_).setConstant(gyro_bias_random_walk
+                                                      * gyro_bias_random_walk / Ts);
+  Q_diagonal.segment<3>(accel_bias_index_).setConstant(accel_bias_random_walk
+                                                       * accel_bias_random_walk / Ts);
+  Q_diagonal.segment<2>(wind_index_).setConstant(wind_random_walk * wind_random_walk / Ts);
+
+  // The error is zero between updates and stays zero when propagated, so only its covariance
+  // changes. Only the position, velocity and attitude errors have dynamics.
+  ErrorEKF::StateVector error = ErrorEKF::StateVector::Zero();
+  Eigen::Vector<float, 6> inputs;
+  inputs << angular_rate, specific_force;
+  ErrorEKF::propagate_structured<num_dynamic_states_>(
+    error, P_, inputs,
+    [](const auto &, const auto &) { return ErrorEKF::StateVector::Zero().eval(); },
+    [&A](const auto &, const auto &) { return A; }, [&G](const auto &, const auto &) { return G; },
+    Q_diagonal, Q_g_diagonal, Ts, 1);
+
+  // Integrate the nominal state.
+  const Eigen::Vector3f acceleration =
+    R * specific_force + Eigen::Vector3f(0.0f, 0.0f, static_cast<float>(gravity));
+  position_ += velocity_ * Ts + acceleration * (Ts * Ts / 2.0f);
+  velocity_ += acceleration * Ts;
+  attitude_ = (attitude_ * rotation_vector_to_quaternion(angular_rate * Ts)).normalized();
+}
+
+void EstimatorQuaternionINS::fuse_gps(const Input & input)
+{
+  // For readability, declare the parameters here
+  float sigma_horizontal = sigma_gps_horizontal_.get();
+  float sigma_vertical = sigma_gps_vertical_.get();
+  float sigma_velocity = sigma_gps_velocity_.get();
+
+  Eigen::Vector<float, 5> y;
+  y << input.gps_n, input.gps_e, input.gps_h, input.gps_Vg * cosf(input.gps_course),
+    input.gps_Vg * sinf(input.gps_course);
+
+  Eigen::Vector<float, 5> R_diagonal;
+  R_diagonal << sigma_horizontal * sigma_horizontal, sigma_horizontal * sigma_horizontal,
+    sigma_vertical * sigma_vertical, sigma_velocity * sigma_velocity,
+    sigma_velocity * sigma_velocity;
+
+  // Before the heading is aligned the velocity cannot be used, since it would rotate the heading.
+  if (heading_aligned_) {
+    fuse_gps_measurements<5>(y, R_diagonal);
+  } else {
+    fuse_gps_measurements<3>(y.head<3>(), R_diagonal.head<3>());
+  }
+}
+
+template<int M>
+void EstimatorQuaternionINS::fuse_gps_measurements(const Eigen::Vector<float, M> & y,
+                                                   const Eigen::Vector<float, M> & R_diagonal)
+{
+  // For readability, declare the parameters here
+  float gate_threshold = gps_gate_threshold_.get();
+  bool joseph_form = joseph_form_.get();
+
+  // The GPS position, altitude and horizontal velocity, of which the leading M are fused.
+  Eigen::Vector<float, 5> h;
+  h << position_(0), position_(1), -position_(2), velocity_(0), velocity_(1);
+
+  Eigen::Matrix<float, 5, 17> C = Eigen::Matrix<float, 5, 17>::Zero();
+  C(0, position_index_) = 1.0f;
+  C(1, position_index_ + 1) = 1.0f;
+  C(2, position_index_ + 2) = -1.0f;
+  C(3, velocity_index_) = 1.0f;
+  C(4, velocity_index_ + 1) = 1.0f;
+
+  ErrorEKF::StateVector error = ErrorEKF::StateVector::Zero();
+  MeasurementInnovation<M> innovation = ErrorEKF::sequential_measurement_update(
+    error, P_, Eigen::Vector<float, 1>::Zero().eval(),
+    [&h](const auto &, const auto &) { return h.template head<M>().eval(); },
+    [&C](const auto &, const auto &) { return C.template topRows<M>().eval(); }, y, R_diagonal,
+    gate_threshold, joseph_form);
+
+  innovations_.gps_nis = innovation.nis;
+  innovations_.gps_accepted = innovation.accepted;
+  if (innovation.accepted) {
+    inject_error(error);
+  } else {
+    innovations_.gps_rejections++;
+    RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 5000,
+                         "GPS measurement rejected by the innovation gate (NIS %.1f).",
+                         innovation.nis);
+  }
+}
+
+void EstimatorQuaternionINS::fuse_baro(float static_pres)
+{
+  // For readability, declare the parameters here
+  double rho = rho_.get();
+  double gravity = gravity_.get();
+  float sigma_baro = sigma_baro_.get();
+  bool joseph_form = joseph_form_.get();
+
+  float altitude = static_pres / rho / gravity;
+
+  ErrorEKF::StateVector C = ErrorEKF::StateVector::Zero();
+  C(position_index_ + 2) = -1.0f;
+
+  ErrorEKF::StateVector error = ErrorEKF::StateVector::Zero();
+  ErrorEKF::single_measurement_update(error, P_, altitude, -position_(2),
+                                      sigma_baro * sigma_baro, C, 0.0f, joseph_form);
+  inject_error(error);
+}
+
+void EstimatorQuaternionINS::fuse_air_data(float diff_pres)
+{
+  // For readability, declare the parameters here
+  double rho = rho_.get();
+  float sigma_airspeed = sigma_airspeed_.get();
+  float sigma_sideslip = sigma_sideslip_.get();
+  float airspeed_threshold = airspeed_fusion_threshold_.get();
+  bool joseph_form = joseph_form_.get();
+
+  float va_measured = sqrtf(2.0f / rho * std::max(diff_pres, 0.0f));
+
+  // The pitot tube reads noise at low airspeeds and the sideslip model assumes flight, and both
+  // observe the heading, which must first be aligned.
+  if (va_measured < airspeed_threshold || !heading_aligned_) {
+    return;
+  }
+
+  const Eigen::Matrix3f R = attitude_.toRotationMatrix();
+  Eigen::Vector3f air_velocity = velocity_;
+  air_velocity.head<2>() -= wind_;
+  const Eigen::Vector3f air_velocity_body = R.transpose() * air_velocity;
+  float va = air_velocity.norm();
+  if (va < 1e-3f) {
+    return;
+  }
+
+  // The airspeed is the norm of the air-relative velocity, and the sideslip pseudo measurement is
+  // its body y component, which is zero in coordinated flight.
+  Eigen::Matrix<float, 2, 17> C = Eigen::Matrix<float, 2, 17>::Zero();
+  C.block<1, 3>(0, velocity_index_) = air_velocity.transpose() / va;
+  C.block<1, 2>(0, wind_index_) = -air_velocity.head<2>().transpose() / va;
+  C.block<1, 3>(1, velocity_index_) = R.col(1).transpose();
+  C.block<1, 3>(1, attitude_index_) = skew(air_velocity_body).row(1);
+  C.block<1, 2>(1, wind_index_) = -R.col(1).head<2>().transpose();
+
+  Eigen::Vector2f y(va_measured, 0.0f);
+  Eigen::Vector2f R_diagonal(sigma_airspeed * sigma_airspeed, sigma_sideslip * sigma_sideslip);
+
+  ErrorEKF::StateVector error = ErrorEKF::StateVector::Zero();
+  ErrorEKF::sequential_measurement_update(
+    error, P_, Eigen::Vector<float, 1>::Zero().eval(),
+    [va, &air_velocity_body](const auto &, const auto &) {
+      return Eigen::Vector2f(va, air_velocity_body(1));
+    },
+    [&C](const auto &, const auto &) { return C; }, y, R_diagonal, 0.0f, joseph_form);
+  inject_error(error);
+}
+
+void EstimatorQuaternionINS::inject_error(const ErrorEKF::StateVector & error)
+{
+  position_ += error.segment<3>(position_index_);
+  velocity_ += error.segment<3>(velocity_index_);
+  attitude_ =
+    (attitude_ * rotation_vector_to_quaternion(error.segment<3>(attitude_index_))).normalized();
+  gyro_bias_ += error.segment<3>(gyro_bias_index_);
+  accel_bias_ += error.segment<3>(accel_bias_index_);
+  wind_ += error.segment<2>(wind_index_);
+
+  // The covariance of the reset error is the same to first order, since the attitude corrections
+  // are small.
+}
+
+Eigen::Vector3f EstimatorQuaternionINS::air_relative_velocity_body() const
+{
+  Eigen::Vector3f air_velocity = velocity_;
+  air_velocity.head<2>() -= wind_;
+  return attitude_.conjugate() * air_velocity;
+}
+
+void EstimatorQuaternionINS::align_heading(float gps_Vg, float gps_course)
+{
+  Eigen::Vector3f euler = quaternion_to_euler(attitude_);
+  attitude_ = euler_to_quaternion(euler(0), euler(1), gps_course);
+  velocity_(0) = gps_Vg * cosf(gps_course);
+  velocity_(1) = gps_Vg * sinf(gps_course);
+
+  // The velocity and attitude were just set, so their correlations with the rest of the state are
+  // no longer valid.
+  double velocity_initial_cov = params_.get_double("ins_velocity_initial_cov");
+  double attitude_initial_cov = params_.get_double("ins_attitude_initial_cov");
+  P_.middleRows<6>(velocity_index_).setZero();
+  P_.middleCols<6>(velocity_index_).setZero();
+  P_.diagonal().segment<3>(velocity_index_).setConstant(velocity_initial_cov);
+  P_.diagonal().segment<3>(attitude_index_).setConstant(
+    powf(attitude_initial_cov * deg_to_rad, 2));
+
+  heading_aligned_ = true;
+  RCLCPP_INFO(this->get_logger(), "Heading aligned with the GPS course.");
+}
+
+void EstimatorQuaternionINS::check_state(const Input & input)
+{
+  bool finite = position_.allFinite() && velocity_.allFinite() && attitude_.coeffs().allFinite()
+    && gyro_bias_.allFinite() && accel_bias_.allFinite() && wind_.allFinite()
+    && P_.diagonal().allFinite();
+  if (!finite) {
+    RCLCPP_WARN(this->get_logger(), "INS reinitialized due to non-finite state");
+    reinitializations_++;
+    initialize(input);
+  }
+}
+
+void EstimatorQuaternionINS::fill_diagnostics(
+  rosplane_msgs::msg::EstimatorDiagnostics & diagnostics)
+{
+  diagnostics.covariance_diagonal.resize(ErrorEKF::StateVector::RowsAtCompileTime);
+  ErrorEKF::StateVector::Map(diagnostics.covariance_diagonal.data()) = P_.diagonal();
+  diagnostics.reinitializations = reinitializations_;
+  diagnostics.innovations = innovations_;
+}
+
+void EstimatorQuaternionINS::declare_parameters()
+{
+  params_.declare_double("ins_sigma_gyro", 0.13 * M_PI / 180.0); // Gyro noise per sample (rad/s)
+  params_.declare_double("ins_sigma_accel", .0025 * 9.81);       // Accel noise per sample (m/s^2)
+  params_.declare_double("ins_gyro_bias_random_walk", 1e-4);     // rad/s/sqrt(s)
+  params_.declare_double("ins_accel_bias_random_walk", 1e-3);    // m/s^2/sqrt(s)
+  params_.declare_double("ins_wind_random_walk", 0.05);          // m/s/sqrt(s)
+  params_.declare_double("ins_sigma_gps_horizontal", 0.5);       // m
+  params_.declare_double("ins_sigma_gps_vertical", 1.0);         // m
+  params_.declare_double("ins_sigma_gps_velocity", 0.1);         // m/s
+  params_.declare_double("ins_sigma_baro", 0.5);                 // m
+  params_.declare_double("ins_sigma_airspeed", 0.5);             // m/s
+  params_.declare_double("ins_sigma_sideslip", 0.5);             // Body y air velocity (m/s)
+  params_.declare_double("ins_airspeed_fusion_threshold", 5.0);  // Min airspeed to fuse (m/s)
+  params_.declare_double("ins_gps_gate_threshold", 0.0);         // Chi-squared gate, zero disables
+  params_.declare_bool("ins_joseph_form", true);
+  params_.declare_double("ins_position_initial_cov", 1.0);       // m^2
+  params_.declare_double("ins_velocity_initial_cov", 1.0);       // m^2/s^2
+  params_.declare_double("ins_attitude_initial_cov", 5.0);       // Deg, not squared
+  params_.declare_double("ins_gyro_bias_initial_cov", 1e-4);     // rad^2/s^2
+  params_.declare_double("ins_accel_bias_initial_cov", 0.01);    // m^2/s^4
+  params_.declare_double("ins_wind_initial_cov", 0.04);          // m^2/s^2
+}
+
+void EstimatorQuaternionINS::bind_parameters()
+{
+  sigma_gyro_ = params_.get_double_handle("ins_sigma_gyro");
+  sigma_accel_ = params_.get_double_handle("ins_sigma_accel");
+  gyro_bias_random_walk_ = params_.get_double_handle("ins_gyro_bias_random_walk");
+  accel_bias_random_walk_ = params_.get_double_handle("ins_accel_bias_random_walk");
+  wind_random_walk_ = params_.get_double_handle("ins_wind_random_walk");
+  sigma_gps_horizontal_ = params_.get_double_handle("ins_sigma_gps_horizontal");
+  sigma_gps_vertical_ = params_.get_double_handle("ins_sigma_gps_vertical");
+  sigma_gps_velocity_ = params_.get_double_handle("ins_sigma_gps_velocity");
+  sigma_baro_ = params_.get_double_handle("ins_sigma_baro");
+  sigma_airspeed_ = params_.get_double_handle("ins_sigma_airspeed");
+  sigma_sideslip_ = params_.get_double_handle("ins_sigma_sideslip");
+  airspeed_fusion_threshold_ = params_.get_double_handle("ins_airspeed_fusion_threshold");
+  gps_gate_threshold_ = params_.get_double_handle("ins_gps_gate_threshold");
+  joseph_form_ = params_.get_bool_handle("ins_joseph_form");
+  ground_speed_threshold_ = params_.get_double_handle("gps_ground_speed_threshold");
+}
+
+} // namespace rosplane
+
+#include <rclcpp_components/register_node_macro.hpp>
+RCLCPP_COMPONENTS_REGISTER_NODE(rosplane::EstimatorQuaternionINS)
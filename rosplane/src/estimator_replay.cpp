@@ -0,0 +1,217 @@
+/**
+ * @file estimator_replay.cpp
+ *
+ * Runs the estimator offline on a recorded sensor log, as fast as the CPU allows, and writes the
+ * estimated state stream to a CSV file. The estimator is the same one the live node runs, driven in
+ * event-driven mode by the log's IMU stamps, so the output only depends on the log and the
+ * parameters. No other nodes are needed and the node is never spun, but it is still a ROS node:
+ * it needs an rclcpp context, which main() creates, and a ROS 2 installation to run.
+ *
+ * Usage:
+ *   ros2 run rosplane rosplane_estimator_replay <sensor_log.csv> <state_out.csv> [estimator_type]
+ *     --ros-args -r __node:=estimator --params-file <params.yaml>
+ *
+ * estimator_type is continuous_discrete (the default) or quaternion_ins, as for the estimator node.
+ *
+ * The sensor log has one message per line, in the order the messages were received. The first
+ * field is the message type and the second its header stamp in seconds:
+ *   imu,<stamp>,<gyro_x>,<gyro_y>,<gyro_z>,<accel_x>,<accel_y>,<accel_z>
+ *   baro,<stamp>,<pressure>
+ *   airspeed,<stamp>,<differential_pressure>
+ *   gnss_fix,<stamp>,<status>,<latitude>,<longitude>,<altitude>
+ *   gnss_vel,<stamp>,<v_n>,<v_e>,<v_d>
+ *   status,<stamp>,<armed>
+ * Empty lines and lines starting with '#' are skipped. scripts/estimator_log_from_bag.py writes
+ * this format from a rosbag2 recording of the estimator's input topics.
+ *
+ * The state CSV has a header row and one row per estimate:
+ *   stamp,pn,pe,pd,va,alpha,beta,phi,theta,psi,chi,p,q,r,vg,wn,we
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "estimator_continuous_discrete.hpp"
+#include "estimator_quaternion_ins.hpp"
+#include "sensor_fed_estimator.hpp"
+
+namespace rosplane
+{
+
+/**
+ * An estimator fed from a recorded log, with its state publisher replaced by a CSV file.
+ */
+template<typename Estimator>
+class EstimatorReplay : public SensorFedEstimator<Estimator>
+{
+public:
+  explicit EstimatorReplay(FILE * state_file)
+      : state_file_(state_file)
+      , states_written_(0)
+  {
+    // The replay budget exists to bound CPU time on the vehicle, and whether a late fix fits in it
+    // depends on how fast this machine is. Always replay, so the output only depends on the log.
+    if constexpr (std::is_base_of_v<EstimatorContinuousDiscrete, Estimator>) {
+      this->params_.set_double("gps_replay_budget", INFINITY);
+    }
+
+    std::fprintf(state_file_, "stamp,pn,pe,pd,va,alpha,beta,phi,theta,psi,chi,p,q,r,vg,wn,we\n");
+  }
+
+  /**
+   * @brief Feeds one line of the sensor log to the estimator.
+   *
+   * @param line The log line.
+   * @return False if the line could not be parsed.
+   */
+  bool process_line(const std::string & line)
+  {
+    if (line.empty() || line[0] == '#') {
+      return true;
+    }
+
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, ',')) {
+      fields.push_back(field);
+    }
+    if (fields.size() < 2) {
+      return false;
+    }
+
+    std::vector<double> values;
+    try {
+      for (std::size_t i = 1; i < fields.size(); i++) {
+        values.push_back(std::stod(fields[i]));
+      }
+    } catch (const std::exception &) {
+      return false;
+    }
+
+    const std::string & type = fields[0];
+    const builtin_interfaces::msg::Time stamp = this->to_stamp(values[0]);
+
+    if (type == "imu" && values.size() == 7) {
+      this->feed_imu(stamp, values[1], values[2], values[3], values[4], values[5], values[6]);
+    } else if (type == "baro" && values.size() == 2) {
+      this->feed_baro(stamp, values[1]);
+    } else if (type == "airspeed" && values.size() == 2) {
+      this->feed_airspeed(stamp, values[1]);
+    } else if (type == "gnss_fix" && values.size() == 5) {
+      this->feed_gnss_fix(stamp, static_cast<int8_t>(values[1]), values[2], values[3], values[4]);
+    } else if (type == "gnss_vel" && values.size() == 4) {
+      this->feed_gnss_vel(stamp, values[1], values[2], values[3]);
+    } else if (type == "status" && values.size() == 2) {
+      this->feed_status(stamp, values[1] != 0.0);
+    } else {
+      return false;
+    }
+
+    return true;
+  }
+
+  int64_t states_written() const { return states_written_; }
+
+protected:
+  void publish_state(const rosplane_msgs::msg::State & msg) override
+  {
+    double stamp = rclcpp::Time(msg.header.stamp).seconds();
+    std::fprintf(state_file_,
+                 "%.9f,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,"
+                 "%.9g\n",
+                 stamp, msg.position[0], msg.position[1], msg.position[2], msg.va, msg.alpha,
+                 msg.beta, msg.phi, msg.theta, msg.psi, msg.chi, msg.p, msg.q, msg.r, msg.vg,
+                 msg.wn, msg.we);
+    states_written_++;
+  }
+
+private:
+  FILE * state_file_;
+  int64_t states_written_;
+};
+
+/**
+ * @brief Replays a sensor log through an estimator of the given type.
+ *
+ * @return Zero if every line of the log was replayed.
+ */
+template<typename Estimator>
+int replay(std::ifstream & log_file, const std::string & log_path, FILE * state_file)
+{
+  auto estimator = std::make_shared<EstimatorReplay<Estimator>>(state_file);
+
+  auto start = std::chrono::steady_clock::now();
+  std::string line;
+  int64_t line_number = 0;
+  int result = 0;
+  while (std::getline(log_file, line)) {
+    line_number++;
+    if (!estimator->process_line(line)) {
+      std::fprintf(stderr, "%s:%ld: could not parse line: %s\n", log_path.c_str(),
+                   static_cast<long>(line_number), line.c_str());
+      result = 1;
+      break;
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  RCLCPP_INFO(estimator->get_logger(), "Replayed %ld log lines into %ld states in %.3f s.",
+              static_cast<long>(line_number), static_cast<long>(estimator->states_written()),
+              elapsed.count());
+  return result;
+}
+
+} // namespace rosplane
+
+int main(int argc, char ** argv)
+{
+  rclcpp::init(argc, argv);
+  std::vector<std::string> args = rclcpp::remove_ros_arguments(argc, argv);
+
+  if (args.size() != 3 && args.size() != 4) {
+    std::fprintf(stderr,
+                 "Usage: %s <sensor_log.csv> <state_out.csv> [estimator_type] [--ros-args -r "
+                 "__node:=estimator --params-file <params.yaml>]\n",
+                 args.empty() ? "rosplane_estimator_replay" : args[0].c_str());
+    rclcpp::shutdown();
+    return 1;
+  }
+  std::string estimator_type = args.size() == 4 ? args[3] : "continuous_discrete";
+  if (estimator_type != "continuous_discrete" && estimator_type != "quaternion_ins") {
+    std::fprintf(stderr, "Unknown estimator type %s\n", estimator_type.c_str());
+    rclcpp::shutdown();
+    return 1;
+  }
+
+  std::ifstream log_file(args[1]);
+  if (!log_file) {
+    std::fprintf(stderr, "Could not open sensor log %s\n", args[1].c_str());
+    rclcpp::shutdown();
+    return 1;
+  }
+
+  FILE * state_file = std::fopen(args[2].c_str(), "w");
+  if (state_file == nullptr) {
+    std::fprintf(stderr, "Could not open %s for writing\n", args[2].c_str());
+    rclcpp::shutdown();
+    return 1;
+  }
+
+  int result;
+  if (estimator_type == "quaternion_ins") {
+    result = rosplane::replay<rosplane::EstimatorQuaternionINS>(log_file, args[1], state_file);
+  } else {
+    result = rosplane::replay<rosplane::EstimatorContinuousDiscrete>(log_file, args[1], state_file);
+  }
+
+  std::fclose(state_file);
+  rclcpp::shutdown();
+  return result;
+}
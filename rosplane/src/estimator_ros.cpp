@@ -1,27 +1,61 @@
+#include <algorithm>
 #include <cstdlib>
-#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <numeric>
+
+#include <Eigen/Geometry>
 
-#include "estimator_continuous_discrete.hpp"
 #include "estimator_ros.hpp"
 
 namespace rosplane
 {
 
-EstimatorROS::EstimatorROS()
-    : Node("estimator_ros")
+EstimatorROS::EstimatorROS(const rclcpp::NodeOptions & options)
+    : Node("estimator_ros", options)
     , params_(this)
     , params_initialized_(false)
+    , event_driven_(false)
+    , imu_stamp_init_(false)
+    , imu_samples_dropped_(0)
+    , imu_samples_duplicated_(0)
+    , imu_samples_reported_(0)
+    , held_measurements_dropped_(0)
+    , imu_samples_overflowed_(0)
+    , imu_sub_event_driven_(false)
+    , diagnostics_ticks_(0)
+    , tick_jitter_sum_(0.0)
+    , tick_jitter_max_(0.0)
+    , tick_jitter_count_(0)
+    , diagnostics_window_start_(0.0)
+    , diagnostics_window_init_(false)
+    , innovations_estimates_(0)
+    , last_tick_time_init_(false)
+    , intra_process_(options.use_intra_process_comms())
+    , baro_q1_(0.25)
+    , baro_q3_(0.75)
+    , baro_outliers_(0)
+    , baro_calibration_restarts_(0)
 {
   vehicle_state_pub_ = this->create_publisher<rosplane_msgs::msg::State>("estimated_state", 10);
+  diagnostics_pub_ =
+    this->create_publisher<rosplane_msgs::msg::EstimatorDiagnostics>("estimator_diagnostics", 10);
+  innovations_pub_ =
+    this->create_publisher<rosplane_msgs::msg::EstimatorInnovations>("estimator_innovations", 10);
+  // Transient local so a ground station that starts late still sees whether the baro is calibrated.
+  // Intra-process communication does not support transient_local, so it is disabled for this topic.
+  rclcpp::QoS qos_transient_local_1_(1);
+  qos_transient_local_1_.transient_local();
+  rclcpp::PublisherOptions baro_calibration_pub_options;
+  baro_calibration_pub_options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
+  baro_calibration_pub_ = this->create_publisher<rosplane_msgs::msg::BaroCalibration>(
+    "baro_calibration", qos_transient_local_1_, baro_calibration_pub_options);
 
   gnss_fix_sub_ = this->create_subscription<sensor_msgs::msg::NavSatFix>(
     gnss_fix_topic_, 10, std::bind(&EstimatorROS::gnssFixCallback, this, std::placeholders::_1));
   gnss_vel_sub_ = this->create_subscription<geometry_msgs::msg::TwistStamped>(
     gnss_vel_topic_, 10, std::bind(&EstimatorROS::gnssVelCallback, this, std::placeholders::_1));
-  imu_sub_ = this->create_subscription<sensor_msgs::msg::Imu>(
-    imu_topic_, 10, std::bind(&EstimatorROS::imuCallback, this, std::placeholders::_1));
+  // The IMU subscription depends on the update mode, so set_timer creates it.
+  imu_callback_group_ = this->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
   baro_sub_ = this->create_subscription<rosflight_msgs::msg::Barometer>(
     baro_topic_, 10, std::bind(&EstimatorROS::baroAltCallback, this, std::placeholders::_1));
   airspeed_sub_ = this->create_subscription<rosflight_msgs::msg::Airspeed>(
@@ -30,7 +64,6 @@ EstimatorROS::EstimatorROS()
     status_topic_, 10, std::bind(&EstimatorROS::statusCallback, this, std::placeholders::_1));
 
   init_static_ = 0;
-  baro_count_ = 0;
   armed_first_time_ = false;
   baro_init_ = false;
   gps_init_ = false;
@@ -43,6 +76,27 @@ EstimatorROS::EstimatorROS()
   declare_parameters();
   params_.set_parameters();
 
+  rho_ = params_.get_double_handle("rho");
+  gravity_ = params_.get_double_handle("gravity");
+  update_frequency_ = params_.get_double_handle("estimator_update_frequency");
+  gps_ground_speed_threshold_ = params_.get_double_handle("gps_ground_speed_threshold");
+  baro_measurement_gate_ = params_.get_double_handle("baro_measurement_gate");
+  airspeed_measurement_gate_ = params_.get_double_handle("airspeed_measurement_gate");
+  baro_calibration_count_ = params_.get_int_handle("baro_calibration_count");
+  baro_calibration_outlier_fence_ = params_.get_double_handle("baro_calibration_outlier_fence");
+  baro_calibration_max_outliers_ = params_.get_double_handle("baro_calibration_max_outliers");
+  diagnostics_decimation_ = params_.get_int_handle("diagnostics_decimation");
+  innovations_decimation_ = params_.get_int_handle("innovations_decimation");
+  gyro_bias_converged_std_ = params_.get_double_handle("gyro_bias_converged_std");
+  accel_bias_converged_std_ = params_.get_double_handle("accel_bias_converged_std");
+
+  gyro_bias_seed_.setZero();
+  accel_bias_seed_.setZero();
+  persisted_gyro_bias_ << params_.get_double("gyro_bias_x"), params_.get_double("gyro_bias_y"),
+    params_.get_double("gyro_bias_z");
+  persisted_accel_bias_ << params_.get_double("accel_bias_x"), params_.get_double("accel_bias_y"),
+    params_.get_double("accel_bias_z");
+
   params_initialized_ = true;
 
   std::filesystem::path rosplane_dir = ament_index_cpp::get_package_share_directory("rosplane");
@@ -52,9 +106,14 @@ EstimatorROS::EstimatorROS()
   std::filesystem::path full_path = rosplane_dir / params_dir / params_file;
 
   param_filepath_ = full_path.string();
+  params_.set_persistence_file(param_filepath_, "estimator");
 
   input_.diff_pres = 0.0; // Initalize the differential_pressure measurement to zero.
   input_.static_pres = 0.0; // Initalize the differential_pressure measurement to zero.
+  input_.baro_new = false;
+  input_.airspeed_new = false;
+  input_.gps_vd = 0.0;
+  input_.Ts = 1.0 / update_frequency_.get();
 
   set_timer();
 }
@@ -62,6 +121,10 @@ EstimatorROS::EstimatorROS()
 void EstimatorROS::declare_parameters()
 {
   params_.declare_double("estimator_update_frequency", 100.0);
+  params_.declare_bool("event_driven_estimation", false);
+  // Start from the GPS origin, baro calibration and IMU biases saved in the parameters. Only read
+  // when the estimator is constructed.
+  params_.declare_bool("seed_estimator", false);
   params_.declare_double("rho", 1.225);
   params_.declare_double("gravity", 9.8);
   params_.declare_double("gps_ground_speed_threshold",
@@ -73,19 +136,69 @@ void EstimatorROS::declare_parameters()
   params_.declare_int("baro_calibration_count",
                       100); // TODO: this is a magic number. What is it determined from?
   params_.declare_double("baro_calibration_val", 0.0);
+  // Samples more than this many interquartile ranges outside the quartiles are outliers
+  params_.declare_double("baro_calibration_outlier_fence", 2.0);
+  // Fraction of outliers, out of all samples, above which the calibration restarts
+  params_.declare_double("baro_calibration_max_outliers", 0.1);
   params_.declare_double("init_lat", 0.0);
   params_.declare_double("init_lon", 0.0);
   params_.declare_double("init_alt", 0.0);
+  params_.declare_int("diagnostics_decimation", 100); // Ticks per diagnostics message, 0 disables
+  params_.declare_int("innovations_decimation", 10); // Estimates per innovations msg, 0 disables
+
+  // IMU biases, saved by the estimator once its estimates converge
+  params_.declare_double("gyro_bias_x", 0.0); // rad/s
+  params_.declare_double("gyro_bias_y", 0.0);
+  params_.declare_double("gyro_bias_z", 0.0);
+  params_.declare_double("accel_bias_x", 0.0); // m/s^2
+  params_.declare_double("accel_bias_y", 0.0);
+  params_.declare_double("accel_bias_z", 0.0);
+  params_.declare_double("gyro_bias_converged_std", 0.001); // rad/s
+  params_.declare_double("accel_bias_converged_std", 0.05); // m/s^2
 }
 
 void EstimatorROS::set_timer()
 {
   double frequency = params_.get_double("estimator_update_frequency");
+  event_driven_ = params_.get_bool("event_driven_estimation");
+  create_imu_subscription();
 
   update_period_ = std::chrono::microseconds(static_cast<long long>(1.0 / frequency * 1'000'000));
+
+  // Restart the sample bookkeeping so the first step after a mode change does not see a stale gap.
+  imu_stamp_init_ = false;
+
+  if (event_driven_) {
+    // The IMU messages drive the estimator, so no timer is needed. The update frequency is then
+    // the expected IMU rate, used to detect dropped samples.
+    return;
+  }
+
+  // Measurements held for the IMU stream would never be released in timer mode, so apply them now.
+  release_held_measurements(last_imu_stamp_);
+
   update_timer_ = this->create_wall_timer(update_period_, std::bind(&EstimatorROS::update, this));
 }
 
+void EstimatorROS::create_imu_subscription()
+{
+  if (imu_sub_ && imu_sub_event_driven_ == event_driven_) {
+    return;
+  }
+
+  // In timer mode the IMU callback only fills the sample buffer, so it gets its own callback
+  // group. In event-driven mode it runs the estimator and reads the inputs the other sensor
+  // callbacks write, so it must share their (default) group to be mutually exclusive with them.
+  rclcpp::SubscriptionOptions imu_sub_options;
+  if (!event_driven_) {
+    imu_sub_options.callback_group = imu_callback_group_;
+  }
+  imu_sub_ = this->create_subscription<sensor_msgs::msg::Imu>(
+    imu_topic_, 10, std::bind(&EstimatorROS::imuCallback, this, std::placeholders::_1),
+    imu_sub_options);
+  imu_sub_event_driven_ = event_driven_;
+}
+
 rcl_interfaces::msg::SetParametersResult
 EstimatorROS::parametersCallback(const std::vector<rclcpp::Parameter> & parameters)
 {
@@ -99,12 +212,16 @@ EstimatorROS::parametersCallback(const std::vector<rclcpp::Parameter> & paramete
     result.reason = "One of the parameters given is not a parameter of the estimator node.";
   }
 
-  // Check to see if the timer period was changed. If it was, recreate the timer with the new period
+  // Check to see if the timer period or the update mode was changed. If it was, recreate the timer
   if (params_initialized_ && success) {
     std::chrono::microseconds curr_period = std::chrono::microseconds(
-      static_cast<long long>(1.0 / params_.get_double("estimator_update_frequency") * 1'000'000));
-    if (update_period_ != curr_period) {
-      update_timer_->cancel();
+      static_cast<long long>(1.0 / update_frequency_.get() * 1'000'000));
+    bool event_driven = params_.get_bool("event_driven_estimation");
+    if (update_period_ != curr_period || event_driven_ != event_driven) {
+      if (update_timer_) {
+        update_timer_->cancel();
+        update_timer_.reset();
+      }
       set_timer();
     }
   }
@@ -115,9 +232,24 @@ EstimatorROS::parametersCallback(const std::vector<rclcpp::Parameter> & paramete
 void EstimatorROS::update()
 {
   Output output;
+  bool ran_estimate = false;
+  double estimate_time = 0.0;
+
+  // In event-driven mode the estimate is valid at the time of the IMU sample it was propagated to.
+  rclcpp::Time stamp = last_imu_stamp_;
+  if (!event_driven_) {
+    stamp = this->get_clock()->now();
+    input_.Ts = 1.0 / update_frequency_.get();
+    integrate_imu_samples();
+  }
+  input_.stamp = stamp.seconds();
 
   if (armed_first_time_) {
+    auto estimate_start = std::chrono::steady_clock::now();
     estimate(input_, output);
+    estimate_time =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - estimate_start).count();
+    ran_estimate = true;
   } else {
     output.pn = output.pe = output.h = 0;
     output.phi = output.theta = output.psi = 0;
@@ -127,9 +259,32 @@ void EstimatorROS::update()
   }
 
   input_.gps_new = false;
+  input_.baro_new = false;
+  input_.airspeed_new = false;
+
+  if (intra_process_) {
+    // Build the message in memory that the subscribers in this process take over, so it reaches
+    // them without being copied or serialized.
+    auto msg = std::make_unique<rosplane_msgs::msg::State>();
+    fill_state(stamp, output, *msg);
+    vehicle_state_pub_->publish(std::move(msg));
+  } else {
+    rosplane_msgs::msg::State msg;
+    fill_state(stamp, output, msg);
+    publish_state(msg);
+  }
+
+  record_diagnostics(stamp, ran_estimate, estimate_time);
+
+  if (ran_estimate) {
+    record_innovations(stamp);
+  }
+}
 
-  rosplane_msgs::msg::State msg;
-  msg.header.stamp = this->get_clock()->now();
+void EstimatorROS::fill_state(const rclcpp::Time & stamp, const Output & output,
+                              rosplane_msgs::msg::State & msg)
+{
+  msg.header.stamp = stamp;
   msg.header.frame_id = 1; // Denotes global frame
 
   msg.position[0] = output.pn;
@@ -175,12 +330,298 @@ void EstimatorROS::update()
   msg.chi_deg = fmod(output.chi, 2.0 * M_PI) * 180 / M_PI; //-360 to 360
   msg.chi_deg += (msg.chi_deg < -180 ? 360 : 0);
   msg.chi_deg -= (msg.chi_deg > 180 ? 360 : 0);
+}
 
+void EstimatorROS::publish_state(const rosplane_msgs::msg::State & msg)
+{
   vehicle_state_pub_->publish(msg);
 }
 
+void EstimatorROS::fill_diagnostics(rosplane_msgs::msg::EstimatorDiagnostics & diagnostics)
+{
+  diagnostics.covariance_diagonal.clear();
+}
+
+bool EstimatorROS::fill_innovations(rosplane_msgs::msg::EstimatorInnovations &) { return false; }
+
+void EstimatorROS::publish_diagnostics(const rosplane_msgs::msg::EstimatorDiagnostics & msg)
+{
+  diagnostics_pub_->publish(msg);
+}
+
+void EstimatorROS::publish_innovations(const rosplane_msgs::msg::EstimatorInnovations & msg)
+{
+  innovations_pub_->publish(msg);
+}
+
+void EstimatorROS::record_innovations(const rclcpp::Time & stamp)
+{
+  int64_t decimation = innovations_decimation_.get();
+  if (decimation <= 0 || ++innovations_estimates_ < decimation) {
+    return;
+  }
+  innovations_estimates_ = 0;
+
+  if (fill_innovations(innovations_msg_)) {
+    innovations_msg_.header.stamp = stamp;
+    publish_innovations(innovations_msg_);
+  }
+}
+
+void EstimatorROS::record_diagnostics(const rclcpp::Time & stamp, bool ran_estimate,
+                                      double estimate_time)
+{
+  int64_t decimation = diagnostics_decimation_.get();
+  if (decimation <= 0) {
+    last_tick_time_init_ = false;
+    return;
+  }
+
+  // The jitter is how far the wall clock time since the last tick is from the time step the tick
+  // estimated over, the timer period or the IMU sample interval in event-driven mode.
+  auto now = std::chrono::steady_clock::now();
+  if (last_tick_time_init_) {
+    double jitter =
+      fabs(std::chrono::duration<double>(now - last_tick_time_).count() - input_.Ts);
+    tick_jitter_sum_ += jitter;
+    tick_jitter_max_ = std::max(tick_jitter_max_, jitter);
+    tick_jitter_count_++;
+  }
+  last_tick_time_ = now;
+  last_tick_time_init_ = true;
+
+  if (!diagnostics_window_init_) {
+    diagnostics_window_start_ = stamp.seconds();
+    diagnostics_window_init_ = true;
+  }
+
+  if (ran_estimate) {
+    estimate_times_.push_back(estimate_time);
+  }
+  diagnostics_ticks_++;
+
+  if (diagnostics_ticks_ >= decimation) {
+    finish_diagnostics_window(stamp);
+  }
+}
+
+void EstimatorROS::finish_diagnostics_window(const rclcpp::Time & stamp)
+{
+  double now = stamp.seconds();
+  double window = now - diagnostics_window_start_;
+
+  diagnostics_.header.stamp = stamp;
+  diagnostics_.ticks = diagnostics_ticks_;
+  diagnostics_.estimates = estimate_times_.size();
+
+  if (estimate_times_.empty()) {
+    diagnostics_.estimate_time_min = 0.0;
+    diagnostics_.estimate_time_mean = 0.0;
+    diagnostics_.estimate_time_p99 = 0.0;
+    diagnostics_.estimate_time_max = 0.0;
+  } else {
+    auto [min_time, max_time] = std::minmax_element(estimate_times_.begin(), estimate_times_.end());
+    diagnostics_.estimate_time_min = *min_time;
+    diagnostics_.estimate_time_max = *max_time;
+    diagnostics_.estimate_time_mean =
+      std::accumulate(estimate_times_.begin(), estimate_times_.end(), 0.0)
+      / estimate_times_.size();
+
+    // The times are discarded after this, so they can be partially sorted in place.
+    auto p99 = estimate_times_.begin() + (estimate_times_.size() - 1) * 99 / 100;
+    std::nth_element(estimate_times_.begin(), p99, estimate_times_.end());
+    diagnostics_.estimate_time_p99 = *p99;
+  }
+
+  diagnostics_.tick_jitter_mean =
+    tick_jitter_count_ > 0 ? tick_jitter_sum_ / tick_jitter_count_ : 0.0;
+  diagnostics_.tick_jitter_max = tick_jitter_max_;
+
+  auto rate = [window](const SensorStats & stats) {
+    return window > 0.0 ? static_cast<float>(stats.count / window) : 0.0f;
+  };
+  auto age = [now](const SensorStats & stats) {
+    return stats.received ? static_cast<float>(now - stats.last_stamp) : -1.0f;
+  };
+  diagnostics_.imu_rate = rate(imu_stats_);
+  diagnostics_.baro_rate = rate(baro_stats_);
+  diagnostics_.airspeed_rate = rate(airspeed_stats_);
+  diagnostics_.gnss_fix_rate = rate(gnss_fix_stats_);
+  diagnostics_.gnss_vel_rate = rate(gnss_vel_stats_);
+  diagnostics_.imu_age = age(imu_stats_);
+  diagnostics_.baro_age = age(baro_stats_);
+  diagnostics_.airspeed_age = age(airspeed_stats_);
+  diagnostics_.gnss_fix_age = age(gnss_fix_stats_);
+  diagnostics_.gnss_vel_age = age(gnss_vel_stats_);
+
+  diagnostics_.imu_samples_dropped =
+    imu_samples_dropped_ + imu_samples_overflowed_.load(std::memory_order_relaxed);
+  diagnostics_.imu_samples_duplicated = imu_samples_duplicated_;
+  diagnostics_.held_measurements_dropped = held_measurements_dropped_;
+
+  fill_diagnostics(diagnostics_);
+
+  publish_diagnostics(diagnostics_);
+
+  // Start the next window. The tick that published belongs to both, so the rates cover the whole
+  // time between messages.
+  estimate_times_.clear();
+  diagnostics_ticks_ = 0;
+  tick_jitter_sum_ = 0.0;
+  tick_jitter_max_ = 0.0;
+  tick_jitter_count_ = 0;
+  diagnostics_window_start_ = now;
+  imu_stats_.count = 0;
+  baro_stats_.count = 0;
+  airspeed_stats_.count = 0;
+  gnss_fix_stats_.count = 0;
+  gnss_vel_stats_.count = 0;
+}
+
+void EstimatorROS::integrate_imu_samples()
+{
+  bool had_samples = imu_stamp_init_;
+  double total_dt = 0.0;
+  double delta_angle_x = 0.0, delta_angle_y = 0.0, delta_angle_z = 0.0;
+  double delta_vel_x = 0.0, delta_vel_y = 0.0, delta_vel_z = 0.0;
+  int num_samples = 0;
+
+  ImuSample sample;
+  while (imu_buffer_.pop(sample)) {
+    if (imu_stamp_init_ && sample.stamp <= last_imu_stamp_) {
+      // A repeated or out of order sample covers no time.
+      imu_samples_duplicated_ += 1;
+      continue;
+    }
+    imu_stats_.record(sample.stamp);
+
+    // Each sample is held over the time since the previous one. The first sample ever received
+    // has no interval, so it only sets the inputs.
+    double dt = imu_stamp_init_ ? (sample.stamp - last_imu_stamp_).seconds() : 0.0;
+    last_imu_stamp_ = sample.stamp;
+    imu_stamp_init_ = true;
+
+    input_.gyro_x = sample.gyro_x;
+    input_.gyro_y = sample.gyro_y;
+    input_.gyro_z = sample.gyro_z;
+    input_.accel_x = sample.accel_x;
+    input_.accel_y = sample.accel_y;
+    input_.accel_z = sample.accel_z;
+
+    total_dt += dt;
+    delta_angle_x += sample.gyro_x * dt;
+    delta_angle_y += sample.gyro_y * dt;
+    delta_angle_z += sample.gyro_z * dt;
+    delta_vel_x += sample.accel_x * dt;
+    delta_vel_y += sample.accel_y * dt;
+    delta_vel_z += sample.accel_z * dt;
+    num_samples++;
+  }
+
+  if (total_dt > 0.0) {
+    input_.gyro_x = delta_angle_x / total_dt;
+    input_.gyro_y = delta_angle_y / total_dt;
+    input_.gyro_z = delta_angle_z / total_dt;
+    input_.accel_x = delta_vel_x / total_dt;
+    input_.accel_y = delta_vel_y / total_dt;
+    input_.accel_z = delta_vel_z / total_dt;
+  }
+
+  // A tick without a new sample reuses the previous one.
+  if (had_samples && num_samples == 0) {
+    imu_samples_duplicated_ += 1;
+  }
+
+  report_imu_sample_counts();
+}
+
+void EstimatorROS::process_imu_samples()
+{
+  ImuSample sample;
+  while (imu_buffer_.pop(sample)) {
+    if (imu_stamp_init_ && sample.stamp <= last_imu_stamp_) {
+      // A repeated or out of order sample has nothing new to propagate with.
+      imu_samples_duplicated_ += 1;
+      continue;
+    }
+    imu_stats_.record(sample.stamp);
+    imu_update(sample);
+  }
+
+  report_imu_sample_counts();
+}
+
+void EstimatorROS::imu_update(const ImuSample & sample)
+{
+  input_.gyro_x = sample.gyro_x;
+  input_.gyro_y = sample.gyro_y;
+  input_.gyro_z = sample.gyro_z;
+  input_.accel_x = sample.accel_x;
+  input_.accel_y = sample.accel_y;
+  input_.accel_z = sample.accel_z;
+
+  const rclcpp::Time & stamp = sample.stamp;
+  if (!imu_stamp_init_) {
+    // There is no time step until a second sample arrives.
+    last_imu_stamp_ = stamp;
+    imu_stamp_init_ = true;
+    release_held_measurements(stamp);
+    return;
+  }
+
+  double Ts = (stamp - last_imu_stamp_).seconds();
+
+  // Any whole IMU periods missing from the gap are samples that never reached the estimator.
+  double nominal_period = 1.0 / update_frequency_.get();
+  int missed_samples = static_cast<int>(std::round(Ts / nominal_period)) - 1;
+  if (missed_samples > 0) {
+    imu_samples_dropped_ += missed_samples;
+  }
+
+  last_imu_stamp_ = stamp;
+  release_held_measurements(stamp);
+
+  input_.Ts = Ts;
+  update();
+}
+
+bool EstimatorROS::is_ahead_of_imu(const builtin_interfaces::msg::Time & stamp)
+{
+  return event_driven_ && imu_stamp_init_ && rclcpp::Time(stamp) > last_imu_stamp_;
+}
+
+void EstimatorROS::release_held_measurements(const rclcpp::Time & stamp)
+{
+  // Outside of event-driven mode everything that is held is released. The callbacks are called
+  // after last_imu_stamp_ has been advanced, so they apply the measurement instead of holding it.
+  release_held(held_baro_, stamp, &EstimatorROS::baroAltCallback);
+  release_held(held_airspeed_, stamp, &EstimatorROS::airspeedCallback);
+  release_held(held_gnss_fix_, stamp, &EstimatorROS::gnssFixCallback);
+  release_held(held_gnss_vel_, stamp, &EstimatorROS::gnssVelCallback);
+}
+
+void EstimatorROS::report_imu_sample_counts()
+{
+  int64_t dropped = imu_samples_dropped_ + imu_samples_overflowed_.load(std::memory_order_relaxed);
+  int64_t total = dropped + imu_samples_duplicated_;
+  if (total == imu_samples_reported_) {
+    return;
+  }
+  imu_samples_reported_ = total;
+
+  RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 5000,
+                       "Estimator IMU samples dropped: %ld, duplicated: %ld",
+                       static_cast<long>(dropped), static_cast<long>(imu_samples_duplicated_));
+}
+
 void EstimatorROS::gnssFixCallback(const sensor_msgs::msg::NavSatFix::SharedPtr msg)
 {
+  if (is_ahead_of_imu(msg->header.stamp)) {
+    hold_measurement(held_gnss_fix_, msg);
+    return;
+  }
+  gnss_fix_stats_.record(msg->header.stamp);
+
   bool has_fix = msg->status.status
     >= sensor_msgs::msg::NavSatStatus::STATUS_FIX; // Higher values refer to augmented fixes
   if (!has_fix || !std::isfinite(msg->latitude)) {
@@ -192,88 +633,84 @@ void EstimatorROS::gnssFixCallback(const sensor_msgs::msg::NavSatFix::SharedPtr
     init_alt_ = msg->altitude;
     init_lat_ = msg->latitude;
     init_lon_ = msg->longitude;
+    gps_origin_.set_origin(init_lat_, init_lon_, init_alt_);
     saveParameter("init_lat", init_lat_);
     saveParameter("init_lon", init_lon_);
     saveParameter("init_alt", init_alt_);
   } else {
-    input_.gps_n = EARTH_RADIUS * (msg->latitude - init_lat_) * M_PI / 180.0;
-    input_.gps_e =
-      EARTH_RADIUS * cos(init_lat_ * M_PI / 180.0) * (msg->longitude - init_lon_) * M_PI / 180.0;
+    Eigen::Vector3d ned = gps_origin_.lla_to_ned(msg->latitude, msg->longitude, msg->altitude);
+    input_.gps_n = ned(0);
+    input_.gps_e = ned(1);
+    // The altitude stays the height above the origin rather than the depth below the tangent
+    // plane, which would grow with the curvature of the earth away from the origin.
     input_.gps_h = msg->altitude - init_alt_;
+    input_.gps_stamp = rclcpp::Time(msg->header.stamp).seconds();
     input_.gps_new = true;
   }
 }
 
 void EstimatorROS::gnssVelCallback(const geometry_msgs::msg::TwistStamped::SharedPtr msg)
 {
+  if (is_ahead_of_imu(msg->header.stamp)) {
+    hold_measurement(held_gnss_vel_, msg);
+    return;
+  }
+  gnss_vel_stats_.record(msg->header.stamp);
+
   // Rename parameter here for clarity
-  double ground_speed_threshold = params_.get_double("gps_ground_speed_threshold");
+  double ground_speed_threshold = gps_ground_speed_threshold_.get();
 
   double v_n = msg->twist.linear.x;
   double v_e = msg->twist.linear.y;
-  //  double v_d = msg->twist.linear.z; // This variable was unused.
+  double v_d = msg->twist.linear.z;
   double ground_speed = sqrt(v_n * v_n + v_e * v_e);
   double course =
     atan2(v_e, v_n); //Does this need to be in a specific range? All uses seem to accept anything.
   input_.gps_Vg = ground_speed;
+  input_.gps_vd = v_d;
   if (ground_speed > ground_speed_threshold)
     input_.gps_course = course;
 }
 
 void EstimatorROS::imuCallback(const sensor_msgs::msg::Imu::SharedPtr msg)
 {
-  input_.accel_x = msg->linear_acceleration.x;
-  input_.accel_y = msg->linear_acceleration.y;
-  input_.accel_z = msg->linear_acceleration.z;
+  ImuSample sample;
+  sample.stamp = rclcpp::Time(msg->header.stamp);
+
+  sample.accel_x = msg->linear_acceleration.x;
+  sample.accel_y = msg->linear_acceleration.y;
+  sample.accel_z = msg->linear_acceleration.z;
+
+  sample.gyro_x = msg->angular_velocity.x;
+  sample.gyro_y = msg->angular_velocity.y;
+  sample.gyro_z = msg->angular_velocity.z;
 
-  input_.gyro_x = msg->angular_velocity.x;
-  input_.gyro_y = msg->angular_velocity.y;
-  input_.gyro_z = msg->angular_velocity.z;
+  if (!imu_buffer_.push(sample)) {
+    imu_samples_overflowed_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // In event-driven mode this callback is also the consumer and runs the estimator itself.
+  if (event_driven_) {
+    process_imu_samples();
+  }
 }
 
 void EstimatorROS::baroAltCallback(const rosflight_msgs::msg::Barometer::SharedPtr msg)
 {
+  if (is_ahead_of_imu(msg->header.stamp)) {
+    hold_measurement(held_baro_, msg);
+    return;
+  }
+  baro_stats_.record(msg->header.stamp);
+
   // For readability, declare the parameters here
-  double rho = params_.get_double("rho");
-  double gravity = params_.get_double("gravity");
-  double gate_gain_constant = params_.get_double("baro_measurement_gate");
-  double baro_calib_count = params_.get_int("baro_calibration_count");
+  double rho = rho_.get();
+  double gravity = gravity_.get();
+  double gate_gain_constant = baro_measurement_gate_.get();
 
   if (armed_first_time_ && !baro_init_) {
-    if (baro_count_ < baro_calib_count) {
-      init_static_ += msg->pressure;
-      init_static_vector_.push_back(msg->pressure);
-      input_.static_pres = 0;
-      baro_count_ += 1;
-    } else {
-      init_static_ = std::accumulate(init_static_vector_.begin(), init_static_vector_.end(), 0.0)
-        / init_static_vector_.size();
-      baro_init_ = true;
-      saveParameter("baro_calibration_val", init_static_);
-
-      //Check that it got a good calibration.
-      std::sort(init_static_vector_.begin(), init_static_vector_.end());
-      float q1 = (init_static_vector_[24] + init_static_vector_[25]) / 2.0;
-      float q3 = (init_static_vector_[74] + init_static_vector_[75]) / 2.0;
-      float IQR = q3 - q1;
-      float upper_bound = q3 + 2.0 * IQR;
-      float lower_bound = q1 - 2.0 * IQR;
-      for (int i = 0; i < baro_calib_count; i++) {
-        if (init_static_vector_[i] > upper_bound) {
-          baro_init_ = false;
-          baro_count_ = 0;
-          init_static_vector_.clear();
-          RCLCPP_WARN(this->get_logger(), "Bad baro calibration. Recalibrating");
-          break;
-        } else if (init_static_vector_[i] < lower_bound) {
-          baro_init_ = false;
-          baro_count_ = 0;
-          init_static_vector_.clear();
-          RCLCPP_WARN(this->get_logger(), "Bad baro calibration. Recalibrating");
-          break;
-        }
-      }
-    }
+    input_.static_pres = 0;
+    calibrate_baro(msg->pressure, msg->header.stamp);
   } else {
     float static_pres_old = input_.static_pres;
     input_.static_pres = -msg->pressure + init_static_;
@@ -284,14 +721,99 @@ void EstimatorROS::baroAltCallback(const rosflight_msgs::msg::Barometer::SharedP
     } else if (input_.static_pres > static_pres_old + gate_gain) {
       input_.static_pres = static_pres_old + gate_gain;
     }
+    input_.baro_new = true;
   }
 }
 
+void EstimatorROS::calibrate_baro(double pressure, const builtin_interfaces::msg::Time & stamp)
+{
+  // For readability, declare the parameters here
+  uint32_t baro_calib_count = std::max<int64_t>(baro_calibration_count_.get(), 1);
+  double fence = baro_calibration_outlier_fence_.get();
+  double max_outliers = baro_calibration_max_outliers_.get();
+
+  baro_q1_.add(pressure);
+  baro_q3_.add(pressure);
+
+  // The quartiles of the first few samples are too rough to judge outliers by, so accept those.
+  bool outlier = false;
+  if (baro_q1_.count() > 5) {
+    double q1 = baro_q1_.quantile();
+    double q3 = baro_q3_.quantile();
+    double iqr = q3 - q1;
+    outlier = pressure > q3 + fence * iqr || pressure < q1 - fence * iqr;
+  }
+
+  if (outlier) {
+    baro_outliers_++;
+  } else {
+    baro_calibration_stats_.add(pressure);
+  }
+
+  if (baro_calibration_stats_.count() >= baro_calib_count) {
+    double outlier_fraction =
+      static_cast<double>(baro_outliers_) / (baro_outliers_ + baro_calibration_stats_.count());
+    if (outlier_fraction > max_outliers) {
+      RCLCPP_WARN_STREAM(this->get_logger(),
+                         "Bad baro calibration, " << baro_outliers_
+                                                  << " outliers. Recalibrating");
+      baro_calibration_restarts_++;
+      publish_baro_calibration(stamp);
+      reset_baro_calibration();
+      return;
+    }
+
+    init_static_ = baro_calibration_stats_.mean();
+    baro_init_ = true;
+    saveParameter("baro_calibration_val", init_static_);
+    RCLCPP_INFO_STREAM(this->get_logger(),
+                       "Baro calibrated: " << init_static_ << " Pa, standard deviation "
+                                           << baro_calibration_stats_.std_dev() << " Pa, "
+                                           << baro_outliers_ << " outliers");
+  }
+
+  publish_baro_calibration(stamp);
+}
+
+void EstimatorROS::reset_baro_calibration()
+{
+  baro_calibration_stats_.reset();
+  baro_q1_.reset();
+  baro_q3_.reset();
+  baro_outliers_ = 0;
+}
+
+void EstimatorROS::publish_baro_calibration(const builtin_interfaces::msg::Time & stamp)
+{
+  uint32_t baro_calib_count = std::max<int64_t>(baro_calibration_count_.get(), 1);
+
+  rosplane_msgs::msg::BaroCalibration msg;
+  msg.header.stamp = stamp;
+  msg.calibrated = baro_init_;
+  msg.samples = baro_calibration_stats_.count();
+  msg.samples_required = baro_calib_count;
+  msg.progress =
+    baro_init_ ? 1.0 : std::min(1.0, static_cast<double>(msg.samples) / baro_calib_count);
+  msg.outliers = baro_outliers_;
+  msg.restarts = baro_calibration_restarts_;
+  msg.static_pressure = baro_init_ ? init_static_ : baro_calibration_stats_.mean();
+  msg.std_dev = baro_calibration_stats_.std_dev();
+  msg.q1 = baro_q1_.quantile();
+  msg.q3 = baro_q3_.quantile();
+  baro_calibration_pub_->publish(msg);
+}
+
 void EstimatorROS::airspeedCallback(const rosflight_msgs::msg::Airspeed::SharedPtr msg)
 {
+  if (is_ahead_of_imu(msg->header.stamp)) {
+    hold_measurement(held_airspeed_, msg);
+    return;
+  }
+  airspeed_stats_.record(msg->header.stamp);
+
   // For readability, declare the parameters here
-  double rho = params_.get_double("rho");
-  double gate_gain_constant = params_.get_double("airspeed_measurement_gate");
+  double rho = rho_.get();
+  double gate_gain_constant = airspeed_measurement_gate_.get();
 
   float diff_pres_old = input_.diff_pres;
   input_.diff_pres = msg->differential_pressure;
@@ -302,6 +824,7 @@ void EstimatorROS::airspeedCallback(const rosflight_msgs::msg::Airspeed::SharedP
   } else if (input_.diff_pres > diff_pres_old + gate_gain) {
     input_.diff_pres = diff_pres_old + gate_gain;
   }
+  input_.airspeed_new = true;
 }
 
 void EstimatorROS::statusCallback(const rosflight_msgs::msg::Status::SharedPtr msg)
@@ -310,45 +833,73 @@ void EstimatorROS::statusCallback(const rosflight_msgs::msg::Status::SharedPtr m
     armed_first_time_ = true;
 }
 
-void EstimatorROS::saveParameter(std::string param_name, double param_val)
+void EstimatorROS::seed_from_parameters()
 {
-
-  YAML::Node param_yaml_file = YAML::LoadFile(param_filepath_);
-
-  if (param_yaml_file["estimator"]["ros__parameters"][param_name]) {
-    param_yaml_file["estimator"]["ros__parameters"][param_name] = param_val;
-  } else {
-    RCLCPP_ERROR_STREAM(this->get_logger(),
-                        "Parameter [" << param_name << "] is not in parameter file.");
-  }
-
-  std::ofstream fout(param_filepath_);
-  fout << param_yaml_file;
+  double init_lat = params_.get_double("init_lat");
+  double init_long = params_.get_double("init_lon");
+  double init_alt = params_.get_double("init_alt");
+  double init_static = params_.get_double("baro_calibration_val");
+
+  RCLCPP_INFO_STREAM(this->get_logger(), "Using seeded estimator values.");
+  RCLCPP_INFO_STREAM(this->get_logger(), "Seeded initial latitude: " << init_lat);
+  RCLCPP_INFO_STREAM(this->get_logger(), "Seeded initial longitude: " << init_long);
+  RCLCPP_INFO_STREAM(this->get_logger(), "Seeded initial altitude: " << init_alt);
+  RCLCPP_INFO_STREAM(this->get_logger(), "Seeded barometer calibration value: " << init_static);
+
+  gps_init_ = true;
+  init_lat_ = init_lat;
+  init_lon_ = init_long;
+  init_alt_ = init_alt;
+  gps_origin_.set_origin(init_lat_, init_lon_, init_alt_);
+
+  baro_init_ = true;
+  init_static_ = init_static;
+  publish_baro_calibration(this->now());
+
+  gyro_bias_seed_ = persisted_gyro_bias_;
+  accel_bias_seed_ = persisted_accel_bias_;
+  RCLCPP_INFO_STREAM(this->get_logger(),
+                     "Seeded gyro bias: " << gyro_bias_seed_.transpose()
+                                          << ", accel bias: " << accel_bias_seed_.transpose());
 }
 
-} // namespace rosplane
-
-int main(int argc, char ** argv)
+void EstimatorROS::persist_imu_biases(const Eigen::Vector3f & gyro_bias,
+                                      const Eigen::Vector3f & gyro_bias_var,
+                                      const Eigen::Vector3f & accel_bias,
+                                      const Eigen::Vector3f & accel_bias_var)
 {
-
-  rclcpp::init(argc, argv);
-
-  char* use_params;
-  if (argc >= 2) {
-    use_params = argv[1];
+  // For readability, declare the parameters here
+  float gyro_converged_std = gyro_bias_converged_std_.get();
+  float accel_converged_std = accel_bias_converged_std_.get();
+
+  bool save_gyro = gyro_bias_var.maxCoeff() < gyro_converged_std * gyro_converged_std
+    && (gyro_bias - persisted_gyro_bias_).cwiseAbs().maxCoeff() > gyro_converged_std;
+  bool save_accel = accel_bias_var.maxCoeff() < accel_converged_std * accel_converged_std
+    && (accel_bias - persisted_accel_bias_).cwiseAbs().maxCoeff() > accel_converged_std;
+  if (!save_gyro && !save_accel) {
+    return;
   }
 
-  if (!strcmp(use_params, "true")) {
-    rclcpp::spin(std::make_shared<rosplane::EstimatorContinuousDiscrete>(use_params));
-  } else if (strcmp(use_params, "false")) // If the string is not true or false print error.
-  {
-    auto estimator_node = std::make_shared<rosplane::EstimatorContinuousDiscrete>();
-    RCLCPP_WARN(estimator_node->get_logger(),
-                "Invalid option for seeding estimator, defaulting to unseeded.");
-    rclcpp::spin(estimator_node);
-  } else {
-    rclcpp::spin(std::make_shared<rosplane::EstimatorContinuousDiscrete>());
+  if (save_gyro) {
+    saveParameter("gyro_bias_x", gyro_bias(0));
+    saveParameter("gyro_bias_y", gyro_bias(1));
+    saveParameter("gyro_bias_z", gyro_bias(2));
+    persisted_gyro_bias_ = gyro_bias;
   }
+  if (save_accel) {
+    saveParameter("accel_bias_x", accel_bias(0));
+    saveParameter("accel_bias_y", accel_bias(1));
+    saveParameter("accel_bias_z", accel_bias(2));
+    persisted_accel_bias_ = accel_bias;
+  }
+  RCLCPP_INFO_STREAM(this->get_logger(), "Saved IMU biases, gyro: "
+                                            << persisted_gyro_bias_.transpose()
+                                            << ", accel: " << persisted_accel_bias_.transpose());
+}
 
-  return 0;
+void EstimatorROS::saveParameter(std::string param_name, double param_val)
+{
+  params_.persist(param_name, param_val);
 }
+
+} // namespace rosplane
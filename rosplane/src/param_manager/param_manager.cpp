@@ -7,6 +7,7 @@ namespace rosplane
 
 ParamManager::ParamManager(rclcpp::Node * node)
     : container_node_{node}
+    , revision_{0}
 {}
 
 void ParamManager::declare_double(std::string param_name, double value)
@@ -41,6 +42,14 @@ void ParamManager::declare_string(std::string param_name, std::string value)
   container_node_->declare_parameter(param_name, value);
 }
 
+void ParamManager::declare_double_array(std::string param_name, std::vector<double> value)
+{
+  // Insert the parameter into the parameter struct
+  params_[param_name] = value;
+  // Declare each of the parameters, making it visible to the ROS2 param system.
+  container_node_->declare_parameter(param_name, value);
+}
+
 void ParamManager::set_double(std::string param_name, double value)
 {
   // Check that the parameter is in the parameter struct
@@ -52,6 +61,7 @@ void ParamManager::set_double(std::string param_name, double value)
 
   // Set the parameter in the parameter struct
   params_[param_name] = value;
+  revision_++;
   // Set the parameter in the ROS2 param system
   container_node_->set_parameter(rclcpp::Parameter(param_name, value));
 }
@@ -67,6 +77,7 @@ void ParamManager::set_bool(std::string param_name, bool value)
 
   // Set the parameter in the parameter struct
   params_[param_name] = value;
+  revision_++;
   // Set the parameter in the ROS2 param system
   container_node_->set_parameter(rclcpp::Parameter(param_name, value));
 }
@@ -82,6 +93,7 @@ void ParamManager::set_int(std::string param_name, int64_t value)
 
   // Set the parameter in the parameter struct
   params_[param_name] = value;
+  revision_++;
   // Set the parameter in the ROS2 param system
   container_node_->set_parameter(rclcpp::Parameter(param_name, value));
 }
@@ -97,6 +109,7 @@ void ParamManager::set_string(std::string param_name, std::string value)
 
   // Set the parameter in the parameter struct
   params_[param_name] = value;
+  revision_++;
   // Set the parameter in the ROS2 param system
   container_node_->set_parameter(rclcpp::Parameter(param_name, value));
 }
@@ -141,6 +154,42 @@ std::string ParamManager::get_string(std::string param_name)
   }
 }
 
+std::vector<double> ParamManager::get_double_array(std::string param_name)
+{
+  try {
+    return std::get<std::vector<double>>(params_[param_name]);
+  } catch (std::bad_variant_access & e) {
+    RCLCPP_ERROR_STREAM(container_node_->get_logger(), "ERROR GETTING PARAMETER: " + param_name);
+    throw std::runtime_error(e.what());
+  }
+}
+
+template<typename T>
+const ParamValue * ParamManager::find_param(const std::string & param_name)
+{
+  auto param = params_.find(param_name);
+  if (param == params_.end() || !std::holds_alternative<T>(param->second)) {
+    RCLCPP_ERROR_STREAM(container_node_->get_logger(), "ERROR GETTING PARAMETER: " + param_name);
+    throw std::runtime_error("Parameter not found in parameter struct: " + param_name);
+  }
+  return &param->second;
+}
+
+ParamHandle<double> ParamManager::get_double_handle(std::string param_name)
+{
+  return ParamHandle<double>(find_param<double>(param_name));
+}
+
+ParamHandle<bool> ParamManager::get_bool_handle(std::string param_name)
+{
+  return ParamHandle<bool>(find_param<bool>(param_name));
+}
+
+ParamHandle<int64_t> ParamManager::get_int_handle(std::string param_name)
+{
+  return ParamHandle<int64_t>(find_param<int64_t>(param_name));
+}
+
 void ParamManager::set_parameters()
 {
 
@@ -156,11 +205,15 @@ void ParamManager::set_parameters()
       params_[key] = container_node_->get_parameter(key).as_int();
     else if (type == rclcpp::ParameterType::PARAMETER_STRING)
       params_[key] = container_node_->get_parameter(key).as_string();
+    else if (type == rclcpp::ParameterType::PARAMETER_DOUBLE_ARRAY)
+      params_[key] = container_node_->get_parameter(key).as_double_array();
     else
       RCLCPP_ERROR_STREAM(container_node_->get_logger(),
                           "Unable to set parameter: " + key
-                            + ". Error casting parameter as double, int, string, or bool!");
+                            + ". Error casting parameter as double, int, string, bool, or double "
+                              "array!");
   }
+  revision_++;
 }
 
 bool ParamManager::set_parameters_callback(const std::vector<rclcpp::Parameter> & parameters)
@@ -185,12 +238,51 @@ bool ParamManager::set_parameters_callback(const std::vector<rclcpp::Parameter>
       params_[param.get_name()] = param.as_int();
     else if (param.get_type() == rclcpp::ParameterType::PARAMETER_STRING)
       params_[param.get_name()] = param.as_string();
+    else if (param.get_type() == rclcpp::ParameterType::PARAMETER_DOUBLE_ARRAY)
+      params_[param.get_name()] = param.as_double_array();
     else
       RCLCPP_ERROR_STREAM(container_node_->get_logger(),
                           "Unable to determine parameter type in controller. Type is "
                             + std::to_string(param.get_type()));
   }
+  revision_++;
   return true;
 }
 
+void ParamManager::set_persistence_file(std::string file_path, std::string node_section)
+{
+  persistence_ = std::make_unique<ParamPersistence>(std::move(file_path), std::move(node_section),
+                                                    container_node_->get_logger());
+}
+
+void ParamManager::persist(std::string param_name, ParamValue value)
+{
+  if (!persistence_) {
+    RCLCPP_ERROR_STREAM(container_node_->get_logger(),
+                        "No parameter file to persist parameter to: " + param_name);
+    return;
+  }
+
+  persistence_->save(param_name, value);
+}
+
+void ParamManager::persist(std::string param_name)
+{
+  // Check that the parameter is in the parameter struct
+  if (params_.find(param_name) == params_.end()) {
+    RCLCPP_ERROR_STREAM(container_node_->get_logger(),
+                        "Parameter not found in parameter struct: " + param_name);
+    return;
+  }
+
+  persist(param_name, params_[param_name]);
+}
+
+void ParamManager::flush_persistence()
+{
+  if (persistence_) {
+    persistence_->flush();
+  }
+}
+
 } // namespace rosplane
\ No newline at end of file
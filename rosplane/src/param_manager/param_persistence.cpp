@@ -0,0 +1,148 @@
+#include <filesystem>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <yaml-cpp/yaml.h>
+
+#include "param_persistence.hpp"
+
+namespace rosplane
+{
+
+namespace
+{
+
+/**
+ * @brief Flushes a file or directory to the disk.
+ * @return Whether the sync succeeded.
+ */
+bool sync_to_disk(const std::filesystem::path & path, int flags)
+{
+  int fd = ::open(path.c_str(), flags);
+  if (fd < 0) {
+    return false;
+  }
+  bool synced = ::fsync(fd) == 0;
+  synced = ::close(fd) == 0 && synced;
+  return synced;
+}
+
+} // namespace
+
+ParamPersistence::ParamPersistence(std::string file_path, std::string node_section,
+                                   rclcpp::Logger logger)
+    : file_path_{std::move(file_path)}
+    , node_section_{std::move(node_section)}
+    , logger_{logger}
+    , queued_count_{0}
+    , written_count_{0}
+    , stopping_{false}
+    , worker_{&ParamPersistence::run, this}
+{}
+
+ParamPersistence::~ParamPersistence()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_one();
+  worker_.join();
+}
+
+void ParamPersistence::save(const std::string & param_name, const ParamValue & value)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_[param_name] = value;
+    queued_count_++;
+  }
+  work_available_.notify_one();
+}
+
+void ParamPersistence::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t target = queued_count_;
+  work_done_.wait(lock, [this, target]() { return written_count_ >= target; });
+}
+
+void ParamPersistence::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_available_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+    if (pending_.empty()) {
+      // Only reached when stopping, after everything queued has been written.
+      return;
+    }
+
+    // Take everything queued so far and write it in one pass, without holding the lock, so save()
+    // never waits on the disk.
+    std::map<std::string, ParamValue> values;
+    values.swap(pending_);
+    uint64_t batch_end = queued_count_;
+
+    lock.unlock();
+    write(values);
+    lock.lock();
+
+    written_count_ = batch_end;
+    work_done_.notify_all();
+  }
+}
+
+void ParamPersistence::write(const std::map<std::string, ParamValue> & values)
+{
+  try {
+    // Replace the file a symlink points to rather than the symlink itself.
+    std::filesystem::path target = file_path_;
+    if (std::filesystem::is_symlink(target)) {
+      target = std::filesystem::canonical(target);
+    }
+
+    YAML::Node param_yaml_file = YAML::LoadFile(target.string());
+    YAML::Node node_params = param_yaml_file[node_section_]["ros__parameters"];
+
+    for (const auto & [param_name, value] : values) {
+      if (node_params[param_name]) {
+        std::visit([&node_params, &param_name = param_name](const auto & v) {
+          node_params[param_name] = v;
+        }, value);
+      } else {
+        RCLCPP_ERROR_STREAM(logger_, "Parameter [" << param_name << "] is not in parameter file.");
+      }
+    }
+
+    // Write the new contents next to the file and rename it over the original. The rename is
+    // atomic, so the file is never seen half written. The data is synced before the rename so the
+    // rename cannot reach the disk ahead of it, and the directory after it so the rename survives
+    // a power loss.
+    std::filesystem::path temp_path = target;
+    temp_path += ".tmp";
+    {
+      std::ofstream fout(temp_path);
+      fout << param_yaml_file << '\n';
+      fout.flush();
+      if (!fout) {
+        RCLCPP_ERROR_STREAM(logger_, "Failed to write parameter file " << temp_path.string());
+        return;
+      }
+    }
+    if (!sync_to_disk(temp_path, O_WRONLY)) {
+      RCLCPP_ERROR_STREAM(logger_, "Failed to sync parameter file " << temp_path.string());
+      return;
+    }
+    std::filesystem::rename(temp_path, target);
+    std::filesystem::path directory = target.has_parent_path() ? target.parent_path() : ".";
+    if (!sync_to_disk(directory, O_RDONLY | O_DIRECTORY)) {
+      RCLCPP_WARN_STREAM(logger_, "Failed to sync the directory of " << target.string()
+                                    << ", the new parameters may not survive a power loss.");
+    }
+  } catch (const std::exception & e) {
+    RCLCPP_ERROR_STREAM(logger_, "Failed to save parameters to " << file_path_ << ": " << e.what());
+  }
+}
+
+} // namespace rosplane
@@ -1,14 +1,12 @@
 #include <rclcpp/logging.hpp>
 
-#include "path_follower_example.hpp"
-
 #include "path_follower_base.hpp"
 
 namespace rosplane
 {
 
-PathFollowerBase::PathFollowerBase()
-    : Node("path_follower_base")
+PathFollowerBase::PathFollowerBase(const rclcpp::NodeOptions & options)
+    : Node("path_follower_base", options)
     , params_(this)
     , params_initialized_(false)
 {
@@ -55,22 +53,23 @@ void PathFollowerBase::update()
 
   if (state_init_ == true && current_path_init_ == true) {
     follow(input_, output);
-    rosplane_msgs::msg::ControllerCommands msg;
+    auto msg = std::make_unique<rosplane_msgs::msg::ControllerCommands>();
 
     rclcpp::Time now = this->get_clock()->now();
 
     // Populate the message with the required information
-    msg.header.stamp = now;
-    msg.chi_c = output.chi_c;
-    msg.va_c = output.va_c;
-    msg.h_c = output.h_c;
-    msg.phi_ff = output.phi_ff;
-
-    controller_commands_pub_->publish(msg);
+    msg->header.stamp = now;
+    msg->chi_c = output.chi_c;
+    msg->va_c = output.va_c;
+    msg->h_c = output.h_c;
+    msg->phi_ff = output.phi_ff;
+
+    // Publishing the unique pointer lets an intra-process controller take the message as is.
+    controller_commands_pub_->publish(std::move(msg));
   }
 }
 
-void PathFollowerBase::vehicle_state_callback(const rosplane_msgs::msg::State::SharedPtr msg)
+void PathFollowerBase::vehicle_state_callback(const rosplane_msgs::msg::State::ConstSharedPtr msg)
 {
   input_.pn = msg->position[0]; /** position north */
   input_.pe = msg->position[1]; /** position east */
@@ -84,7 +83,8 @@ void PathFollowerBase::vehicle_state_callback(const rosplane_msgs::msg::State::S
   state_init_ = true;
 }
 
-void PathFollowerBase::current_path_callback(const rosplane_msgs::msg::CurrentPath::SharedPtr msg)
+void PathFollowerBase::current_path_callback(
+  const rosplane_msgs::msg::CurrentPath::ConstSharedPtr msg)
 {
   if (msg->path_type == msg->LINE_PATH) {
     input_.p_type = PathType::LINE;
@@ -144,11 +144,3 @@ void PathFollowerBase::declare_parameters()
 }
 
 } // namespace rosplane
-
-int main(int argc, char ** argv)
-{
-  rclcpp::init(argc, argv);
-
-  rclcpp::spin(std::make_shared<rosplane::PathFollowerExample>());
-  return 0;
-}
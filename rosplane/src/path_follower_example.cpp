@@ -1,24 +1,27 @@
 #include <rclcpp/logging.hpp>
 
+#include "angles.hpp"
 #include "path_follower_example.hpp"
 
 namespace rosplane
 {
 
-double wrap_within_180(double fixed_heading, double wrapped_heading)
+PathFollowerExample::PathFollowerExample(const rclcpp::NodeOptions & options)
+    : PathFollowerBase(options)
 {
-  return wrapped_heading - floor((wrapped_heading - fixed_heading) / (2 * M_PI) + 0.5) * 2 * M_PI;
+  k_path_ = params_.get_double_handle("k_path");
+  k_orbit_ = params_.get_double_handle("k_orbit");
+  chi_infty_ = params_.get_double_handle("chi_infty");
+  gravity_ = params_.get_double_handle("gravity");
 }
 
-PathFollowerExample::PathFollowerExample() {}
-
 void PathFollowerExample::follow(const Input & input, Output & output)
 {
   // For readability, declare parameters that will be used in the function here
-  double k_path = params_.get_double("k_path");
-  double k_orbit = params_.get_double("k_orbit");
-  double chi_infty = params_.get_double("chi_infty");
-  double gravity = params_.get_double("gravity");
+  double k_path = k_path_.get();
+  double k_orbit = k_orbit_.get();
+  double chi_infty = chi_infty_.get();
+  double gravity = gravity_.get();
 
   // If path_type is a line, follow straight line path specified by r and q
   // Otherwise, follow an orbit path specified by c_orbit, rho_orbit, and lam_orbit
@@ -72,3 +75,6 @@ void PathFollowerExample::follow(const Input & input, Output & output)
 }
 
 } // namespace rosplane
+
+#include <rclcpp_components/register_node_macro.hpp>
+RCLCPP_COMPONENTS_REGISTER_NODE(rosplane::PathFollowerExample)
@@ -1,18 +1,17 @@
 #include <iostream>
 #include <limits>
 
+#include <Eigen/Eigen>
 #include <rclcpp/logging.hpp>
 #include <rclcpp/rclcpp.hpp>
 
-#include "path_manager_example.hpp"
-
 #include "path_manager_base.hpp"
 
 namespace rosplane
 {
 
-PathManagerBase::PathManagerBase()
-    : Node("rosplane_path_manager")
+PathManagerBase::PathManagerBase(const rclcpp::NodeOptions & options)
+    : Node("rosplane_path_manager", options)
     , params_(this)
     , params_initialized_(false)
 {
@@ -37,6 +36,7 @@ PathManagerBase::PathManagerBase()
 
   num_waypoints_ = 0;
 
+  vehicle_state_ = std::make_shared<const rosplane_msgs::msg::State>();
   state_init_ = false;
 }
 
@@ -86,9 +86,10 @@ PathManagerBase::parametersCallback(const std::vector<rclcpp::Parameter> & param
   return result;
 }
 
-void PathManagerBase::vehicle_state_callback(const rosplane_msgs::msg::State & msg)
+void PathManagerBase::vehicle_state_callback(const rosplane_msgs::msg::State::ConstSharedPtr msg)
 {
 
+  // Keep the message rather than copying it, so intra-process subscribers share one message.
   vehicle_state_ = msg;
 
   state_init_ = true;
@@ -113,12 +114,12 @@ void PathManagerBase::new_waypoint_callback(const rosplane_msgs::msg::Waypoint &
   if (waypoints_.size() == 0) {
     Waypoint temp_waypoint;
 
-    temp_waypoint.w[0] = vehicle_state_.position[0];
-    temp_waypoint.w[1] = vehicle_state_.position[1];
+    temp_waypoint.w[0] = vehicle_state_->position[0];
+    temp_waypoint.w[1] = vehicle_state_->position[1];
 
-    if (vehicle_state_.position[2] < -default_altitude) {
+    if (vehicle_state_->position[2] < -default_altitude) {
 
-      temp_waypoint.w[2] = vehicle_state_.position[2];
+      temp_waypoint.w[2] = vehicle_state_->position[2];
     } else {
       temp_waypoint.w[2] = -default_altitude;
     }
@@ -166,10 +167,10 @@ void PathManagerBase::current_path_publish()
 {
 
   Input input;
-  input.pn = vehicle_state_.position[0]; // position north
-  input.pe = vehicle_state_.position[1]; // position east
-  input.h = -vehicle_state_.position[2]; // altitude
-  input.chi = vehicle_state_.chi;
+  input.pn = vehicle_state_->position[0]; // position north
+  input.pe = vehicle_state_->position[1]; // position east
+  input.h = -vehicle_state_->position[2]; // altitude
+  input.chi = vehicle_state_->chi;
 
   Output output;
   output.va_d = 0;
@@ -187,36 +188,27 @@ void PathManagerBase::current_path_publish()
     manage(input, output);
   }
 
-  rosplane_msgs::msg::CurrentPath current_path;
+  auto current_path = std::make_unique<rosplane_msgs::msg::CurrentPath>();
 
   rclcpp::Time now = this->get_clock()->now();
 
   // Populate current_path message
-  current_path.header.stamp = now;
+  current_path->header.stamp = now;
   if (output.flag) {
-    current_path.path_type = current_path.LINE_PATH;
+    current_path->path_type = current_path->LINE_PATH;
   } else {
-    current_path.path_type = current_path.ORBIT_PATH;
+    current_path->path_type = current_path->ORBIT_PATH;
   }
-  current_path.va_d = output.va_d;
+  current_path->va_d = output.va_d;
   for (int i = 0; i < 3; i++) {
-    current_path.r[i] = output.r[i];
-    current_path.q[i] = output.q[i];
-    current_path.c[i] = output.c[i];
+    current_path->r[i] = output.r[i];
+    current_path->q[i] = output.q[i];
+    current_path->c[i] = output.c[i];
   }
-  current_path.rho = output.rho;
-  current_path.lamda = output.lamda;
+  current_path->rho = output.rho;
+  current_path->lamda = output.lamda;
 
-  current_path_pub_->publish(current_path);
+  current_path_pub_->publish(std::move(current_path));
 }
 
 } // namespace rosplane
-
-int main(int argc, char ** argv)
-{
-
-  rclcpp::init(argc, argv);
-  rclcpp::spin(std::make_shared<rosplane::PathManagerExample>());
-
-  return 0;
-}
@@ -10,7 +10,8 @@
 namespace rosplane
 {
 
-PathManagerExample::PathManagerExample()
+PathManagerExample::PathManagerExample(const rclcpp::NodeOptions & options)
+    : PathManagerBase(options)
 {
   fil_state_ = FilletState::STRAIGHT;
   dub_state_ = DubinState::FIRST;
@@ -19,6 +20,11 @@ PathManagerExample::PathManagerExample()
   declare_parameters();
   params_.set_parameters();
 
+  R_min_ = params_.get_double_handle("R_min");
+  default_altitude_ = params_.get_double_handle("default_altitude");
+  default_airspeed_ = params_.get_double_handle("default_airspeed");
+  orbit_last_ = params_.get_bool_handle("orbit_last");
+
   start_time_ = std::chrono::system_clock::now();
 
   first_ = true;
@@ -27,10 +33,10 @@ PathManagerExample::PathManagerExample()
 void PathManagerExample::manage(const Input & input, Output & output)
 {
   // For readability, declare the parameters that will be used in the function here
-  double R_min = params_.get_double("R_min");
-  double default_altitude = params_.get_double(
-    "default_altitude"); // This is the true altitude not the down position (no need for a negative)
-  double default_airspeed = params_.get_double("default_airspeed");
+  double R_min = R_min_.get();
+  // This is the true altitude not the down position (no need for a negative)
+  double default_altitude = default_altitude_.get();
+  double default_airspeed = default_airspeed_.get();
 
   if (num_waypoints_ == 0) {
     auto now = std::chrono::system_clock::now();
@@ -87,7 +93,7 @@ void PathManagerExample::manage(const Input & input, Output & output)
 void PathManagerExample::manage_line(const Input & input, Output & output)
 {
   // For readability, declare the parameters that will be used in the function here
-  bool orbit_last = params_.get_bool("orbit_last");
+  bool orbit_last = orbit_last_.get();
 
   Eigen::Vector3f p;
   p << input.pn, input.pe, -input.h;
@@ -137,8 +143,8 @@ void PathManagerExample::manage_line(const Input & input, Output & output)
 void PathManagerExample::manage_fillet(const Input & input, Output & output)
 {
   // For readability, declare the parameters that will be used in the function here
-  bool orbit_last = params_.get_bool("orbit_last");
-  double R_min = params_.get_double("R_min");
+  bool orbit_last = orbit_last_.get();
+  double R_min = R_min_.get();
 
   if (num_waypoints_ < 3) // Do not attempt to fillet between only 2 points.
   {
@@ -301,7 +307,7 @@ void PathManagerExample::manage_fillet(const Input & input, Output & output)
 void PathManagerExample::manage_dubins(const Input & input, Output & output)
 {
   // For readability, declare the parameters that will be used in the function here
-  double R_min = params_.get_double("R_min");
+  double R_min = R_min_.get();
 
   Eigen::Vector3f p;
   p << input.pn, input.pe, -input.h;
@@ -638,8 +644,8 @@ void PathManagerExample::increment_indices(int & idx_a, int & idx_b, int & idx_c
                                            const Input & input, Output & output)
 {
 
-  bool orbit_last = params_.get_bool("orbit_last");
-  double R_min = params_.get_double("R_min");
+  bool orbit_last = orbit_last_.get();
+  double R_min = R_min_.get();
 
   if (temp_waypoint_ && idx_a_ == 1) {
     waypoints_.erase(waypoints_.begin());
@@ -690,3 +696,6 @@ void PathManagerExample::increment_indices(int & idx_a, int & idx_b, int & idx_c
 }
 
 } // namespace rosplane
+
+#include <rclcpp_components/register_node_macro.hpp>
+RCLCPP_COMPONENTS_REGISTER_NODE(rosplane::PathManagerExample)
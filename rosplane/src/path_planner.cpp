@@ -22,16 +22,23 @@ using std::placeholders::_2;
 namespace rosplane
 {
 
-PathPlanner::PathPlanner()
-    : Node("path_planner")
+PathPlanner::PathPlanner(const rclcpp::NodeOptions & options)
+    : Node("path_planner", options)
     , params_(this)
+    , initial_lat_(0.0)
+    , initial_lon_(0.0)
+    , initial_alt_(0.0)
 {
 
   // Make this publisher transient_local so that it publishes the last 10 waypoints to late subscribers
   rclcpp::QoS qos_transient_local_10_(10);
   qos_transient_local_10_.transient_local();
-  waypoint_publisher_ =
-    this->create_publisher<rosplane_msgs::msg::Waypoint>("waypoint_path", qos_transient_local_10_);
+  // Intra-process communication does not support transient_local, so this publisher always goes
+  // through the middleware, even when the node runs in a component container.
+  rclcpp::PublisherOptions waypoint_publisher_options;
+  waypoint_publisher_options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
+  waypoint_publisher_ = this->create_publisher<rosplane_msgs::msg::Waypoint>(
+    "waypoint_path", qos_transient_local_10_, waypoint_publisher_options);
 
   next_waypoint_service_ = this->create_service<std_srvs::srv::Trigger>(
     "publish_next_waypoint", std::bind(&PathPlanner::publish_next_waypoint, this, _1, _2));
@@ -92,9 +99,15 @@ void PathPlanner::state_callback(const rosplane_msgs::msg::State & msg)
   // Make sure initial LLA is not zero before updating to avoid initialization errors
   // TODO: What if we want to initialize it at (0,0,0)?
   if (fabs(msg.initial_lat) > 0.0 || fabs(msg.initial_lon) > 0.0 || fabs(msg.initial_alt) > 0.0) {
-    initial_lat_ = msg.initial_lat;
-    initial_lon_ = msg.initial_lon;
-    initial_alt_ = msg.initial_alt;
+    // The origin only changes when the estimator reinitializes, so only then recompute the
+    // tangent plane.
+    if (msg.initial_lat != initial_lat_ || msg.initial_lon != initial_lon_
+        || msg.initial_alt != initial_alt_) {
+      initial_lat_ = msg.initial_lat;
+      initial_lon_ = msg.initial_lon;
+      initial_alt_ = msg.initial_alt;
+      origin_.set_origin(initial_lat_, initial_lon_, initial_alt_);
+    }
   }
 }
 
@@ -244,19 +257,19 @@ bool PathPlanner::load_mission_from_file(const std::string & filename)
     assert(root.IsSequence());
     RCLCPP_INFO_STREAM(this->get_logger(), root);
 
+    // Indices in wps and coordinates of the LLA waypoints, converted to NED together at the end
+    std::vector<std::size_t> lla_indices;
+    std::vector<std::array<float, 3>> lla_points;
+
     for (YAML::const_iterator it = root.begin(); it != root.end(); ++it) {
       YAML::Node wp = it->second;
 
       rosplane_msgs::msg::Waypoint new_wp;
       new_wp.w = wp["w"].as<std::array<float, 3>>();
 
-      // If LLA, convert to NED
       if (wp["lla"].as<bool>()) {
-        std::array<double, 3> ned = lla2ned(new_wp.w);
-
-        new_wp.w[0] = ned[0];
-        new_wp.w[1] = ned[1];
-        new_wp.w[2] = ned[2];
+        lla_indices.push_back(wps.size());
+        lla_points.push_back(new_wp.w);
       }
 
       new_wp.chi_d = wp["chi_d"].as<double>();
@@ -266,6 +279,16 @@ bool PathPlanner::load_mission_from_file(const std::string & filename)
       wps.push_back(new_wp);
     }
 
+    // Convert the LLA waypoints to NED
+    if (!lla_points.empty()) {
+      std::vector<std::array<double, 3>> ned = lla2ned(lla_points);
+      for (std::size_t i = 0; i < ned.size(); i++) {
+        wps[lla_indices[i]].w[0] = ned[i][0];
+        wps[lla_indices[i]].w[1] = ned[i][1];
+        wps[lla_indices[i]].w[2] = ned[i][2];
+      }
+    }
+
     return true;
   } catch (...) {
     RCLCPP_ERROR_STREAM(this->get_logger(), "Error while parsing mission YAML file! Check inputs");
@@ -275,28 +298,49 @@ bool PathPlanner::load_mission_from_file(const std::string & filename)
 
 std::array<double, 3> PathPlanner::lla2ned(std::array<float, 3> lla)
 {
-  double lat1 = lla[0];
-  double lon1 = lla[1];
-  double alt1 = lla[2];
+  Eigen::Vector3d ned = origin_.lla_to_ned(lla[0], lla[1], lla[2]);
 
-  double lat0 = initial_lat_;
-  double lon0 = initial_lon_;
-  double alt0 = initial_alt_;
+  // Down is the altitude below the origin, as the estimator reports it, rather than the depth
+  // below the tangent plane.
+  double d = -(lla[2] - initial_alt_);
 
-  double n = EARTH_RADIUS * (lat1 - lat0) * M_PI / 180.0;
-  double e = EARTH_RADIUS * cos(lat0 * M_PI / 180.0) * (lon1 - lon0) * M_PI / 180.0;
-  double d = -(alt1 - alt0);
+  check_origin();
 
+  return std::array<double, 3>{ned(0), ned(1), d};
+}
+
+std::vector<std::array<double, 3>>
+PathPlanner::lla2ned(const std::vector<std::array<float, 3>> & lla)
+{
+  std::vector<Eigen::Vector3d> points;
+  points.reserve(lla.size());
+  for (const std::array<float, 3> & point : lla) {
+    points.emplace_back(point[0], point[1], point[2]);
+  }
+
+  std::vector<Eigen::Vector3d> ned = origin_.lla_to_ned(points);
+
+  std::vector<std::array<double, 3>> result;
+  result.reserve(ned.size());
+  for (std::size_t i = 0; i < ned.size(); i++) {
+    result.push_back(std::array<double, 3>{ned[i](0), ned[i](1), -(lla[i][2] - initial_alt_)});
+  }
+
+  check_origin();
+
+  return result;
+}
+
+void PathPlanner::check_origin()
+{
   // Usually will not be flying exactly at these locations.
   // If the GPS reports (0,0,0), it most likely means there is an error with the GPS
   if (fabs(initial_lat_) == 0.0 || fabs(initial_lon_) == 0.0 || fabs(initial_alt_) == 0.0) {
     RCLCPP_WARN_STREAM(this->get_logger(),
-                       "NED position set to ["
-                         << n << "," << e << "," << d
-                         << "]! Waypoints may be incorrect. Check GPS health");
+                       "NED origin set to [" << initial_lat_ << "," << initial_lon_ << ","
+                                             << initial_alt_
+                                             << "]! Waypoints may be incorrect. Check GPS health");
   }
-
-  return std::array<double, 3>{n, e, d};
 }
 
 rcl_interfaces::msg::SetParametersResult
@@ -323,13 +367,5 @@ void PathPlanner::declare_parameters()
 
 } // namespace rosplane
 
-int main(int argc, char ** argv)
-{
-  rclcpp::init(argc, argv);
-
-  auto node = std::make_shared<rosplane::PathPlanner>();
-
-  rclcpp::spin(node);
-
-  return 0;
-}
+#include <rclcpp_components/register_node_macro.hpp>
+RCLCPP_COMPONENTS_REGISTER_NODE(rosplane::PathPlanner)